@@ -0,0 +1,280 @@
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#include "asyncio.h"
+
+
+//
+// io_uring
+//
+// There is no liburing here, so this sets up the rings itself.  We
+// are the only producer of submissions and the only consumer of
+// completions, and the kernel is the other side of each.
+//
+
+static int uring_setup(const unsigned entries, struct io_uring_params *p)
+{
+  return syscall(__NR_io_uring_setup,entries,p);
+}
+
+static int uring_enter(const int fd, const unsigned submit, const unsigned wait, const unsigned flags)
+{
+  return syscall(__NR_io_uring_enter,fd,submit,wait,flags,0,0);
+}
+
+URingIO::URingIO() :
+  ringfd(-1), sqring(0), cqring(0), sqringlen(0), cqringlen(0), sqeslen(0),
+  sqes(0), cqes(0), inflight(0)
+{}
+
+URingIO::~URingIO()
+{
+  if (sqes) {
+    munmap(sqes,sqeslen);
+  }
+  if (cqring && cqring!=sqring) {
+    munmap(cqring,cqringlen);
+  }
+  if (sqring) {
+    munmap(sqring,sqringlen);
+  }
+  if (ringfd>=0) {
+    close(ringfd);
+  }
+}
+
+ERROR_T URingIO::Init()
+{
+  struct io_uring_params p;
+  void *m;
+
+  memset(&p,0,sizeof(p));
+  if ((ringfd=uring_setup(ASYNCIO_DEPTH,&p))<0) {
+    return ERROR_UNIMPL;
+  }
+  // IORING_OP_READ and IORING_OP_WRITE came in with this
+  if (!(p.features & IORING_FEAT_RW_CUR_POS)) {
+    return ERROR_UNIMPL;
+  }
+
+  sqringlen=p.sq_off.array+p.sq_entries*sizeof(unsigned);
+  cqringlen=p.cq_off.cqes+p.cq_entries*sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    sqringlen=cqringlen=(sqringlen>cqringlen ? sqringlen : cqringlen);
+  }
+
+  if ((m=mmap(0,sqringlen,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,ringfd,IORING_OFF_SQ_RING))==MAP_FAILED) {
+    return ERROR_NOMEM;
+  }
+  sqring=(BYTE_T*)m;
+
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    cqring=sqring;
+  } else {
+    if ((m=mmap(0,cqringlen,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,ringfd,IORING_OFF_CQ_RING))==MAP_FAILED) {
+      return ERROR_NOMEM;
+    }
+    cqring=(BYTE_T*)m;
+  }
+
+  sqeslen=p.sq_entries*sizeof(struct io_uring_sqe);
+  if ((m=mmap(0,sqeslen,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,ringfd,IORING_OFF_SQES))==MAP_FAILED) {
+    return ERROR_NOMEM;
+  }
+  sqes=(struct io_uring_sqe *)m;
+
+  sqhead=(unsigned*)(sqring+p.sq_off.head);
+  sqtail=(unsigned*)(sqring+p.sq_off.tail);
+  sqmask=(unsigned*)(sqring+p.sq_off.ring_mask);
+  sqarray=(unsigned*)(sqring+p.sq_off.array);
+  cqhead=(unsigned*)(cqring+p.cq_off.head);
+  cqtail=(unsigned*)(cqring+p.cq_off.tail);
+  cqmask=(unsigned*)(cqring+p.cq_off.ring_mask);
+  cqes=(struct io_uring_cqe *)(cqring+p.cq_off.cqes);
+
+  return ERROR_NOERROR;
+}
+
+ERROR_T URingIO::Submit(const bool write, const int fd, const off_t off,
+			BYTE_T *buf, const size_t len, const SIZE_T tag)
+{
+  unsigned tail=*sqtail;
+  unsigned index=tail & *sqmask;
+  struct io_uring_sqe *sqe=&(sqes[index]);
+
+  memset(sqe,0,sizeof(*sqe));
+  sqe->opcode=write ? IORING_OP_WRITE : IORING_OP_READ;
+  sqe->fd=fd;
+  sqe->off=off;
+  sqe->addr=(unsigned long)buf;
+  sqe->len=len;
+  sqe->user_data=tag;
+  sqarray[index]=index;
+
+  // the entry has to be filled in before the kernel can see it
+  __atomic_store_n(sqtail,tail+1,__ATOMIC_RELEASE);
+
+  int rc;
+  while ((rc=uring_enter(ringfd,1,0,0))<0 && errno==EINTR) {
+  }
+  if (rc<0) {
+    // Without a polling thread the kernel only takes entries during
+    // io_uring_enter.  If it didn't take this one, withdraw it so that
+    // the caller can do the transfer itself.  If it did, the transfer
+    // is under way, and the caller must not touch buf until it is
+    // reaped.
+    if (__atomic_load_n(sqhead,__ATOMIC_ACQUIRE)==tail) {
+      __atomic_store_n(sqtail,tail,__ATOMIC_RELEASE);
+      return ERROR_IMPLBUG;
+    }
+  }
+  inflight++;
+  return ERROR_NOERROR;
+}
+
+ERROR_T URingIO::Reap(vector<pair<SIZE_T, ssize_t> > &done, const SIZE_T min)
+{
+  SIZE_T got=0;
+
+  for (;;) {
+    unsigned head=*cqhead;
+    unsigned tail=__atomic_load_n(cqtail,__ATOMIC_ACQUIRE);
+
+    for (; head!=tail; head++) {
+      struct io_uring_cqe *cqe=&(cqes[head & *cqmask]);
+      done.push_back(make_pair((SIZE_T)cqe->user_data,(ssize_t)cqe->res));
+      got++;
+      inflight--;
+    }
+    __atomic_store_n(cqhead,head,__ATOMIC_RELEASE);
+
+    if (got>=min || inflight==0) {
+      return ERROR_NOERROR;
+    }
+    if (uring_enter(ringfd,0,1,IORING_ENTER_GETEVENTS)<0 && errno!=EINTR) {
+      return ERROR_IMPLBUG;
+    }
+  }
+}
+
+
+//
+// Thread pool
+//
+
+ThreadPoolIO::ThreadPoolIO(const SIZE_T numthreads) : stopping(false), inflight(0)
+{
+  for (SIZE_T i=0; i<numthreads; i++) {
+    workers.push_back(thread(&ThreadPoolIO::Worker,this));
+  }
+}
+
+ThreadPoolIO::~ThreadPoolIO()
+{
+  {
+    lock_guard<mutex> l(lock);
+    stopping=true;
+  }
+  queued.notify_all();
+  for (SIZE_T i=0; i<workers.size(); i++) {
+    workers[i].join();
+  }
+}
+
+void ThreadPoolIO::Worker()
+{
+  unique_lock<mutex> l(lock);
+
+  for (;;) {
+    while (jobs.empty() && !stopping) {
+      queued.wait(l);
+    }
+    if (jobs.empty()) {
+      return;
+    }
+    Job j=jobs.front();
+    jobs.pop_front();
+
+    l.unlock();
+    ssize_t rc;
+    do {
+      rc = j.write ? pwrite(j.fd,j.buf,j.len,j.off) : pread(j.fd,j.buf,j.len,j.off);
+    } while (rc<0 && errno==EINTR);
+    if (rc<0) {
+      rc=-errno;
+    }
+    l.lock();
+
+    results.push_back(make_pair(j.tag,rc));
+    finished.notify_all();
+  }
+}
+
+ERROR_T ThreadPoolIO::Submit(const bool write, const int fd, const off_t off,
+			     BYTE_T *buf, const size_t len, const SIZE_T tag)
+{
+  Job j;
+
+  j.write=write;
+  j.fd=fd;
+  j.off=off;
+  j.buf=buf;
+  j.len=len;
+  j.tag=tag;
+
+  {
+    lock_guard<mutex> l(lock);
+    jobs.push_back(j);
+    inflight++;
+  }
+  queued.notify_one();
+  return ERROR_NOERROR;
+}
+
+ERROR_T ThreadPoolIO::Reap(vector<pair<SIZE_T, ssize_t> > &done, const SIZE_T min)
+{
+  unique_lock<mutex> l(lock);
+
+  while (results.size()<min && results.size()<inflight) {
+    finished.wait(l);
+  }
+  done.insert(done.end(),results.begin(),results.end());
+  inflight-=results.size();
+  results.clear();
+  return ERROR_NOERROR;
+}
+
+
+AsyncIO *CreateAsyncIO(const AsyncIOType type)
+{
+  switch (type) {
+  case ASYNCIO_URING: {
+    URingIO *u=new URingIO();
+    if (u->Init()!=ERROR_NOERROR) {
+      delete u;
+      return 0;
+    }
+    return u;
+  }
+  case ASYNCIO_THREADS:
+    return new ThreadPoolIO();
+  default:
+    return 0;
+  }
+}
+
+const char *GetAsyncIOName(const AsyncIOType type)
+{
+  switch (type) {
+  case ASYNCIO_URING:
+    return "io_uring";
+  case ASYNCIO_THREADS:
+    return "threads";
+  default:
+    return "UNKNOWN";
+  }
+}
@@ -0,0 +1,123 @@
+#ifndef _asyncio
+#define _asyncio
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <sys/types.h>
+
+#include "global.h"
+
+using namespace std;
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+//
+// Asynchronous positioned reads and writes on file descriptors
+//
+// Transfers are submitted with a tag and come back, in whatever order
+// they finish, from Reap as (tag, result) pairs, where the result is
+// the number of bytes moved or -errno.  A transfer may come up short,
+// and it is up to the caller to finish it off.  Nothing here orders
+// overlapping transfers either; that is up to the caller too.
+//
+// URING    Linux io_uring, talked to directly through the system calls
+// THREADS  a small pool of threads doing pread/pwrite, for where
+//          io_uring is missing or disabled
+//
+enum AsyncIOType {ASYNCIO_URING, ASYNCIO_THREADS};
+
+// Most transfers in flight at once
+#define ASYNCIO_DEPTH 64
+// Size of the thread pool
+#define ASYNCIO_NUMTHREADS 4
+
+
+class AsyncIO {
+ public:
+  virtual ~AsyncIO() {}
+
+  virtual AsyncIOType GetType() const = 0;
+
+  // Start a transfer of len bytes between buf and fd at off.  buf
+  // must stay put until the transfer is reaped.  The caller keeps
+  // at most ASYNCIO_DEPTH in flight.  A failed Submit has not started
+  // the transfer and will not report it.
+  virtual ERROR_T Submit(const bool write, const int fd, const off_t off,
+			 BYTE_T *buf, const size_t len, const SIZE_T tag) = 0;
+  // Collect finished transfers, waiting until there are at least min
+  virtual ERROR_T Reap(vector<pair<SIZE_T, ssize_t> > &done, const SIZE_T min) = 0;
+  virtual SIZE_T  GetNumInFlight() const = 0;
+};
+
+
+class URingIO : public AsyncIO {
+ private:
+  int     ringfd;
+  BYTE_T *sqring, *cqring;
+  size_t  sqringlen, cqringlen, sqeslen;
+  // the shared ring indices, and the arrays they index
+  unsigned *sqhead, *sqtail, *sqmask, *sqarray;
+  unsigned *cqhead, *cqtail, *cqmask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  SIZE_T  inflight;
+
+ public:
+  URingIO();
+  ~URingIO();
+
+  // Sets up the ring.  Fails if the kernel has no io_uring, or one
+  // too old to do plain reads and writes.
+  ERROR_T Init();
+
+  AsyncIOType GetType() const { return ASYNCIO_URING; }
+  ERROR_T Submit(const bool write, const int fd, const off_t off,
+		 BYTE_T *buf, const size_t len, const SIZE_T tag);
+  ERROR_T Reap(vector<pair<SIZE_T, ssize_t> > &done, const SIZE_T min);
+  SIZE_T  GetNumInFlight() const { return inflight; }
+};
+
+
+class ThreadPoolIO : public AsyncIO {
+ private:
+  struct Job {
+    bool    write;
+    int     fd;
+    off_t   off;
+    BYTE_T *buf;
+    size_t  len;
+    SIZE_T  tag;
+  };
+
+  mutex                          lock;
+  condition_variable             queued, finished;
+  deque<Job>                     jobs;
+  vector<pair<SIZE_T, ssize_t> > results;
+  vector<thread>                 workers;
+  bool                           stopping;
+  SIZE_T                         inflight;
+
+  void Worker();
+
+ public:
+  ThreadPoolIO(const SIZE_T numthreads=ASYNCIO_NUMTHREADS);
+  ~ThreadPoolIO();
+
+  AsyncIOType GetType() const { return ASYNCIO_THREADS; }
+  ERROR_T Submit(const bool write, const int fd, const off_t off,
+		 BYTE_T *buf, const size_t len, const SIZE_T tag);
+  ERROR_T Reap(vector<pair<SIZE_T, ssize_t> > &done, const SIZE_T min);
+  SIZE_T  GetNumInFlight() const { return inflight; }
+};
+
+
+// returns 0 if that kind can't be had here
+AsyncIO *CreateAsyncIO(const AsyncIOType type);
+const char *GetAsyncIOName(const AsyncIOType type);
+
+#endif
@@ -0,0 +1,224 @@
+#include <unistd.h>
+#include <errno.h>
+#include <endian.h>
+
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+
+#include "bitmap.h"
+
+// Bytes of the file per dirty page
+#define BITMAP_PAGE_BYTES 4096
+#define BITMAP_PAGE_WORDS (BITMAP_PAGE_BYTES/8)
+
+// The bits a..b-1 of a word, counting from the most significant
+static inline uint64_t WordMask(const SIZE_T a, const SIZE_T b)
+{
+  uint64_t lo = a==0 ? ~(uint64_t)0 : ~(uint64_t)0 >> a;
+  uint64_t hi = b==64 ? ~(uint64_t)0 : ~(~(uint64_t)0 >> b);
+  return lo & hi;
+}
+
+AllocationBitmap::AllocationBitmap() : numbits(0)
+{
+}
+
+void AllocationBitmap::Resize(const SIZE_T bits)
+{
+  numbits=bits;
+  words.assign((numbits+63)/64,0);
+  pagedirty.assign((words.size()+BITMAP_PAGE_WORDS-1)/BITMAP_PAGE_WORDS,false);
+  dirtypages.clear();
+  if (words.size()>0) {
+    MarkDirty(0,words.size()-1);
+  }
+}
+
+SIZE_T AllocationBitmap::GetNumBits() const
+{
+  return numbits;
+}
+
+void AllocationBitmap::MarkDirty(const SIZE_T firstword, const SIZE_T lastword)
+{
+  for (SIZE_T p=firstword/BITMAP_PAGE_WORDS; p<=lastword/BITMAP_PAGE_WORDS; p++) {
+    if (!pagedirty[p]) {
+      pagedirty[p]=true;
+      dirtypages.push_back(p);
+    }
+  }
+}
+
+bool AllocationBitmap::IsSet(const SIZE_T bit) const
+{
+  return (words[bit/64] >> (63-bit%64)) & 0x1;
+}
+
+void AllocationBitmap::Update(const SIZE_T first, const SIZE_T num, const bool set)
+{
+  if (num==0) {
+    return;
+  }
+
+  SIZE_T last=first+num-1;
+  SIZE_T fw=first/64, lw=last/64;
+
+  for (SIZE_T w=fw; w<=lw; w++) {
+    uint64_t mask=WordMask(w==fw ? first%64 : 0, w==lw ? last%64+1 : 64);
+    if (set) {
+      words[w] |= mask;
+    } else {
+      words[w] &= ~mask;
+    }
+  }
+  MarkDirty(fw,lw);
+}
+
+void AllocationBitmap::Set(const SIZE_T first, const SIZE_T num)
+{
+  Update(first,num,true);
+}
+
+void AllocationBitmap::Clear(const SIZE_T first, const SIZE_T num)
+{
+  Update(first,num,false);
+}
+
+SIZE_T AllocationBitmap::Count(const SIZE_T first, const SIZE_T num) const
+{
+  if (num==0) {
+    return 0;
+  }
+
+  SIZE_T last=first+num-1;
+  SIZE_T fw=first/64, lw=last/64;
+  SIZE_T n=0;
+
+  for (SIZE_T w=fw; w<=lw; w++) {
+    n+=__builtin_popcountll(words[w] & WordMask(w==fw ? first%64 : 0, w==lw ? last%64+1 : 64));
+  }
+  return n;
+}
+
+SIZE_T AllocationBitmap::FindClear(const SIZE_T from) const
+{
+  if (from>=numbits) {
+    return numbits;
+  }
+
+  SIZE_T w=from/64;
+  // count the bits before from as set
+  uint64_t free=~(words[w] | ~WordMask(from%64,64));
+
+  while (!free) {
+    if (++w>=words.size()) {
+      return numbits;
+    }
+    free=~words[w];
+  }
+
+  SIZE_T bit=w*64+__builtin_clzll(free);
+  return bit<numbits ? bit : numbits;
+}
+
+
+ERROR_T AllocationBitmap::Read(const int fd)
+{
+  SIZE_T numbytes=(numbits+7)/8;
+  vector<BYTE_T> buf(words.size()*8,0);
+  SIZE_T done=0;
+
+  while (done<numbytes) {
+    ssize_t got=pread(fd,&(buf[done]),numbytes-done,done);
+    if (got<0 && errno==EINTR) {
+      continue;
+    }
+    if (got<=0) {
+      return ERROR_NOFILE;
+    }
+    done+=got;
+  }
+
+  for (SIZE_T w=0;w<words.size();w++) {
+    uint64_t be;
+    memcpy(&be,&(buf[w*8]),8);
+    words[w]=be64toh(be);
+  }
+
+  pagedirty.assign(pagedirty.size(),false);
+  dirtypages.clear();
+  return ERROR_NOERROR;
+}
+
+ERROR_T AllocationBitmap::Write(const int fd)
+{
+  SIZE_T numbytes=(numbits+7)/8;
+  vector<BYTE_T> buf;
+
+  // runs of adjacent dirty pages go out together
+  sort(dirtypages.begin(),dirtypages.end());
+
+  for (SIZE_T i=0; i<dirtypages.size(); ) {
+    SIZE_T j=i+1;
+    while (j<dirtypages.size() && dirtypages[j]==dirtypages[j-1]+1) {
+      j++;
+    }
+
+    SIZE_T fw=dirtypages[i]*BITMAP_PAGE_WORDS;
+    SIZE_T lw=min((SIZE_T)(dirtypages[j-1]+1)*BITMAP_PAGE_WORDS,(SIZE_T)words.size());
+    SIZE_T start=fw*8;
+    SIZE_T end=min(lw*8,numbytes);
+
+    buf.resize((lw-fw)*8);
+    for (SIZE_T w=fw;w<lw;w++) {
+      uint64_t be=htobe64(words[w]);
+      memcpy(&(buf[(w-fw)*8]),&be,8);
+    }
+
+    for (SIZE_T done=start; done<end; ) {
+      ssize_t sent=pwrite(fd,&(buf[done-start]),end-done,done);
+      if (sent<0 && errno==EINTR) {
+	continue;
+      }
+      if (sent<=0) {
+	return ERROR_NOFILE;
+      }
+      done+=sent;
+    }
+
+    for (SIZE_T k=i;k<j;k++) {
+      pagedirty[dirtypages[k]]=false;
+    }
+    i=j;
+  }
+
+  dirtypages.clear();
+  return ERROR_NOERROR;
+}
+
+SIZE_T AllocationBitmap::GetNumDirtyPages() const
+{
+  return dirtypages.size();
+}
+
+
+ostream & AllocationBitmap::Print(ostream &os) const
+{
+  string s;
+
+  for (SIZE_T w=0;w<words.size();w++) {
+    SIZE_T n=min((SIZE_T)64,numbits-w*64);
+    if (words[w]==0) {
+      s.append(n,'.');
+    } else if (words[w]==~(uint64_t)0) {
+      s.append(n,'*');
+    } else {
+      for (SIZE_T k=0;k<n;k++) {
+	s+=((words[w]>>(63-k)) & 0x1) ? '*' : '.';
+      }
+    }
+  }
+  return os << s;
+}
@@ -0,0 +1,62 @@
+#ifndef _bitmap
+#define _bitmap
+
+#include <iostream>
+#include <vector>
+
+#include <stdint.h>
+
+#include "global.h"
+
+using namespace std;
+
+//
+// The allocation bitmap of a disk, one bit per block
+//
+// Bits are kept 64 to a word, so that ranges are set and cleared a
+// word at a time, and counting and searching use popcount and count
+// leading zeros.  The file layout is unchanged from the byte at a
+// time version: block b is bit 7-b%8 of byte b/8.  The words are
+// big endian images of eight of those bytes.
+//
+// Changes are tracked by page of the file, and Write only writes
+// back the pages changed since the last Read or Write.
+//
+class AllocationBitmap {
+ private:
+  vector<uint64_t> words;
+  SIZE_T           numbits;
+  // pages of the file changed since the last Read or Write, and
+  // which they are, in the order first changed
+  vector<bool>     pagedirty;
+  vector<SIZE_T>   dirtypages;
+
+  void    MarkDirty(const SIZE_T firstword, const SIZE_T lastword);
+  // Set or clear first..first+num-1
+  void    Update(const SIZE_T first, const SIZE_T num, const bool set);
+
+ public:
+  AllocationBitmap();
+
+  // All clear, and all to be written
+  void    Resize(const SIZE_T bits);
+  SIZE_T  GetNumBits() const;
+
+  bool    IsSet(const SIZE_T bit) const;
+  void    Set(const SIZE_T first, const SIZE_T num=1);
+  void    Clear(const SIZE_T first, const SIZE_T num=1);
+  // How many of first..first+num-1 are set
+  SIZE_T  Count(const SIZE_T first, const SIZE_T num) const;
+  // The first clear bit at or after from, or GetNumBits() if none
+  SIZE_T  FindClear(const SIZE_T from=0) const;
+
+  // The whole file, and the changed pages of it
+  ERROR_T Read(const int fd);
+  ERROR_T Write(const int fd);
+  SIZE_T  GetNumDirtyPages() const;
+
+  // * for set, . for clear
+  ostream & Print(ostream &os) const;
+};
+
+#endif
@@ -30,10 +30,12 @@ KeyValuePair & KeyValuePair::operator=(const KeyValuePair &rhs)
 BTreeIndex::BTreeIndex(SIZE_T keysize, 
 		       SIZE_T valuesize,
 		       BufferCache *cache,
-		       bool unique) 
+		       bool unique,
+		       bool prefixkeys) 
 {
   superblock.info.keysize=keysize;
   superblock.info.valuesize=valuesize;
+  superblock.info.prefixkeys=prefixkeys;
   buffercache=cache;
   // note: ignoring unique now
 }
@@ -74,13 +76,20 @@ ERROR_T BTreeIndex::AllocateNode(SIZE_T &n)
     return ERROR_NOSPACE;
   }
 
-  BTreeNode node;
+  BTreeNodeView node;
+  ERROR_T rc;
+
+  rc=node.Attach(buffercache,n);
+
+  if (rc) { 
+    return rc;
+  }
 
-  node.Unserialize(buffercache,n);
+  assert(node.info->nodetype==BTREE_UNALLOCATED_BLOCK);
 
-  assert(node.info.nodetype==BTREE_UNALLOCATED_BLOCK);
+  superblock.info.freelist=node.info->freelist;
 
-  superblock.info.freelist=node.info.freelist;
+  node.Release();
 
   superblock.Serialize(buffercache,superblock_index);
 
@@ -93,17 +102,23 @@ ERROR_T BTreeIndex::AllocateNode(SIZE_T &n)
 
 ERROR_T BTreeIndex::DeallocateNode(const SIZE_T &n)
 {
-  BTreeNode node;
+  BTreeNodeView node;
+  ERROR_T rc;
+
+  rc=node.Attach(buffercache,n);
 
-  node.Unserialize(buffercache,n);
+  if (rc) { 
+    return rc;
+  }
 
-  assert(node.info.nodetype!=BTREE_UNALLOCATED_BLOCK);
+  assert(node.info->nodetype!=BTREE_UNALLOCATED_BLOCK);
 
-  node.info.nodetype=BTREE_UNALLOCATED_BLOCK;
+  node.info->nodetype=BTREE_UNALLOCATED_BLOCK;
 
-  node.info.freelist=superblock.info.freelist;
+  node.info->freelist=superblock.info.freelist;
 
-  node.Serialize(buffercache,n);
+  node.MarkDirty();
+  node.Release();
 
   superblock.info.freelist=n;
 
@@ -136,6 +151,7 @@ ERROR_T BTreeIndex::Attach(const SIZE_T initblock, const bool create)
     newsuperblock.info.freelist=superblock_index+2;
     newsuperblock.info.numkeys=0;
 	newsuperblock.info.parentnode=0;
+    newsuperblock.info.prefixkeys=superblock.info.prefixkeys;
 
     buffercache->NotifyAllocateBlock(superblock_index);
 
@@ -145,32 +161,46 @@ ERROR_T BTreeIndex::Attach(const SIZE_T initblock, const bool create)
       return rc;
     }
     
-    BTreeNode newrootnode(BTREE_ROOT_NODE,
+    buffercache->NotifyAllocateBlock(superblock_index+1);
+
+    BTreeNodeView newrootnode;
+    rc=newrootnode.Create(buffercache,
+			  superblock_index+1,
+			  BTREE_ROOT_NODE,
 			  superblock.info.keysize,
-			  superblock.info.valuesize,
-			  buffercache->GetBlockSize());
-    newrootnode.info.rootnode=superblock_index+1;
-    newrootnode.info.freelist=superblock_index+2;
-    newrootnode.info.numkeys=0;
-	newrootnode.info.parentnode=0;
+			  superblock.info.valuesize);
 
-    buffercache->NotifyAllocateBlock(superblock_index+1);
+    if (rc) { 
+      return rc;
+    }
+
+    newrootnode.info->rootnode=superblock_index+1;
+    newrootnode.info->freelist=superblock_index+2;
+    newrootnode.info->numkeys=0;
+	newrootnode.info->parentnode=0;
 
-    rc=newrootnode.Serialize(buffercache,superblock_index+1);
+    rc=newrootnode.Release();
 
     if (rc) { 
       return rc;
     }
 
     for (SIZE_T i=superblock_index+2; i<buffercache->GetNumBlocks();i++) { 
-      BTreeNode newfreenode(BTREE_UNALLOCATED_BLOCK,
+      BTreeNodeView newfreenode;
+      rc=newfreenode.Create(buffercache,
+			    i,
+			    BTREE_UNALLOCATED_BLOCK,
 			    superblock.info.keysize,
-			    superblock.info.valuesize,
-			    buffercache->GetBlockSize());
-      newfreenode.info.rootnode=superblock_index+1;
-      newfreenode.info.freelist= ((i+1)==buffercache->GetNumBlocks()) ? 0: i+1;
+			    superblock.info.valuesize);
+
+      if (rc) {
+	return rc;
+      }
+
+      newfreenode.info->rootnode=superblock_index+1;
+      newfreenode.info->freelist= ((i+1)==buffercache->GetNumBlocks()) ? 0: i+1;
       
-      rc = newfreenode.Serialize(buffercache,i);
+      rc = newfreenode.Release();
 
       if (rc) {
 	return rc;
@@ -196,59 +226,45 @@ ERROR_T BTreeIndex::LookupOrUpdateInternal(const SIZE_T &node,
 					   const KEY_T &key,
 					   VALUE_T &value)
 {
-  BTreeNode b;
+  BTreeNodeView b;
   ERROR_T rc;
   SIZE_T offset;
-  KEY_T testkey;
   SIZE_T ptr;
 
-  rc= b.Unserialize(buffercache,node);
+  rc= b.Attach(buffercache,node);
 
   if (rc!=ERROR_NOERROR) { 
     return rc;
   }
 
-  switch (b.info.nodetype) { 
+  switch (b.info->nodetype) { 
   case BTREE_ROOT_NODE:
   case BTREE_INTERIOR_NODE:
-    // Scan through key/ptr pairs
-    //and recurse if possible
-    for (offset=0;offset<b.info.numkeys;offset++) { 
-      rc=b.GetKey(offset,testkey);
-      if (rc) {  return rc; }
-      if (key<testkey) {
-	// OK, so we now have the first key that's larger
-	// so we ned to recurse on the ptr immediately previous to 
-	// this one, if it exists
-	rc=b.GetPtr(offset,ptr);
-	if (rc) { return rc; }
-	return LookupOrUpdateInternal(ptr,op,key,value);
-      }
-    }
-    // if we got here, we need to go to the next pointer, if it exists
-    if (b.info.numkeys>0) { 
-      rc=b.GetPtr(b.info.numkeys,ptr);
-      if (rc) { return rc; }
-      return LookupOrUpdateInternal(ptr,op,key,value);
-    } else {
+    if (b.info->numkeys==0) { 
       // There are no keys at all on this node, so nowhere to go
       return ERROR_NONEXISTENT;
     }
+    // Recurse on the ptr just before the first key that's larger,
+    // or on the last ptr if there is none
+    offset=b.FindKey(key);
+    rc=b.GetPtr(offset,ptr);
+    if (rc) { return rc; }
+    // only the node we're on stays pinned on the way down
+    rc=b.Release();
+    if (rc) { return rc; }
+    return LookupOrUpdateInternal(ptr,op,key,value);
     break;
   case BTREE_LEAF_NODE:
-    // Scan through keys looking for matching value
-    for (offset=0;offset<b.info.numkeys;offset++) { 
-      rc=b.GetKey(offset,testkey);
-      if (rc) {  return rc; }
-      if (testkey==key) { 
-	if (op==BTREE_OP_LOOKUP) { 
-	  return b.GetVal(offset,value);
-	} else { 
-	  rc=b.SetVal(offset,value);
-    if(rc) { return rc; }
-    return b.Serialize(buffercache, node);
-    //return ERROR_UNIMPL;
-	}
+    // The matching key, if any, is the last one not larger
+    offset=b.FindKey(key);
+    if (offset>0 && b.CompareKey(offset-1,key)==0) { 
+      offset--;
+      if (op==BTREE_OP_LOOKUP) { 
+	return b.GetVal(offset,value);
+      } else { 
+	rc=b.SetVal(offset,value);
+	if(rc) { return rc; }
+	return b.Release();
       }
     }
     return ERROR_NONEXISTENT;
@@ -267,127 +283,67 @@ ERROR_T BTreeIndex::Insert_NotFull(const SIZE_T offset,
 					   const KEY_T &key,
 					   const VALUE_T &value,					   
 					   const SIZE_T &nodenum,
-					   BTreeNode &b)
+					   BTreeNodeView &b)
 {
   
   ERROR_T rc;
-  KEY_T temp_key;
-  VALUE_T temp_val;
-  SIZE_T temp_offset;
-
-  assert(b.info.nodetype == BTREE_LEAF_NODE); //Insert_NotFull should only be called at a leaf node
-	b.info.numkeys++;
-  //First step is to shift all values from offset to the right
-	for (temp_offset=(b.info.numkeys-1);temp_offset>offset;temp_offset--) {
-		//obtain key and value starting from the rightmost kvpair
-		rc = b.GetKey(temp_offset-1,temp_key);
-		if (rc) {  return rc; }
-		rc = b.GetVal(temp_offset-1,temp_val);
-		if (rc) {  return rc; }
-		//save the key/value into the next slot (which should be open since leaf not full)
-		rc = b.SetKey(temp_offset,temp_key);
-		if (rc) {  return rc; }
-		rc = b.SetVal(temp_offset,temp_val);
-		if (rc) {  return rc; }
-	}
-	//all offset+1 pairs should now be right shifted
+
+  assert(b.info->nodetype == BTREE_LEAF_NODE); //Insert_NotFull should only be called at a leaf node
+	//First step is to shift all pairs from offset to the right, in one move
+	rc = b.InsertSlot(offset);
+	if (rc) {  return rc; }
 	rc = b.SetKey(offset,key);//insert new pair into leaf
 	if (rc) {  return rc; }
 	rc = b.SetVal(offset,value);
 	if (rc) {  return rc; }
-	return b.Serialize(buffercache,nodenum);
+	b.MarkDirty();
+	return ERROR_NOERROR;
 }
 
 ERROR_T BTreeIndex::Insert_NotFullParent(const SIZE_T newnode,
 					   const KEY_T &key,
-					   BTreeNode &b,
+					   BTreeNodeView &b,
 					   const SIZE_T nodenum)
 {
 
   ERROR_T rc;
-  SIZE_T temp_offset;
-  SIZE_T temp_ptr;
-  KEY_T temp_key;
   SIZE_T offset;
-  KEY_T testkey;
   
-  assert(b.info.nodetype == BTREE_INTERIOR_NODE || b.info.nodetype == BTREE_ROOT_NODE); //Insert_FullParent should only be called on interior nodes and root nodes.
+  assert(b.info->nodetype == BTREE_INTERIOR_NODE || b.info->nodetype == BTREE_ROOT_NODE); //Insert_FullParent should only be called on interior nodes and root nodes.
   
-  for (offset=0;offset<b.info.numkeys;offset++) { 
-      rc=b.GetKey(offset,testkey);
-      if (rc) {  return rc; }
-      if (key<testkey) {
-	// OK, so we now have the first key that's larger
-	// so we need to recurse on the ptr immediately previous to 
-	// this one, if it exists
-		break;
-	  }
-	}
+  // The new key goes before the first key that's larger
+  offset=b.FindKey(key);
 	
-	b.info.numkeys++;
-	//First step is to shift all values from offset to the right
-	for (temp_offset=(b.info.numkeys-1);temp_offset>offset;temp_offset--) {
-		//obtain key and value starting from the rightmost kvpair
-		rc = b.GetKey(temp_offset-1,temp_key);
-		if (rc) {  return rc; }
-		rc = b.GetPtr(temp_offset,temp_ptr);
-		if (rc) {  return rc; }
-		//save the key/value into the next slot (which should be open since leaf not full)
-		rc = b.SetKey(temp_offset,temp_key);
-		if (rc) {  return rc; }
-		rc = b.SetPtr(temp_offset+1,temp_ptr);
-		if (rc) {  return rc; }
-	}
-	//all offset+1 pairs should now be right shifted
+	//First step is to shift all key/ptr pairs from offset to the right, in one move
+	rc = b.InsertSlot(offset);
+	if (rc) {  return rc; }
 	rc = b.SetKey(offset,key);//insert new pair into leaf
 	if (rc) {  return rc; }
 	rc = b.SetPtr(offset+1,newnode);
 	if (rc) {  return rc; }
-	return b.Serialize(buffercache,nodenum);
+	b.MarkDirty();
+	return ERROR_NOERROR;
 }
 
 ERROR_T BTreeIndex::Insert_FullParent(const SIZE_T &newnode,
 					   const KEY_T &key,
-					   BTreeNode &b,
+					   BTreeNodeView &b,
 					   SIZE_T &nodenum)
 {
 
   ERROR_T rc;
-  SIZE_T temp_offset;
   SIZE_T temp_ptr;
   KEY_T temp_key;
   SIZE_T offset;
-  KEY_T testkey;
   
-  assert(b.info.nodetype == BTREE_INTERIOR_NODE || b.info.nodetype == BTREE_ROOT_NODE); //Insert_FullParent should only be called on interior nodes and root nodes.
+  assert(b.info->nodetype == BTREE_INTERIOR_NODE || b.info->nodetype == BTREE_ROOT_NODE); //Insert_FullParent should only be called on interior nodes and root nodes.
   
-  
-  for (offset=0;offset<b.info.numkeys;offset++) { 
-      rc=b.GetKey(offset,testkey);
-      if (rc) {  return rc; }
-      if (key<testkey) {
-	// OK, so we now have the first key that's larger
-	// so we need to recurse on the ptr immediately previous to 
-	// this one, if it exists
-		break;
-	  }
-	}
+  // The new key goes before the first key that's larger
+  offset=b.FindKey(key);
 
-	b.info.numkeys++;
-  //First step is to shift all values from offset to the right
-	for (temp_offset=(b.info.numkeys-1);temp_offset>offset;temp_offset--) {
-		//obtain key and value starting from the rightmost kvpair
-		rc = b.GetKey(temp_offset-1,temp_key);
-		if (rc) {  return rc; }
-		rc = b.GetPtr(temp_offset,temp_ptr);
-		if (rc) {  return rc; }
-		//save the key/value into the next slot (which should be open since leaf not full)
-		rc = b.SetKey(temp_offset,temp_key);
-		if (rc) {  return rc; }
-		rc = b.SetPtr(temp_offset+1,temp_ptr);
-		if (rc) {  return rc; }
-	}
-	//all offset+1 pairs should now be right shifted
+	//First step is to shift all key/ptr pairs from offset to the right, in one move
+	rc = b.InsertSlot(offset);
+	if (rc) {  return rc; }
 	rc = b.SetKey(offset,key);//insert new pair into leaf
 	if (rc) {  return rc; }
 	rc = b.SetPtr(offset+1,newnode);
@@ -395,13 +351,17 @@ ERROR_T BTreeIndex::Insert_FullParent(const SIZE_T &newnode,
 
 	rc = Split(nodenum,b,temp_ptr,temp_key);
 	if (rc) {  return rc; }
- 	BTreeNode parent;
- 	parent.Unserialize(buffercache,b.info.parentnode);
- 	if (parent.info.numkeys < (2*b.info.GetNumSlotsAsInterior()/3)) {
- 	//if (parent.info.numkeys < 4) {
- 		return Insert_NotFullParent(temp_ptr,temp_key,parent,b.info.parentnode);
+ 	SIZE_T parentnum=b.info->parentnode;
+ 	rc = b.Release(); //done with this node before going up
+ 	if (rc) {  return rc; }
+ 	BTreeNodeView parent;
+ 	rc = parent.Attach(buffercache,parentnum);
+ 	if (rc) {  return rc; }
+ 	if (parent.info->numkeys < (2*parent.info->GetNumSlotsAsInterior()/3)) {
+ 	//if (parent.info->numkeys < 4) {
+ 		return Insert_NotFullParent(temp_ptr,temp_key,parent,parentnum);
  	} else {
- 		return Insert_FullParent(temp_ptr,temp_key,parent,b.info.parentnode);
+ 		return Insert_FullParent(temp_ptr,temp_key,parent,parentnum);
 	}
 }  
 
@@ -409,30 +369,15 @@ ERROR_T BTreeIndex::Insert_Full(const SIZE_T offset,
 					   const KEY_T &key,
 					   const VALUE_T &value,
 					   SIZE_T &nodenum,
-					   BTreeNode &b)
+					   BTreeNodeView &b)
 {
   ERROR_T rc;
-  SIZE_T temp_offset;
   KEY_T temp_key;
   SIZE_T temp_ptr;
-  VALUE_T temp_val;
-
-  // PSEUDOCODE
-	b.info.numkeys++;
-  //First step is to shift all values from offset to the right
-	for (temp_offset=(b.info.numkeys-1);temp_offset>offset;temp_offset--) {
-		//obtain key and value starting from the rightmost kvpair
-		rc = b.GetKey(temp_offset-1,temp_key);
-		if (rc) {  return rc; }
-		rc = b.GetVal(temp_offset-1,temp_val);
-		if (rc) {  return rc; }
-		//save the key/value into the next slot (which should be open since leaf not full)
-		rc = b.SetKey(temp_offset,temp_key);
-		if (rc) {  return rc; }
-		rc = b.SetVal(temp_offset,temp_val);
-		if (rc) {  return rc; }
-	}
-	//all offset+1 pairs should now be right shifted
+
+	//First step is to shift all pairs from offset to the right, in one move
+	rc = b.InsertSlot(offset);
+	if (rc) {  return rc; }
 	rc = b.SetKey(offset,key);//insert new pair into leaf
 	if (rc) {  return rc; }
 	rc = b.SetVal(offset,value);
@@ -440,13 +385,17 @@ ERROR_T BTreeIndex::Insert_Full(const SIZE_T offset,
 	rc=Split(nodenum,b,temp_ptr,temp_key);
 	if (rc) {  return rc; }
 
- 	BTreeNode parent;
- 	parent.Unserialize(buffercache,b.info.parentnode);
- 	if (parent.info.numkeys < (2*b.info.GetNumSlotsAsInterior()/3)) {
- 	//if (parent.info.numkeys < 4) {
- 		return Insert_NotFullParent(temp_ptr,temp_key,parent,b.info.parentnode);
+ 	SIZE_T parentnum=b.info->parentnode;
+ 	rc = b.Release(); //done with this node before going up
+ 	if (rc) {  return rc; }
+ 	BTreeNodeView parent;
+ 	rc = parent.Attach(buffercache,parentnum);
+ 	if (rc) {  return rc; }
+ 	if (parent.info->numkeys < (2*parent.info->GetNumSlotsAsInterior()/3)) {
+ 	//if (parent.info->numkeys < 4) {
+ 		return Insert_NotFullParent(temp_ptr,temp_key,parent,parentnum);
  	} else {
- 		return Insert_FullParent(temp_ptr,temp_key,parent,b.info.parentnode);
+ 		return Insert_FullParent(temp_ptr,temp_key,parent,parentnum);
 	}
 }  
 
@@ -457,40 +406,28 @@ ERROR_T BTreeIndex::InsertInternal(SIZE_T &nodenum,
 					   const KEY_T &key,
 					   const VALUE_T &value)
 {
-  BTreeNode b;
+  BTreeNodeView b;
   ERROR_T rc;
   SIZE_T offset;
-  KEY_T testkey;
   SIZE_T ptr;
-  KeyValuePair kvpair(key,value); //syntax for use would be b.SetKeyVal(&kvpair)
 
-  rc= b.Unserialize(buffercache,nodenum);
+  rc= b.Attach(buffercache,nodenum);
 
   if (rc!=ERROR_NOERROR) { 
 	return rc;
   }
 
-  switch (b.info.nodetype) { 
+  switch (b.info->nodetype) { 
 		case BTREE_ROOT_NODE:			
 		case BTREE_INTERIOR_NODE:
-			// Treat rootnodes the same as interiornodes. find the correct ptr
-			// Scan through key/ptr pairs
-			//and recurse if possible
-			for (offset=0;offset<b.info.numkeys;offset++) { 
-				rc=b.GetKey(offset,testkey);
-				if (rc) {  return rc; }
-				if (key<testkey) {
-			// OK, so we now have the first key that's larger
-			// so we need to recurse on the ptr immediately previous to 
-			// this one, if it exists
-			rc=b.GetPtr(offset,ptr);
-			if (rc) { return rc; }
-			return InsertInternal(ptr,op,key,value);
-			  }
-			}
-			// if we got here, we need to go to the next/last pointer, if it exists
-			if (b.info.numkeys>0) { 
-				rc=b.GetPtr(b.info.numkeys,ptr);
+			// Treat rootnodes the same as interiornodes. find the correct ptr:
+			// the one just before the first key that's larger,
+			// or the last one if there is none
+			if (b.info->numkeys>0) { 
+				offset=b.FindKey(key);
+				rc=b.GetPtr(offset,ptr);
+				if (rc) { return rc; }
+				rc=b.Release(); //only the node we're on stays pinned on the way down
 				if (rc) { return rc; }
 				return InsertInternal(ptr,op,key,value);
 			} else {
@@ -500,7 +437,7 @@ ERROR_T BTreeIndex::InsertInternal(SIZE_T &nodenum,
 				// split the root into 2 leaves
 				
         //Insert the new key
-				b.info.numkeys = 1; //now it has one key(offset)
+				b.info->numkeys = 1; //now it has one key(offset)
 				rc=b.SetKey(0,key); //first key goes in the first offset.
 				if (rc) {  return rc; }
 				
@@ -518,33 +455,38 @@ ERROR_T BTreeIndex::InsertInternal(SIZE_T &nodenum,
 				if (rc) {  return rc; }
 				rc=b.SetPtr(1,rightleaf); //Set the ptr in the rootnode. offset is 1.
 				if (rc) {  return rc; }
-				//Serialize Root
-				rc=b.Serialize(buffercache,nodenum); //Since the ptrs have been created and added to rootnode
-				if (rc) {  return rc; }
+				//Root is done, since the ptrs have been created and added to rootnode
+				b.MarkDirty();
 				
 				//Left Leaf
-				BTreeNode newleftnode(BTREE_LEAF_NODE,
-					b.info.keysize,
-					b.info.valuesize,
-					buffercache->GetBlockSize()); //initialize the left node
+				BTreeNodeView newleftnode;
+				rc=newleftnode.Create(buffercache,
+					leftleaf,
+					BTREE_LEAF_NODE,
+					b.info->keysize,
+					b.info->valuesize); //initialize the left node
 				if (rc) {  return rc; }
 				//fill it with what we want
-				newleftnode.info.rootnode=b.info.rootnode;
-				newleftnode.info.parentnode=nodenum;
-				newleftnode.info.numkeys=0;
-				rc=newleftnode.Serialize(buffercache,leftleaf); //save and close the node
+				newleftnode.info->rootnode=b.info->rootnode;
+				newleftnode.info->parentnode=nodenum;
+				newleftnode.info->numkeys=0;
+				rc=newleftnode.Release(); //save and close the node
 				if (rc) {  return rc; }
 				//Right Leaf				
-				BTreeNode newrightnode(BTREE_LEAF_NODE,
-					b.info.keysize,
-					b.info.valuesize,
-					buffercache->GetBlockSize()); //initialize the right node
+				BTreeNodeView newrightnode;
+				rc=newrightnode.Create(buffercache,
+					rightleaf,
+					BTREE_LEAF_NODE,
+					b.info->keysize,
+					b.info->valuesize); //initialize the right node
 				if (rc) {  return rc; }
 				//fill it with what we want
-				newrightnode.info.rootnode=b.info.rootnode;
-				newrightnode.info.parentnode=nodenum;
-				newrightnode.info.numkeys=0;
-				rc=newrightnode.Serialize(buffercache,rightleaf); //save and close the node
+				newrightnode.info->rootnode=b.info->rootnode;
+				newrightnode.info->parentnode=nodenum;
+				newrightnode.info->numkeys=0;
+				rc=newrightnode.Release(); //save and close the node
+				if (rc) {  return rc; }
+				rc=b.Release();
 				if (rc) {  return rc; }
 				return InsertInternal(rightleaf,op,key,value);
         
@@ -553,29 +495,17 @@ ERROR_T BTreeIndex::InsertInternal(SIZE_T &nodenum,
 			}
 			break;
 		case BTREE_LEAF_NODE:
-			// Scan through keys looking for matching value
-			for (offset=0;offset<b.info.numkeys;offset++) { 
-				rc=b.GetKey(offset,testkey);
-				if (rc) {  return rc; }
-				if (key<testkey) { // if there exists a key that is greater than the new key
-					if (b.info.numkeys < (2*b.info.GetNumSlotsAsLeaf()/3)) { //if not 2/3rds full
-					//if (b.info.numkeys < 4) { //if not test full
-						return Insert_NotFull(offset,key,value,nodenum,b); //function to insert into a leaf that is not full
-					} else {
-						return Insert_Full(offset,key,value,nodenum,b); //function to insert into a full leaf, with splitting
-					}
-				} else if (testkey==key) { //if the key already exists
-					return ERROR_CONFLICT; // it is an error for an insert
-				}
+			// The new key goes before the first key that's larger
+			offset=b.FindKey(key);
+			if (offset>0 && b.CompareKey(offset-1,key)==0) { //if the key already exists
+				return ERROR_CONFLICT; // it is an error for an insert
 			}
-			//if we get here, then none of the existing keys in the leaf need to be shifted
-			//check if it is full, and insert at the end
-			if (b.info.numkeys < (2*b.info.GetNumSlotsAsLeaf()/3)) { //if not 2/3rds full
-			//if (b.info.numkeys < 4) { //if not test full
-			// offset=b.info.numkeys since we are at the end of the existing keys
-				return Insert_NotFull(b.info.numkeys,key,value,nodenum,b); //function to insert into leaf that is not full
+			//check if it is full, and insert at offset
+			if (b.info->numkeys < (2*b.info->GetNumSlotsAsLeaf()/3)) { //if not 2/3rds full
+			//if (b.info->numkeys < 4) { //if not test full
+				return Insert_NotFull(offset,key,value,nodenum,b); //function to insert into leaf that is not full
 			} else {
-				return Insert_Full(b.info.numkeys,key,value,nodenum,b); //function to insert into a full leaf, with splitting
+				return Insert_Full(offset,key,value,nodenum,b); //function to insert into a full leaf, with splitting
 			}
 			break;
 		default:
@@ -586,7 +516,7 @@ ERROR_T BTreeIndex::InsertInternal(SIZE_T &nodenum,
   return ERROR_INSANE;
 }
 
-static ERROR_T PrintNode(ostream &os, SIZE_T nodenum, BTreeNode &b, BTreeDisplayType dt)
+static ERROR_T PrintNode(ostream &os, SIZE_T nodenum, BTreeNodeView &b, BTreeDisplayType dt)
 {
   KEY_T key;
   VALUE_T value;
@@ -602,7 +532,7 @@ static ERROR_T PrintNode(ostream &os, SIZE_T nodenum, BTreeNode &b, BTreeDisplay
   } else {
   }
 
-  switch (b.info.nodetype) { 
+  switch (b.info->nodetype) { 
   case BTREE_ROOT_NODE:
   case BTREE_INTERIOR_NODE:
     if (dt==BTREE_SORTED_KEYVAL) {
@@ -611,15 +541,15 @@ static ERROR_T PrintNode(ostream &os, SIZE_T nodenum, BTreeNode &b, BTreeDisplay
       } else { 
 	os << "Interior: ";
       }
-      for (offset=0;offset<=b.info.numkeys;offset++) { 
+      for (offset=0;offset<=b.info->numkeys;offset++) { 
 	rc=b.GetPtr(offset,ptr);
 	if (rc) { return rc; }
 	os << "*" << ptr << " ";
 	// Last pointer
-	if (offset==b.info.numkeys) break;
+	if (offset==b.info->numkeys) break;
 	rc=b.GetKey(offset,key);
 	if (rc) {  return rc; }
-	for (i=0;i<b.info.keysize;i++) { 
+	for (i=0;i<b.info->keysize;i++) { 
 	  os << key.data[i];
 	}
 	os << " ";
@@ -631,7 +561,7 @@ static ERROR_T PrintNode(ostream &os, SIZE_T nodenum, BTreeNode &b, BTreeDisplay
     } else {
       os << "Leaf: ";
     }
-    for (offset=0;offset<b.info.numkeys;offset++) { 
+    for (offset=0;offset<b.info->numkeys;offset++) { 
       if (offset==0) { 
 	// special case for first pointer
 	rc=b.GetPtr(offset,ptr);
@@ -645,7 +575,7 @@ static ERROR_T PrintNode(ostream &os, SIZE_T nodenum, BTreeNode &b, BTreeDisplay
       }
       rc=b.GetKey(offset,key);
       if (rc) {  return rc; }
-      for (i=0;i<b.info.keysize;i++) { 
+      for (i=0;i<b.info->keysize;i++) { 
 	os << key.data[i];
       }
       if (dt==BTREE_SORTED_KEYVAL) { 
@@ -655,7 +585,7 @@ static ERROR_T PrintNode(ostream &os, SIZE_T nodenum, BTreeNode &b, BTreeDisplay
       }
       rc=b.GetVal(offset,value);
       if (rc) {  return rc; }
-      for (i=0;i<b.info.valuesize;i++) { 
+      for (i=0;i<b.info->valuesize;i++) { 
 	os << value.data[i];
       }
       if (dt==BTREE_SORTED_KEYVAL) { 
@@ -667,9 +597,9 @@ static ERROR_T PrintNode(ostream &os, SIZE_T nodenum, BTreeNode &b, BTreeDisplay
     break;
   default:
     if (dt==BTREE_DEPTH_DOT) { 
-      os << "Unknown("<<b.info.nodetype<<")";
+      os << "Unknown("<<b.info->nodetype<<")";
     } else {
-      os << "Unsupported Node Type " << b.info.nodetype ;
+      os << "Unsupported Node Type " << b.info->nodetype ;
     }
   }
   if (dt==BTREE_DEPTH_DOT) { 
@@ -688,8 +618,18 @@ ERROR_T BTreeIndex::Insert(const KEY_T &key, const VALUE_T &value)
   return InsertInternal(superblock.info.rootnode, BTREE_OP_INSERT, key, value);
 }
 
+// How many bytes at the start a and b have in common
+static SIZE_T CommonPrefixLength(const KEY_T &a, const KEY_T &b, const SIZE_T keysize)
+{
+  SIZE_T i;
+
+  for (i=0; i<keysize && a.data[i]==b.data[i]; i++) {
+  }
+  return i;
+}
+
 ERROR_T BTreeIndex::Split(SIZE_T &nodenum,
-             BTreeNode &b,
+             BTreeNodeView &b,
              SIZE_T &newNode,
              KEY_T &mid)
 {
@@ -697,130 +637,114 @@ ERROR_T BTreeIndex::Split(SIZE_T &nodenum,
   SIZE_T middle;
 
   // find middle split index
-  middle = b.info.numkeys/2;
-    // save the first key on the new node as mid
+  middle = b.info->numkeys/2;
+    // save the key that will separate the two nodes in the parent as mid
   rc = b.GetKey(middle,mid);
+  if (rc) { return rc; }
 
   // create new node
   rc = AllocateNode(newNode);
   if (rc) { return rc; }
-  BTreeNode n(b.info.nodetype, b.info.keysize, b.info.valuesize, buffercache->GetBlockSize());
-  n.info.rootnode=b.info.rootnode;
-  n.info.parentnode=b.info.parentnode;
-  n.info.numkeys=0;
-  //make the newleftNode to be used if case is root
+  BTreeNodeView n;
+  rc = n.Create(buffercache, newNode, b.info->nodetype == BTREE_ROOT_NODE ? BTREE_INTERIOR_NODE : b.info->nodetype, b.info->keysize, b.info->valuesize);
+  if (rc) { return rc; }
+  n.info->rootnode=b.info->rootnode;
+  n.info->parentnode=b.info->parentnode;
+  n.info->numkeys=0;
+  // slots move between nodes as they are, so n starts with b's prefix
+  if (b.info->prefixlen) {
+    rc = n.SetPrefix(mid, b.info->prefixlen);
+    if (rc) { return rc; }
+  }
+  //make the newleftNode, nL, to be used if case is root
   SIZE_T newleftNode;
-  if (b.info.nodetype == BTREE_ROOT_NODE) {
+  BTreeNodeView nL;
+  if (b.info->nodetype == BTREE_ROOT_NODE) {
 	rc = AllocateNode(newleftNode);
 	if (rc) { return rc; }	
-	n.info.nodetype = BTREE_INTERIOR_NODE;
-	n.info.parentnode=b.info.rootnode; 
+	n.info->parentnode=b.info->rootnode; 
+	rc = nL.Create(buffercache, newleftNode, BTREE_INTERIOR_NODE, b.info->keysize, b.info->valuesize);
+	if (rc) { return rc; }	
+	nL.info->rootnode=b.info->rootnode;
+	nL.info->parentnode=b.info->rootnode;
+	nL.info->numkeys=0;
   }
-  
-  BTreeNode nL(BTREE_INTERIOR_NODE, b.info.keysize, b.info.valuesize, buffercache->GetBlockSize());
-	nL.info.rootnode=b.info.rootnode;
-	nL.info.parentnode=b.info.rootnode;
-	nL.info.numkeys=0;
 	
-  switch(b.info.nodetype)
+  switch(b.info->nodetype)
   {
     case BTREE_LEAF_NODE:
 	  
-      // copy half of the keys and values to new node
-      for (unsigned int i=middle; i<b.info.numkeys; i++)
-      {
-        // incremember the number of keys in new node
-        n.info.numkeys++;
-        KEY_T cKey;
-        VALUE_T cVal;
-
-        rc = b.GetKey(i, cKey);
-        if (rc) { return rc; }
-        rc = n.SetKey(i-middle, cKey);
-        if (rc) { return rc; }
-        rc = b.GetVal(i, cVal);
-        if (rc) { return rc; }
-        rc = n.SetVal(i-middle, cVal);
-        if (rc) { return rc; }
-      }
-      // set new number of keys in child
-      b.info.numkeys=middle;
-	  n.info.numkeys=middle+1;
+      // move the upper half of the keys and values to new node
+      rc = b.MoveSlots(middle, b.info->numkeys-middle, n);
+      if (rc) { return rc; }
       break;
 	case BTREE_ROOT_NODE:
-		//make the newleftNode, nL
+		// move all of the root values into the new left node nL:
+		// its first ptr, then every key with the ptr after it
+		{
+		  SIZE_T cPtr;
+		  rc = b.GetPtr(0, cPtr);
 		  if (rc) { return rc; }
-		// copy all of the root values into the new left node
-      for (unsigned int i=0; i<=b.info.numkeys; i++)
+		  rc = nL.SetPtr(0, cPtr);
+		  if (rc) { return rc; }
+		}
+		rc = b.MoveSlots(0, b.info->numkeys, nL); //root numkeys is now 0
+		if (rc) { return rc; }
+      for (unsigned int i=0; i<=nL.info->numkeys; i++)
       {
-        // increment the number of keys in new node
-        nL.info.numkeys++;
-        KEY_T cKey;
         SIZE_T cPtr;
 		
-		rc = b.GetPtr(i, cPtr);
-        if (rc) { return rc; }
-        rc = nL.SetPtr(i, cPtr);
-        if (rc) { return rc; }
-		if (i < b.info.numkeys) {
-        rc = b.GetKey(i, cKey);
+		rc = nL.GetPtr(i, cPtr);
         if (rc) { return rc; }
-        rc = nL.SetKey(i, cKey);
-        if (rc) { return rc; }
-		}
-        
 		
-		BTreeNode temp;
-		rc = temp.Unserialize(buffercache,cPtr);
+		BTreeNodeView temp;
+		rc = temp.Attach(buffercache,cPtr);
         if (rc) { return rc; }
-		temp.info.parentnode=newleftNode;
-		rc = temp.Serialize(buffercache,cPtr);
+		temp.info->parentnode=newleftNode;
+		temp.MarkDirty();
+		rc = temp.Release();
         if (rc) { return rc; }
       }
-	  b.info.numkeys=0; //since root is copied, set root numkeys to 0
 	  rc = b.SetPtr(0,newleftNode); //set the first ptr to point to the new left new node
         if (rc) { return rc; }
-	  rc = b.Serialize(buffercache,nodenum);
-        if (rc) { return rc; }
-	  rc = nL.Serialize(buffercache,newleftNode);
+	  b.MarkDirty();
+	  rc = nL.Release();
         if (rc) { return rc; }
 	  //After writing root, we set the newleftNode to be the node we are splitting
 	  nodenum=newleftNode;
-	  rc = b.Unserialize(buffercache,nodenum); //this should now set b as the new left node
+	  rc = b.Attach(buffercache,nodenum); //this should now set b as the new left node
         if (rc) { return rc; }
 		//after the increase in height, treat the split like a normal node.gdb
     case BTREE_INTERIOR_NODE:
-      // copy half of the keys and pointers to new node
-      for (unsigned int i=middle; i<=b.info.numkeys; i++)
+      // mid goes up to the parent.  The keys after it, and the ptrs
+      // between and around them, move to the new node, and b keeps
+      // the rest.
       {
-        // increment the number of keys in new node
-        n.info.numkeys++;
-        KEY_T cKey;
         SIZE_T cPtr;
-		
-		rc = b.GetPtr(i, cPtr);
+        rc = b.GetPtr(middle+1, cPtr);
         if (rc) { return rc; }
-        rc = n.SetPtr(i-middle, cPtr);
+        rc = n.SetPtr(0, cPtr);
         if (rc) { return rc; }
+      }
+      rc = b.MoveSlots(middle+1, b.info->numkeys-middle-1, n);
+      if (rc) { return rc; }
+      rc = b.RemoveSlot(middle);
+      if (rc) { return rc; }
+      for (unsigned int i=0; i<=n.info->numkeys; i++)
+      {
+        SIZE_T cPtr;
 		
-		if (i < b.info.numkeys) {
-        rc = b.GetKey(i, cKey);
-        if (rc) { return rc; }
-        rc = n.SetKey(i-middle, cKey);
+		rc = n.GetPtr(i, cPtr);
         if (rc) { return rc; }
-		}
-        
 		
-		BTreeNode temp;
-		rc = temp.Unserialize(buffercache,cPtr);
+		BTreeNodeView temp;
+		rc = temp.Attach(buffercache,cPtr);
         if (rc) { return rc; }
-		temp.info.parentnode=newNode;
-		rc = temp.Serialize(buffercache,cPtr);
+		temp.info->parentnode=newNode;
+		temp.MarkDirty();
+		rc = temp.Release();
         if (rc) { return rc; }
       }
-      // set new number of keys in child
-      b.info.numkeys=middle;
-	  n.info.numkeys=middle+1;
       break;
     default:
 		assert(0==1);
@@ -830,10 +754,74 @@ ERROR_T BTreeIndex::Split(SIZE_T &nodenum,
 
   if (rc) { return rc; }
 
-  // save changes to disk
-  rc = n.Serialize(buffercache, newNode);
-  if(rc){return rc;}
-  return b.Serialize(buffercache, nodenum);
+  if (superblock.info.prefixkeys) {
+    // b's range now ends at mid and n's starts there, so each shares
+    // more with its fence on that side
+    KEY_T low, high;
+    bool havelow, havehigh;
+
+    rc = GetFences(nodenum, b.info->parentnode, low, havelow, high, havehigh);
+    if (rc) { return rc; }
+    rc = b.SetPrefix(mid, havelow ? CommonPrefixLength(low, mid, b.info->keysize) : 0);
+    if (rc) { return rc; }
+    rc = n.SetPrefix(mid, havehigh ? CommonPrefixLength(mid, high, n.info->keysize) : 0);
+    if (rc) { return rc; }
+  }
+
+  // both nodes go back to the cache to be written
+  b.MarkDirty();
+  return n.Release();
+}
+
+
+ERROR_T BTreeIndex::GetFences(SIZE_T node,
+             SIZE_T parent,
+             KEY_T &low,
+             bool &havelow,
+             KEY_T &high,
+             bool &havehigh) const
+{
+  ERROR_T rc;
+
+  havelow=false;
+  havehigh=false;
+
+  while (node!=superblock.info.rootnode && !(havelow && havehigh)) {
+    BTreeNodeView p;
+    SIZE_T offset;
+    SIZE_T ptr;
+
+    rc = p.Attach(buffercache, parent);
+    if (rc) { return rc; }
+
+    // find which of the parent's ptrs is node
+    for (offset=0; offset<=p.info->numkeys; offset++) {
+      rc = p.GetPtr(offset, ptr);
+      if (rc) { return rc; }
+      if (ptr==node) {
+        break;
+      }
+    }
+    if (offset>p.info->numkeys) {
+      return ERROR_INSANE;
+    }
+
+    if (!havelow && offset>0) {
+      rc = p.GetKey(offset-1, low);
+      if (rc) { return rc; }
+      havelow=true;
+    }
+    if (!havehigh && offset<p.info->numkeys) {
+      rc = p.GetKey(offset, high);
+      if (rc) { return rc; }
+      havehigh=true;
+    }
+
+    node=parent;
+    parent=p.info->parentnode;
+  }
+
+  return ERROR_NOERROR;
 }
   
 ERROR_T BTreeIndex::Update(const KEY_T &key, const VALUE_T &value)
@@ -865,11 +853,11 @@ ERROR_T BTreeIndex::DisplayInternal(const SIZE_T &node,
 {
   KEY_T testkey;
   SIZE_T ptr;
-  BTreeNode b;
+  BTreeNodeView b;
   ERROR_T rc;
   SIZE_T offset;
 
-  rc= b.Unserialize(buffercache,node);
+  rc= b.Attach(buffercache,node);
 
   if (rc!=ERROR_NOERROR) { 
     return rc;
@@ -887,11 +875,11 @@ ERROR_T BTreeIndex::DisplayInternal(const SIZE_T &node,
     o << endl;
   }
 
-  switch (b.info.nodetype) { 
+  switch (b.info->nodetype) { 
   case BTREE_ROOT_NODE:
   case BTREE_INTERIOR_NODE:
-    if (b.info.numkeys>0) { 
-      for (offset=0;offset<=b.info.numkeys;offset++) { 
+    if (b.info->numkeys>0) { 
+      for (offset=0;offset<=b.info->numkeys;offset++) { 
 	rc=b.GetPtr(offset,ptr);
 	if (rc) { return rc; }
 	if (display_type==BTREE_DEPTH_DOT) { 
@@ -909,7 +897,7 @@ ERROR_T BTreeIndex::DisplayInternal(const SIZE_T &node,
   default:
     if (display_type==BTREE_DEPTH_DOT) { 
     } else {
-      o << "Unsupported Node Type " << b.info.nodetype ;
+      o << "Unsupported Node Type " << b.info->nodetype ;
     }
     return ERROR_INSANE;
   }
@@ -947,46 +935,37 @@ ERROR_T BTreeIndex::SanityCheckInternal(SIZE_T nodenum,
          int prev) const
 {
   ERROR_T rc;
-  BTreeNode b;
-  BTreeNode next;
+  BTreeNodeView b;
+  BTreeNodeView next;
 
-  // unserialize the current node
-  rc = b.Unserialize(buffercache, nodenum);
+  // look at the current node
+  rc = b.Attach(buffercache, nodenum);
   if (rc) { return rc; }
-  
-  // check for cycles
-  if (b.info.check)
-  {
-    // then this node has already been checked, indicating a cycle
-    return ERROR_INSANE;
-  }
-  else 
-  {
-    b.info.check = true;
-  }
 
   // traverse the tree
-  for (unsigned int i=0; i<=b.info.numkeys; i++)
+  for (unsigned int i=0; i<=b.info->numkeys; i++)
   {
     // check the node type of the pointer
     SIZE_T ptr;
     rc = b.GetPtr(i,ptr);
     if (rc) { return rc; }
-    rc = next.Unserialize(buffercache, ptr);
+    rc = next.Attach(buffercache, ptr);
     if (rc) { return rc; }
 
     // check parent node
-    assert(nodenum == next.info.parentnode);
+    assert(nodenum == next.info->parentnode);
 
-    if (next.info.nodetype!=BTREE_LEAF_NODE)
+    if (next.info->nodetype!=BTREE_LEAF_NODE)
     {
+      rc = next.Release();
+      if (rc) { return rc; }
       rc = SanityCheckInternal(ptr, prev);
       if (rc) { return rc; }
     }
     // the node is a leaf
     else
     {
-      for (unsigned int j=0; j<next.info.numkeys; j++)
+      for (unsigned int j=0; j<next.info->numkeys; j++)
       {
         // get key at leaf
         VALUE_T curKey;
@@ -62,22 +62,22 @@ class BTreeIndex {
             const KEY_T &key,
             const VALUE_T &value,
             const SIZE_T &nodenum,
-            BTreeNode &b);
+            BTreeNodeView &b);
 
   ERROR_T Insert_Full(const SIZE_T offset,
              const KEY_T &key,
              const VALUE_T &value,
              SIZE_T &node,
-             BTreeNode &b);
+             BTreeNodeView &b);
 			 
   ERROR_T Insert_NotFullParent(const SIZE_T newnode,
 					   const KEY_T &key,
-					   BTreeNode &b,
+					   BTreeNodeView &b,
 					   const SIZE_T nodenum);
 					   
   ERROR_T Insert_FullParent(const SIZE_T &newnode,
 					   const KEY_T &key,
-					   BTreeNode &b,
+					   BTreeNodeView &b,
 					   SIZE_T &nodenum);
 
   ERROR_T InsertInternal(SIZE_T &node,
@@ -86,9 +86,20 @@ class BTreeIndex {
              const VALUE_T &value);
 
   ERROR_T Split(SIZE_T &nodenum,
-            BTreeNode &b,
+            BTreeNodeView &b,
             SIZE_T &newNode,
             KEY_T &mid);
+
+  // The keys just outside the range of node, whose parent is parent:
+  // the separators before and after it in the nearest ancestors that
+  // have them.  The leftmost nodes have no low one and the rightmost
+  // no high one.
+  ERROR_T GetFences(SIZE_T node,
+            SIZE_T parent,
+            KEY_T &low,
+            bool &havelow,
+            KEY_T &high,
+            bool &havehigh) const;
   
   ERROR_T DisplayInternal(const SIZE_T &node,
 		        ostream &o, 
@@ -109,10 +120,17 @@ public:
   // otherwise, the expectation is that keysize and valuesize
   // will be zero and will be read when Attach(initialblock,false) is 
   // invoked
+  //
+  // With prefixkeys, a node stores the bytes that every key in its
+  // range starts with once, and only the rest of each key, so more
+  // keys fit in a node.  The range is bounded by the separators above
+  // it, so this pays off below the first few levels and when keys
+  // share long prefixes.  This is also stored in the superblock.
   BTreeIndex(SIZE_T keysize, 
 	     SIZE_T valuesize,
 	     BufferCache *cache,
-	     bool unique=true);   // true if a  key maps to a single value
+	     bool unique=true,   // true if a  key maps to a single value
+	     bool prefixkeys=false);
 
 
   BTreeIndex();
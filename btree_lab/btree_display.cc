@@ -3,7 +3,7 @@
 
 void usage() 
 {
-  cerr << "usage: btree_display filestem cachesize dot|normal\n";
+  cerr << "usage: btree_display filestem cachesize dot|normal [LRU|CLOCK|2Q|ARC]\n";
 }
 
 
@@ -13,8 +13,14 @@ int main(int argc, char **argv)
   bool dot;
   SIZE_T cachesize;
   SIZE_T superblocknum;
+  ReplacementPolicyType policy=POLICY_LRU;
 
-  if (argc!=4) { 
+  if (argc!=4 && argc!=5) { 
+    usage();
+    return -1;
+  }
+
+  if (argc==5 && ParseReplacementPolicy(argv[4],policy)!=ERROR_NOERROR) { 
     usage();
     return -1;
   }
@@ -23,8 +29,9 @@ int main(int argc, char **argv)
   cachesize=atoi(argv[2]);
   dot=argv[3][0]=='d' || argv[3][0]=='D';
 
-  DiskSystem disk(filestem);
-  BufferCache cache(&disk,cachesize);
+  unique_ptr<DiskSystem> diskp(OpenDiskSystem(filestem));
+  DiskSystem &disk=*diskp;
+  BufferCache cache(&disk,cachesize,policy);
   BTreeIndex btree(0,0,&cache);
   
   ERROR_T rc;
@@ -56,6 +63,9 @@ int main(int argc, char **argv)
     }
     cerr << "Performance statistics:\n";
     
+    cerr << "policy          = "<<GetReplacementPolicyName(cache.GetPolicy())<<endl;
+    cerr << "numhits         = "<<cache.GetNumHits()<<endl;
+    cerr << "nummisses       = "<<cache.GetNumMisses()<<endl;
     cerr << "numallocs       = "<<cache.GetNumAllocs()<<endl;
     cerr << "numdeallocs     = "<<cache.GetNumDeallocs()<<endl;
     cerr << "numreads        = "<<cache.GetNumReads()<<endl;
@@ -5,6 +5,7 @@
 
 #include "btree_ds.h"
 #include "buffercache.h"
+#include "keysearch.h"
 
 #include "btree.h"
 
@@ -19,12 +20,17 @@ SIZE_T NodeMetadata::GetNumDataBytes() const
 
 SIZE_T NodeMetadata::GetNumSlotsAsInterior() const
 {
-  return (GetNumDataBytes()-sizeof(SIZE_T))/(keysize+sizeof(SIZE_T));  // floor intended
+  return (GetNumDataBytes()-sizeof(SIZE_T)-prefixlen)/(GetStoredKeySize()+sizeof(SIZE_T));  // floor intended
 }
 
 SIZE_T NodeMetadata::GetNumSlotsAsLeaf() const
 {
-  return (GetNumDataBytes()-sizeof(SIZE_T))/(keysize+valuesize);  // floor intended
+  return (GetNumDataBytes()-sizeof(SIZE_T)-prefixlen)/(GetStoredKeySize()+valuesize);  // floor intended
+}
+
+SIZE_T NodeMetadata::GetStoredKeySize() const
+{
+  return keysize-prefixlen;
 }
 
 
@@ -35,15 +41,17 @@ ostream & NodeMetadata::Print(ostream &os) const
 				   nodetype==BTREE_ROOT_NODE ? "ROOT_NODE" :
 				   nodetype==BTREE_INTERIOR_NODE ? "INTERIOR_NODE" :
 				   nodetype==BTREE_LEAF_NODE ? "LEAF_NODE" : "UNKNOWN_TYPE")
+     << ", format="<<hex<<format<<dec
      << ", keysize="<<keysize<<", valuesize="<<valuesize<<", blocksize="<<blocksize
      << ", rootnode="<<rootnode<<", freelist="<<freelist<<", numkeys="<<numkeys
-	 <<", parentnode="<<parentnode<<")";
+	 <<", parentnode="<<parentnode<<", prefixkeys="<<prefixkeys<<", prefixlen="<<prefixlen<<")";
   return os;
 }
 
 BTreeNode::BTreeNode() 
 {
   info.nodetype=BTREE_UNALLOCATED_BLOCK;
+  info.format=BTREE_FORMAT_VERSION;
   data=0;
 }
 
@@ -60,6 +68,7 @@ BTreeNode::~BTreeNode()
 BTreeNode::BTreeNode(int node_type, SIZE_T key_size, SIZE_T value_size, SIZE_T block_size)
 {
   info.nodetype=node_type;
+  info.format=BTREE_FORMAT_VERSION;
   info.keysize=key_size;
   info.valuesize=value_size;
   info.blocksize=block_size;
@@ -67,6 +76,8 @@ BTreeNode::BTreeNode(int node_type, SIZE_T key_size, SIZE_T value_size, SIZE_T b
   info.freelist=0;
   info.numkeys=0;
   info.parentnode=0;  
+  info.prefixkeys=false;
+  info.prefixlen=0;
   data=0;
   if (info.nodetype!=BTREE_UNALLOCATED_BLOCK && info.nodetype!=BTREE_SUPERBLOCK) {
     data = new char [info.GetNumDataBytes()];
@@ -77,6 +88,7 @@ BTreeNode::BTreeNode(int node_type, SIZE_T key_size, SIZE_T value_size, SIZE_T b
 BTreeNode::BTreeNode(const BTreeNode &rhs) 
 {
   info.nodetype=rhs.info.nodetype;
+  info.format=rhs.info.format;
   info.keysize=rhs.info.keysize;
   info.valuesize=rhs.info.valuesize;
   info.blocksize=rhs.info.blocksize;
@@ -84,6 +96,8 @@ BTreeNode::BTreeNode(const BTreeNode &rhs)
   info.freelist=rhs.info.freelist;
   info.numkeys=rhs.info.numkeys;
   info.parentnode=rhs.info.parentnode;  
+  info.prefixkeys=rhs.info.prefixkeys;
+  info.prefixlen=rhs.info.prefixlen;
   data=0;
   if (rhs.data) { 
    data=new char [info.GetNumDataBytes()];
@@ -100,60 +114,82 @@ BTreeNode & BTreeNode::operator=(const BTreeNode &rhs)
 
 ERROR_T BTreeNode::Serialize(BufferCache *b, const SIZE_T blocknum) const
 {
-  assert((unsigned)info.blocksize==b->GetBlockSize());
+  assert(info.blocksize==b->GetBlockSize());
+
+  Block *block;
+
+  ERROR_T rc;
 
-  Block block(sizeof(info)+info.GetNumDataBytes());
+  // We overwrite the whole block, so there is no need to fetch it
+  rc=b->PinBlock(blocknum,block,false);
 
-  memcpy(block.data,&info,sizeof(info));
+  if (rc!=ERROR_NOERROR) {
+    return rc;
+  }
+
+  memcpy(block->data,&info,sizeof(info));
   if (info.nodetype!=BTREE_UNALLOCATED_BLOCK && info.nodetype!=BTREE_SUPERBLOCK) { 
-    memcpy(block.data+sizeof(info),data,info.GetNumDataBytes());
+    memcpy(block->data+sizeof(info),data,info.GetNumDataBytes());
   }
 
-  return b->WriteBlock(blocknum,block);
+  return b->UnpinBlock(blocknum,true);
 }
 
 
 ERROR_T  BTreeNode::Unserialize(BufferCache *b, const SIZE_T blocknum)
 {
-  Block block;
+  Block *block;
 
   ERROR_T rc;
 
-  rc=b->ReadBlock(blocknum,block);
+  rc=b->PinBlock(blocknum,block);
 
   if (rc!=ERROR_NOERROR) {
     return rc;
   }
 
-  memcpy(&info,block.data,sizeof(info));
-  
-  if (data) { 
-    delete [] data;
-    data=0;
-  }
+  memcpy(&info,block->data,sizeof(info));
 
-  assert(b->GetBlockSize()==(unsigned)info.blocksize);
+  if (info.format!=BTREE_FORMAT_VERSION) { 
+    cerr << "BTreeNode::Unserialize: block "<<blocknum<<" is not in this version's format - reinitialize the tree\n";
+    b->UnpinBlock(blocknum);
+    info.nodetype=BTREE_UNALLOCATED_BLOCK;
+    info.format=BTREE_FORMAT_VERSION;
+    return ERROR_BADCONFIG;
+  }
+  
+  assert(b->GetBlockSize()==info.blocksize);
 
   if (info.nodetype!=BTREE_UNALLOCATED_BLOCK && info.nodetype!=BTREE_SUPERBLOCK) {
-    data = new char [info.GetNumDataBytes()];
-    memcpy(data,block.data+sizeof(info),info.GetNumDataBytes());
+    if (!data) { 
+      data = new char [info.GetNumDataBytes()];
+    }
+    memcpy(data,block->data+sizeof(info),info.GetNumDataBytes());
+  } else if (data) { 
+    delete [] data;
+    data=0;
   }
   
-  return ERROR_NOERROR;
+  return b->UnpinBlock(blocknum);
 }
 
 
-char * BTreeNode::ResolveKey(const SIZE_T offset) const
+//
+// The layout of the slots, shared by BTreeNode, which has its own
+// copy of a node, and BTreeNodeView, which looks at it in place
+//
+
+static char *ResolveKeyIn(const NodeMetadata &info, char *data, const SIZE_T offset)
 {
   switch (info.nodetype) { 
   case BTREE_INTERIOR_NODE:
   case BTREE_ROOT_NODE:
     assert(offset<info.numkeys);
-    return data+sizeof(SIZE_T)+offset*(sizeof(SIZE_T)+info.keysize);
+    return data+sizeof(SIZE_T)+offset*(sizeof(SIZE_T)+info.GetStoredKeySize());
     break;
   case BTREE_LEAF_NODE:
     assert(offset<info.numkeys);
-    return data+sizeof(SIZE_T)+offset*(info.keysize+info.valuesize);
+    return data+sizeof(SIZE_T)+offset*(info.GetStoredKeySize()+info.valuesize);
     break;
   default:
 	assert(0==1);
@@ -162,13 +198,13 @@ char * BTreeNode::ResolveKey(const SIZE_T offset) const
 }
 
 
-char * BTreeNode::ResolvePtr(const SIZE_T offset) const
+static char *ResolvePtrIn(const NodeMetadata &info, char *data, const SIZE_T offset)
 {
   switch (info.nodetype) { 
   case BTREE_INTERIOR_NODE:
   case BTREE_ROOT_NODE:
     assert(offset<=info.numkeys);
-    return data+offset*(sizeof(SIZE_T)+info.keysize);
+    return data+offset*(sizeof(SIZE_T)+info.GetStoredKeySize());
     break;
   case BTREE_LEAF_NODE:
     assert(offset==0);
@@ -181,13 +217,12 @@ char * BTreeNode::ResolvePtr(const SIZE_T offset) const
 }
 
 
-
-char * BTreeNode::ResolveVal(const SIZE_T offset) const
+static char *ResolveValIn(const NodeMetadata &info, char *data, const SIZE_T offset)
 {
   switch (info.nodetype) { 
   case BTREE_LEAF_NODE:
     assert(offset<info.numkeys);
-    return data+sizeof(SIZE_T)+offset*(info.keysize+info.valuesize)+info.keysize;
+    return data+sizeof(SIZE_T)+offset*(info.GetStoredKeySize()+info.valuesize)+info.GetStoredKeySize();
     break;
   default:
     return 0;
@@ -195,25 +230,154 @@ char * BTreeNode::ResolveVal(const SIZE_T offset) const
 }
 
 
-
-char * BTreeNode::ResolveKeyVal(const SIZE_T offset) const
+static char *ResolvePrefixIn(const NodeMetadata &info, char *data)
 {
-  return ResolveKey(offset);
+  return data+info.GetNumDataBytes()-info.prefixlen;
 }
 
-ERROR_T BTreeNode::GetKey(const SIZE_T offset, KEY_T &k) const
+
+static ERROR_T GetKeyIn(const NodeMetadata &info, char *data, const SIZE_T offset, KEY_T &k)
 {
-  char *p=ResolveKey(offset);
+  char *p=ResolveKeyIn(info,data,offset);
 
   if (p==0) { 
     return ERROR_NOMEM;
   }
   
   k.Resize(info.keysize,false);
-  memcpy(k.data,p,info.keysize);
+  memcpy(k.data,ResolvePrefixIn(info,data),info.prefixlen);
+  memcpy(k.data+info.prefixlen,p,info.GetStoredKeySize());
   return ERROR_NOERROR;
 }
 
+
+static ERROR_T SetKeyIn(const NodeMetadata &info, char *data, const SIZE_T offset, const KEY_T &k)
+{
+  char *p=ResolveKeyIn(info,data,offset);
+
+  if (p==0) { 
+    return ERROR_NOMEM;
+  }
+
+  // a key without the prefix belongs in some other node
+  if (memcmp(ResolvePrefixIn(info,data),k.data,info.prefixlen)) { 
+    return ERROR_INSANE;
+  }
+
+  memcpy(p,k.data+info.prefixlen,info.GetStoredKeySize());
+  return ERROR_NOERROR;
+}
+
+
+static int CompareKeyIn(const NodeMetadata &info, char *data, const SIZE_T offset, const KEY_T &k)
+{
+  int c=memcmp(ResolvePrefixIn(info,data),k.data,info.prefixlen);
+
+  if (c) { 
+    return c;
+  }
+  return memcmp(ResolveKeyIn(info,data,offset),k.data+info.prefixlen,info.GetStoredKeySize());
+}
+
+
+static SIZE_T FindKeyIn(const NodeMetadata &info, char *data, const KEY_T &k)
+{
+  // The keys are evenly spaced, so step over the pointers or values
+  // between them directly instead of resolving each one
+  SIZE_T stride = info.nodetype==BTREE_LEAF_NODE ? info.GetStoredKeySize()+info.valuesize : sizeof(SIZE_T)+info.GetStoredKeySize();
+
+  assert(info.nodetype==BTREE_LEAF_NODE || info.nodetype==BTREE_INTERIOR_NODE || info.nodetype==BTREE_ROOT_NODE);
+
+  // Every key in the node has the prefix, so a k without it is below
+  // or above all of them, and otherwise only the rest is searched
+  int c=memcmp(ResolvePrefixIn(info,data),k.data,info.prefixlen);
+
+  if (c>0) { 
+    return 0;
+  }
+  if (c<0) { 
+    return info.numkeys;
+  }
+
+  return SearchKeys((const BYTE_T *)data+sizeof(SIZE_T),
+		    stride,
+		    info.numkeys,
+		    info.GetStoredKeySize(),
+		    (const BYTE_T *)data+info.GetNumDataBytes(),
+		    k.data+info.prefixlen);
+}
+
+
+template <class Node>
+static ostream &PrintSlots(ostream &os, const NodeMetadata &info, const Node &node)
+{
+  if (info.nodetype!=BTREE_UNALLOCATED_BLOCK && info.nodetype!=BTREE_SUPERBLOCK) { 
+    os <<", ";
+    if (info.nodetype==BTREE_INTERIOR_NODE || info.nodetype==BTREE_ROOT_NODE) {
+      SIZE_T ptr;
+      KEY_T key;
+      os << "pointers_and_values=(";
+      if (info.numkeys>0) { // ==0 implies an empty root node
+	for (SIZE_T i=0;i<info.numkeys;i++) {
+	  node.GetPtr(i,ptr);
+	  os<<ptr<<", ";
+	  node.GetKey(i,key);
+	  os<<key<<", ";
+	}
+	node.GetPtr(info.numkeys,ptr);
+	os <<ptr;
+      } 
+      os << ")";
+	
+    }
+    if (info.nodetype==BTREE_LEAF_NODE) { 
+      KEY_T key;
+      VALUE_T val;
+      os << "keys_and_values=(";
+      for (SIZE_T i=0;i<info.numkeys;i++) {
+	if (i>0) { 
+	  os<<", ";
+	}
+	node.GetKey(i,key);
+	os<<key<<", ";
+	node.GetVal(i,val);
+	os<<val;
+      }
+      os <<")";
+    }
+  }
+  return os;
+}
+
+
+char * BTreeNode::ResolveKey(const SIZE_T offset) const
+{
+  return ResolveKeyIn(info,data,offset);
+}
+
+
+char * BTreeNode::ResolvePtr(const SIZE_T offset) const
+{
+  return ResolvePtrIn(info,data,offset);
+}
+
+
+char * BTreeNode::ResolveVal(const SIZE_T offset) const
+{
+  return ResolveValIn(info,data,offset);
+}
+
+
+char * BTreeNode::ResolveKeyVal(const SIZE_T offset) const
+{
+  return ResolveKey(offset);
+}
+
+ERROR_T BTreeNode::GetKey(const SIZE_T offset, KEY_T &k) const
+{
+  return GetKeyIn(info,data,offset,k);
+}
+
 ERROR_T BTreeNode::GetPtr(const SIZE_T offset, SIZE_T &ptr) const
 {
   char *p=ResolvePtr(offset);
@@ -254,15 +418,7 @@ ERROR_T BTreeNode::GetKeyVal(const SIZE_T offset, KeyValuePair &p) const
 
 ERROR_T BTreeNode::SetKey(const SIZE_T offset, const KEY_T &k)
 {
-  char *p=ResolveKey(offset);
-
-  if (p==0) { 
-    return ERROR_NOMEM;
-  }
-
-  memcpy(p,k.data,info.keysize);
-
-  return ERROR_NOERROR;
+  return SetKeyIn(info,data,offset,k);
 }
 
 
@@ -308,45 +464,379 @@ ERROR_T BTreeNode::SetKeyVal(const SIZE_T offset, const KeyValuePair &p)
 
 
 
+int BTreeNode::CompareKey(const SIZE_T offset, const KEY_T &k) const
+{
+  return CompareKeyIn(info,data,offset,k);
+}
+
+
+SIZE_T BTreeNode::FindKey(const KEY_T &k) const
+{
+  return FindKeyIn(info,data,k);
+}
+
 
 ostream & BTreeNode::Print(ostream &os) const 
 {
   os << "BTreeNode(info="<<info;
-  if (info.nodetype!=BTREE_UNALLOCATED_BLOCK && info.nodetype!=BTREE_SUPERBLOCK) { 
-    os <<", ";
-    if (info.nodetype==BTREE_INTERIOR_NODE || info.nodetype==BTREE_ROOT_NODE) {
-      SIZE_T ptr;
-      KEY_T key;
-      os << "pointers_and_values=(";
-      if (info.numkeys>0) { // ==0 implies an empty root node
-	for (SIZE_T i=0;i<info.numkeys;i++) {
-	  GetPtr(i,ptr);
-	  os<<ptr<<", ";
-	  GetKey(i,key);
-	  os<<key<<", ";
-	}
-	GetPtr(info.numkeys,ptr);
-	os <<ptr;
-      } 
-      os << ")";
-	
-    }
-    if (info.nodetype==BTREE_LEAF_NODE) { 
-      KEY_T key;
-      VALUE_T val;
-      os << "keys_and_values=(";
-      for (SIZE_T i=0;i<info.numkeys;i++) {
-	if (i>0) { 
-	  os<<", ";
-	}
-	GetKey(i,key);
-	os<<key<<", ";
-	GetVal(i,val);
-	os<<val;
+  PrintSlots(os,info,*this);
+  os <<")";
+  return os;
+}
+
+
+
+BTreeNodeView::BTreeNodeView() : info(0), data(0), cache(0), blocknum(0), dirty(false)
+{}
+
+
+BTreeNodeView::~BTreeNodeView()
+{
+  Release();
+}
+
+
+ERROR_T BTreeNodeView::Pin(BufferCache *b, const SIZE_T block, const bool fetch)
+{
+  Block *page;
+  ERROR_T rc;
+
+  rc=Release();
+
+  if (rc!=ERROR_NOERROR) {
+    return rc;
+  }
+
+  rc=b->PinBlock(block,page,fetch);
+
+  if (rc!=ERROR_NOERROR) {
+    return rc;
+  }
+
+  cache=b;
+  blocknum=block;
+  dirty=false;
+  info=(NodeMetadata *)(page->data);
+  data=(char *)(page->data)+sizeof(NodeMetadata);
+  return ERROR_NOERROR;
+}
+
+
+ERROR_T BTreeNodeView::Attach(BufferCache *b, const SIZE_T block)
+{
+  ERROR_T rc=Pin(b,block,true);
+
+  if (rc!=ERROR_NOERROR) {
+    return rc;
+  }
+
+  if (info->format!=BTREE_FORMAT_VERSION) { 
+    cerr << "BTreeNodeView::Attach: block "<<block<<" is not in this version's format - reinitialize the tree\n";
+    Release();
+    return ERROR_BADCONFIG;
+  }
+
+  assert(b->GetBlockSize()==info->blocksize);
+
+  return ERROR_NOERROR;
+}
+
+
+ERROR_T BTreeNodeView::Create(BufferCache *b, const SIZE_T block, int node_type, SIZE_T key_size, SIZE_T value_size)
+{
+  // The whole block is written, so there is no need to fetch it
+  ERROR_T rc=Pin(b,block,false);
+
+  if (rc!=ERROR_NOERROR) {
+    return rc;
+  }
+
+  memset((char *)info,0,b->GetBlockSize());
+  info->nodetype=node_type;
+  info->format=BTREE_FORMAT_VERSION;
+  info->keysize=key_size;
+  info->valuesize=value_size;
+  info->blocksize=b->GetBlockSize();
+  info->rootnode=0;
+  info->freelist=0;
+  info->numkeys=0;
+  info->parentnode=0;
+  info->check=false;
+  info->prefixkeys=false;
+  info->prefixlen=0;
+  dirty=true;
+
+  return ERROR_NOERROR;
+}
+
+
+void BTreeNodeView::MarkDirty()
+{
+  dirty=true;
+}
+
+
+ERROR_T BTreeNodeView::Release()
+{
+  if (!info) {
+    return ERROR_NOERROR;
+  }
+
+  ERROR_T rc=cache->UnpinBlock(blocknum,dirty);
+
+  info=0;
+  data=0;
+  dirty=false;
+  return rc;
+}
+
+
+SIZE_T BTreeNodeView::GetBlockNum() const
+{
+  return blocknum;
+}
+
+
+char * BTreeNodeView::ResolveKey(const SIZE_T offset) const
+{
+  return ResolveKeyIn(*info,data,offset);
+}
+
+
+char * BTreeNodeView::ResolvePtr(const SIZE_T offset) const
+{
+  return ResolvePtrIn(*info,data,offset);
+}
+
+
+char * BTreeNodeView::ResolveVal(const SIZE_T offset) const
+{
+  return ResolveValIn(*info,data,offset);
+}
+
+
+ERROR_T BTreeNodeView::GetKey(const SIZE_T offset, KEY_T &k) const
+{
+  return GetKeyIn(*info,data,offset,k);
+}
+
+ERROR_T BTreeNodeView::GetPtr(const SIZE_T offset, SIZE_T &ptr) const
+{
+  char *p=ResolvePtr(offset);
+
+  if (p==0) { 
+    return ERROR_NOMEM;
+  }
+  
+  memcpy(&ptr,p,sizeof(SIZE_T));
+  return ERROR_NOERROR;
+}
+
+ERROR_T BTreeNodeView::GetVal(const SIZE_T offset, VALUE_T &v) const
+{
+  char *p=ResolveVal(offset);
+
+  if (p==0) { 
+    return ERROR_NOMEM;
+  }
+  
+  v.Resize(info->valuesize,false);
+  memcpy(v.data,p,info->valuesize);
+  return ERROR_NOERROR;
+}
+
+
+ERROR_T BTreeNodeView::SetKey(const SIZE_T offset, const KEY_T &k)
+{
+  ERROR_T rc=SetKeyIn(*info,data,offset,k);
+
+  if (rc!=ERROR_NOERROR) { 
+    return rc;
+  }
+  dirty=true;
+
+  return ERROR_NOERROR;
+}
+
+
+ERROR_T BTreeNodeView::SetPtr(const SIZE_T offset, const SIZE_T &ptr)
+{
+  char *p=ResolvePtr(offset);
+
+  if (p==0) { 
+    return ERROR_NOMEM;
+  }
+
+  memcpy(p,&ptr,sizeof(SIZE_T));
+  dirty=true;
+
+  return ERROR_NOERROR;
+}
+
+
+ERROR_T BTreeNodeView::SetVal(const SIZE_T offset, const VALUE_T &v)
+{
+  char *p=ResolveVal(offset);
+  
+  if (p==0) { 
+    return ERROR_NOMEM;
+  }
+  
+  memcpy(p,v.data,info->valuesize);
+  dirty=true;
+  
+  return ERROR_NOERROR;
+}
+
+
+int BTreeNodeView::CompareKey(const SIZE_T offset, const KEY_T &k) const
+{
+  return CompareKeyIn(*info,data,offset,k);
+}
+
+
+SIZE_T BTreeNodeView::FindKey(const KEY_T &k) const
+{
+  return FindKeyIn(*info,data,k);
+}
+
+
+SIZE_T BTreeNodeView::GetSlotSize() const
+{
+  return info->nodetype==BTREE_LEAF_NODE ? info->GetStoredKeySize()+info->valuesize : info->GetStoredKeySize()+sizeof(SIZE_T);
+}
+
+
+SIZE_T BTreeNodeView::GetNumSlots() const
+{
+  return info->nodetype==BTREE_LEAF_NODE ? info->GetNumSlotsAsLeaf() : info->GetNumSlotsAsInterior();
+}
+
+
+char * BTreeNodeView::ResolveSlot(const SIZE_T offset) const
+{
+  assert(info->nodetype==BTREE_LEAF_NODE || info->nodetype==BTREE_INTERIOR_NODE || info->nodetype==BTREE_ROOT_NODE);
+  assert(offset<=info->numkeys);
+  return data+sizeof(SIZE_T)+offset*GetSlotSize();
+}
+
+
+ERROR_T BTreeNodeView::InsertSlot(const SIZE_T offset)
+{
+  if (info->numkeys>=GetNumSlots()) { 
+    return ERROR_NOSPACE;
+  }
+
+  char *p=ResolveSlot(offset);
+
+  memmove(p+GetSlotSize(),p,(info->numkeys-offset)*GetSlotSize());
+  info->numkeys++;
+  dirty=true;
+
+  return ERROR_NOERROR;
+}
+
+
+ERROR_T BTreeNodeView::RemoveSlot(const SIZE_T offset)
+{
+  assert(offset<info->numkeys);
+
+  char *p=ResolveSlot(offset);
+
+  memmove(p,p+GetSlotSize(),(info->numkeys-offset-1)*GetSlotSize());
+  info->numkeys--;
+  dirty=true;
+
+  return ERROR_NOERROR;
+}
+
+
+ERROR_T BTreeNodeView::MoveSlots(const SIZE_T offset, const SIZE_T num, BTreeNodeView &to)
+{
+  assert(offset+num<=info->numkeys);
+  assert(to.GetSlotSize()==GetSlotSize());
+  assert(to.info->prefixlen==info->prefixlen);
+
+  if (to.info->numkeys+num>to.GetNumSlots()) { 
+    return ERROR_NOSPACE;
+  }
+
+  char *p=ResolveSlot(offset);
+
+  memcpy(to.ResolveSlot(to.info->numkeys),p,num*GetSlotSize());
+  to.info->numkeys+=num;
+  to.dirty=true;
+
+  memmove(p,p+num*GetSlotSize(),(info->numkeys-offset-num)*GetSlotSize());
+  info->numkeys-=num;
+  dirty=true;
+
+  return ERROR_NOERROR;
+}
+
+
+ERROR_T BTreeNodeView::SetPrefix(const KEY_T &k, const SIZE_T len)
+{
+  SIZE_T oldlen=info->prefixlen;
+  SIZE_T oldstride=GetSlotSize();
+  char *slots=data+sizeof(SIZE_T);
+
+  // the prefixes agree as far as both go
+  if (len>=info->keysize || memcmp(ResolvePrefixIn(*info,data),k.data,len<oldlen ? len : oldlen)) { 
+    return ERROR_INSANE;
+  }
+
+  if (len>oldlen) { 
+    for (SIZE_T i=0;i<info->numkeys;i++) { 
+      if (memcmp(slots+i*oldstride,k.data+oldlen,len-oldlen)) { 
+	return ERROR_INSANE;
       }
-      os <<")";
     }
   }
+
+  NodeMetadata newinfo=*info;
+  newinfo.prefixlen=len;
+
+  // the bytes that become or stop being prefix, saved since longer
+  // slots may run over where the prefix is now
+  Block prefix(len>oldlen ? len : oldlen);
+  memcpy(prefix.data,ResolvePrefixIn(*info,data),oldlen);
+  memcpy(prefix.data+oldlen,k.data+oldlen,prefix.length-oldlen);
+
+  if (info->numkeys>(info->nodetype==BTREE_LEAF_NODE ? newinfo.GetNumSlotsAsLeaf() : newinfo.GetNumSlotsAsInterior())) { 
+    return ERROR_NOSPACE;
+  }
+
+  SIZE_T newstride=oldstride+oldlen-len;
+
+  if (len>oldlen) { 
+    // the slots shrink, so go front to back, dropping what is now prefix
+    for (SIZE_T i=0;i<info->numkeys;i++) { 
+      memmove(slots+i*newstride,slots+i*oldstride+(len-oldlen),newstride);
+    }
+  } else if (len<oldlen) { 
+    // the slots grow, so go back to front, putting back what was prefix
+    for (SIZE_T i=info->numkeys;i-->0;) { 
+      memmove(slots+i*newstride+(oldlen-len),slots+i*oldstride,oldstride);
+      memcpy(slots+i*newstride,prefix.data+len,oldlen-len);
+    }
+  }
+
+  info->prefixlen=len;
+  memcpy(ResolvePrefixIn(*info,data),prefix.data,len);
+  dirty=true;
+
+  return ERROR_NOERROR;
+}
+
+
+ostream & BTreeNodeView::Print(ostream &os) const 
+{
+  os << "BTreeNodeView(block="<<blocknum;
+  if (info) {
+    os << ", info="<<*info;
+    PrintSlots(os,*info,*this);
+  }
   os <<")";
   return os;
 }
@@ -14,6 +14,12 @@ using namespace std;
 #define BTREE_INTERIOR_NODE 3
 #define BTREE_LEAF_NODE 4
 
+// Stored in every node, so that a tree laid out with different
+// sizes of fields is caught instead of misread.  Version 2 has 64
+// bit block numbers.  Version 3 can store a prefix common to the keys
+// of a node once, rather than in every key.
+#define BTREE_FORMAT_VERSION 0x42540003
+
 
 typedef Block Buffer;
 typedef Buffer KeyOrValue;
@@ -25,8 +31,9 @@ class BufferCache;
 struct KeyValuePair;
 
 struct NodeMetadata {
-  NodeMetadata(): check(false) {}
+  NodeMetadata(): check(false), prefixkeys(false), prefixlen(0) {}
   int nodetype;
+  int format;
   SIZE_T keysize; 
   SIZE_T valuesize;
   SIZE_T blocksize;
@@ -35,10 +42,13 @@ struct NodeMetadata {
   SIZE_T numkeys;
   SIZE_T parentnode;
   bool check;
+  bool prefixkeys; //meaningful only for superblock: nodes are given key prefixes
+  unsigned prefixlen; //bytes at the start of every key stored once for the node
 
   SIZE_T GetNumDataBytes() const;
   SIZE_T GetNumSlotsAsInterior() const;
   SIZE_T GetNumSlotsAsLeaf() const;
+  SIZE_T GetStoredKeySize() const; // The bytes of each key after the prefix
 
   ostream &Print(ostream &rhs) const;
 			  
@@ -52,13 +62,19 @@ inline ostream & operator<< (ostream &os, const NodeMetadata &node) { return nod
 //
 // Interior node:
 //
-// PTR KEY PTR KEY PTR KEY PTR
+// PTR KEY PTR KEY PTR KEY PTR ... PREFIX
 //
 // Leaf:
 //
-// PTR* KEY VALUE KEY VALUE KEY VALUE
+// PTR* KEY VALUE KEY VALUE KEY VALUE ... PREFIX
 //
 // *Here this pointer is not used
+//
+// PREFIX is the first prefixlen bytes of every key that can be in the
+// node, kept once at the very end of the data, and each KEY is only
+// the rest of its key.  Without a prefix, prefixlen is 0 and the keys
+// are whole.  Get, Set, and the compares take and give whole keys
+// either way; Resolve gives where the stored part is.
 
 
 struct BTreeNode {
@@ -100,6 +116,10 @@ struct BTreeNode {
   ERROR_T SetVal(const SIZE_T offset, const VALUE_T &v); // Writes the ith value (leaf)
   ERROR_T SetKeyVal(const SIZE_T offset, const KeyValuePair &p); // Writes the ith key value pair (leaf)
 
+  // These compare the keys where they lie, without copying them out
+  int     CompareKey(const SIZE_T offset, const KEY_T &k) const; // Compares the ith key with k, like memcmp
+  SIZE_T  FindKey(const KEY_T &k) const; // Binary search: how many keys are <= k (interior: the ptr to follow, leaf: where k goes)
+
   ostream &Print(ostream &rhs) const;
 };
 
@@ -107,6 +127,86 @@ struct BTreeNode {
 inline ostream & operator<<(ostream &os, const BTreeNode &node) { return node.Print(os); }
 
 
+//
+// A node in place in the buffer cache
+//
+// Where BTreeNode copies a node out of its block and back again, a
+// view pins the block and reads and writes the header and slots right
+// there, so looking at a node allocates and copies nothing.  info and
+// data point into the cached block, laid out as BTreeNode serializes.
+//
+// The Set calls mark the node dirty.  Changing info directly does
+// not, so call MarkDirty after.  Release, or the destructor, unpins
+// the block and writes the node if it is dirty.  Each view holds a
+// pin, and pinned blocks can't be evicted, so release views on the
+// way down a tree rather than holding the whole path.
+//
+struct BTreeNodeView {
+  NodeMetadata *info;
+  char         *data;
+
+  BTreeNodeView();
+  ~BTreeNodeView();
+
+  // Pin the node in block and look at it, releasing whatever node the
+  // view was on.  ERROR_BADCONFIG if it isn't in this version's format.
+  ERROR_T Attach(BufferCache *b, const SIZE_T block);
+  // Pin block without reading it, and make a new empty node there
+  ERROR_T Create(BufferCache *b, const SIZE_T block, int node_type, SIZE_T key_size, SIZE_T value_size);
+  void    MarkDirty();
+  ERROR_T Release();
+  SIZE_T  GetBlockNum() const;
+
+  char *ResolveKey(const SIZE_T offset) const; // Gives a pointer to the ith key  (interior or leaf)
+  char *ResolvePtr(const SIZE_T offset) const; // Gives a pointer to the ith pointer (interior)
+  char *ResolveVal(const SIZE_T offset) const; // Gives a pointer to the ith value (leaf)
+
+  ERROR_T GetKey(const SIZE_T offset, KEY_T &k) const ; // Gives the ith key  (interior or leaf)
+  ERROR_T GetPtr(const SIZE_T offset, SIZE_T &p) const ;   // Gives the ith pointer (interior)
+  ERROR_T GetVal(const SIZE_T offset, VALUE_T &v) const ; // Gives  the ith value (leaf)
+
+  ERROR_T SetKey(const SIZE_T offset, const KEY_T &k); // Writes the ith key  (interior or leaf)
+  ERROR_T SetPtr(const SIZE_T offset, const SIZE_T &p);   // Writes the ith pointer (interior)
+  ERROR_T SetVal(const SIZE_T offset, const VALUE_T &v); // Writes the ith value (leaf)
+
+  int     CompareKey(const SIZE_T offset, const KEY_T &k) const; // Compares the ith key with k, like memcmp
+  SIZE_T  FindKey(const KEY_T &k) const; // Binary search: how many keys are <= k
+
+  // Slot i is the ith key with its value (leaf) or with the pointer to
+  // its right, i+1 (interior).  The slots are back to back, so these
+  // move any number of them with one memmove.  The first pointer of an
+  // interior node is not in a slot, and stays where it is.
+  SIZE_T  GetSlotSize() const;
+  SIZE_T  GetNumSlots() const; // How many fit
+  char   *ResolveSlot(const SIZE_T offset) const; // Gives a pointer to the ith slot, or to the end at numkeys
+  ERROR_T InsertSlot(const SIZE_T offset); // Opens slot offset, shifting the rest up, for the caller to fill
+  ERROR_T RemoveSlot(const SIZE_T offset); // Closes slot offset, shifting the rest down
+  ERROR_T MoveSlots(const SIZE_T offset, const SIZE_T num, BTreeNodeView &to); // Moves num slots from offset to the end of to
+
+  // Make the node's prefix the first len bytes of k, taking bytes off
+  // the front of each stored key or putting them back.  Every key in
+  // the node must start with the new prefix (ERROR_INSANE), and a
+  // shorter prefix must leave room for them (ERROR_NOSPACE).
+  ERROR_T SetPrefix(const KEY_T &k, const SIZE_T len);
+
+  ostream &Print(ostream &rhs) const;
+
+ private:
+  BufferCache *cache;
+  SIZE_T       blocknum;
+  bool         dirty;
+
+  ERROR_T Pin(BufferCache *b, const SIZE_T block, const bool fetch);
+
+  // A view is a pin, which can't be shared
+  BTreeNodeView(const BTreeNodeView &rhs);
+  BTreeNodeView & operator=(const BTreeNodeView &rhs);
+};
+
+
+inline ostream & operator<<(ostream &os, const BTreeNodeView &node) { return node.Print(os); }
+
+
 
 
 
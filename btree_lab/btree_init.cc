@@ -4,7 +4,8 @@
 
 void usage() 
 {
-  cerr << "usage: btree_init filestem cachesize keysize valuesize\n";
+  cerr << "usage: btree_init filestem cachesize keysize valuesize [LRU|CLOCK|2Q|ARC] [PREFIX]\n";
+  cerr << "       PREFIX stores the prefix the keys of a node share once per node\n";
 }
 
 
@@ -13,20 +14,32 @@ int main(int argc, char **argv)
   char *filestem;
   SIZE_T cachesize, keysize, valuesize;
   SIZE_T superblocknum;
+  ReplacementPolicyType policy=POLICY_LRU;
+  bool prefixkeys=false;
 
-  if (argc!=5) { 
+  if (argc<5 || argc>7) { 
     usage();
     return -1;
   }
 
+  for (int i=5; i<argc; i++) { 
+    if (string(argv[i])=="PREFIX") { 
+      prefixkeys=true;
+    } else if (ParseReplacementPolicy(argv[i],policy)!=ERROR_NOERROR) { 
+      usage();
+      return -1;
+    }
+  }
+
   filestem=argv[1];
   cachesize=atoi(argv[2]);
   keysize=atoi(argv[3]);
   valuesize=atoi(argv[4]);
 
-  DiskSystem disk(filestem);
-  BufferCache cache(&disk,cachesize);
-  BTreeIndex btree(keysize,valuesize,&cache);
+  unique_ptr<DiskSystem> diskp(OpenDiskSystem(filestem));
+  DiskSystem &disk=*diskp;
+  BufferCache cache(&disk,cachesize,policy);
+  BTreeIndex btree(keysize,valuesize,&cache,true,prefixkeys);
   
   ERROR_T rc;
 
@@ -50,6 +63,9 @@ int main(int argc, char **argv)
     }
     cerr << "Performance statistics:\n";
     
+    cerr << "policy          = "<<GetReplacementPolicyName(cache.GetPolicy())<<endl;
+    cerr << "numhits         = "<<cache.GetNumHits()<<endl;
+    cerr << "nummisses       = "<<cache.GetNumMisses()<<endl;
     cerr << "numallocs       = "<<cache.GetNumAllocs()<<endl;
     cerr << "numdeallocs     = "<<cache.GetNumDeallocs()<<endl;
     cerr << "numreads        = "<<cache.GetNumReads()<<endl;
@@ -3,7 +3,11 @@
 
 void usage() 
 {
-  cerr << "usage: btree_insert filestem cachesize key value\n";
+  cerr << "usage: btree_insert filestem cachesize key value [LRU|CLOCK|2Q|ARC] [FIFO|SSTF|SCAN|CLOOK] [WARM|WARMDATA] [MMAP] [ASYNC]\n";
+  cerr << "       WARM keeps the hot blocks in filestem.warm between runs,\n";
+  cerr << "       WARMDATA their contents too\n";
+  cerr << "       MMAP reads and writes the disk through a memory mapping\n";
+  cerr << "       ASYNC lets the disk's reads and writes overlap\n";
 }
 
 
@@ -12,20 +16,58 @@ int main(int argc, char **argv)
   char *filestem;
   SIZE_T cachesize;
   SIZE_T superblocknum;
+  ReplacementPolicyType policy=POLICY_LRU;
+  DiskSchedulerType scheduler=DISKSCHED_CLOOK;
+  bool warm=false, warmdata=false, memorymap=false, async=false;
   char *key, *value;
 
-  if (argc!=5) { 
+  if (argc<5 || argc>10) { 
     usage();
     return -1;
   }
 
+  for (int i=5; i<argc; i++) { 
+    if (string(argv[i])=="WARM" || string(argv[i])=="WARMDATA") { 
+      warm=true;
+      warmdata=string(argv[i])=="WARMDATA";
+    } else if (string(argv[i])=="MMAP") { 
+      memorymap=true;
+    } else if (string(argv[i])=="ASYNC") { 
+      async=true;
+    } else if (ParseDiskScheduler(argv[i],scheduler)==ERROR_NOERROR) { 
+      // the disk's request scheduler
+    } else if (ParseReplacementPolicy(argv[i],policy)!=ERROR_NOERROR) { 
+      usage();
+      return -1;
+    }
+  }
+
   filestem=argv[1];
   cachesize=atoi(argv[2]);
   key=argv[3];
   value=argv[4];
 
-  DiskSystem disk(filestem);
-  BufferCache cache(&disk,cachesize);
+  unique_ptr<DiskSystem> diskp(OpenDiskSystem(filestem));
+  DiskSystem &disk=*diskp;
+
+  disk.SetScheduler(scheduler);
+
+  if (memorymap && disk.EnableMemoryMap()!=ERROR_NOERROR) { 
+    cerr << "Can't memory map the disk\n";
+    return -1;
+  }
+
+  if (async && disk.EnableAsyncIO()!=ERROR_NOERROR) { 
+    cerr << "Can't do asynchronous I/O\n";
+    return -1;
+  }
+
+  BufferCache cache(&disk,cachesize,policy);
+
+  if (warm) { 
+    cache.EnableWarmStart(warmdata);
+  }
+
   BTreeIndex btree(0,0,&cache);
   
   ERROR_T rc;
@@ -55,6 +97,9 @@ int main(int argc, char **argv)
     }
     cerr << "Performance statistics:\n";
     
+    cerr << "policy          = "<<GetReplacementPolicyName(cache.GetPolicy())<<endl;
+    cerr << "numhits         = "<<cache.GetNumHits()<<endl;
+    cerr << "nummisses       = "<<cache.GetNumMisses()<<endl;
     cerr << "numallocs       = "<<cache.GetNumAllocs()<<endl;
     cerr << "numdeallocs     = "<<cache.GetNumDeallocs()<<endl;
     cerr << "numreads        = "<<cache.GetNumReads()<<endl;
@@ -64,6 +109,10 @@ int main(int argc, char **argv)
     cerr << endl;
     
     cerr << "total time      = "<<cache.GetCurrentTime()<<endl;
+    cerr << "scheduler       = "<<GetDiskSchedulerName(disk.GetScheduler())<<endl;
+    cerr << "seektime        = "<<disk.GetSeekTime()<<endl;
+    cerr << "rotationtime    = "<<disk.GetRotationTime()<<endl;
+    cerr << "transfertime    = "<<disk.GetTransferTime()<<endl;
 
     return 0;
   }
@@ -3,7 +3,7 @@
 
 void usage() 
 {
-  cerr << "usage: btree_show filestem cachesize\n";
+  cerr << "usage: btree_show filestem cachesize [LRU|CLOCK|2Q|ARC]\n";
 }
 
 
@@ -12,8 +12,14 @@ int main(int argc, char **argv)
   char *filestem;
   SIZE_T cachesize;
   SIZE_T superblocknum;
+  ReplacementPolicyType policy=POLICY_LRU;
 
-  if (argc!=3) { 
+  if (argc!=3 && argc!=4) { 
+    usage();
+    return -1;
+  }
+
+  if (argc==4 && ParseReplacementPolicy(argv[3],policy)!=ERROR_NOERROR) { 
     usage();
     return -1;
   }
@@ -21,8 +27,9 @@ int main(int argc, char **argv)
   filestem=argv[1];
   cachesize=atoi(argv[2]);
 
-  DiskSystem disk(filestem);
-  BufferCache cache(&disk,cachesize);
+  unique_ptr<DiskSystem> diskp(OpenDiskSystem(filestem));
+  DiskSystem &disk=*diskp;
+  BufferCache cache(&disk,cachesize,policy);
   BTreeIndex btree(0,0,&cache);
   
   ERROR_T rc;
@@ -50,6 +57,9 @@ int main(int argc, char **argv)
     }
     cerr << "Performance statistics:\n";
     
+    cerr << "policy          = "<<GetReplacementPolicyName(cache.GetPolicy())<<endl;
+    cerr << "numhits         = "<<cache.GetNumHits()<<endl;
+    cerr << "nummisses       = "<<cache.GetNumMisses()<<endl;
     cerr << "numallocs       = "<<cache.GetNumAllocs()<<endl;
     cerr << "numdeallocs     = "<<cache.GetNumDeallocs()<<endl;
     cerr << "numreads        = "<<cache.GetNumReads()<<endl;
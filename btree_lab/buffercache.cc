@@ -1,53 +1,319 @@
+#include <algorithm>
+#include <string.h>
+
 #include "buffercache.h"
 
-ERROR_T BufferCache::CheckDeleteOldest()
+CacheShard & BufferCache::ShardOf(const SIZE_T blocknum) const
+{
+  return *shards[(blocknum/BUFFERCACHE_SHARD_STRIPE)%shards.size()];
+}
+
+CacheEntry & BufferCache::EntryOf(const SIZE_T blocknum)
+{
+  return (*(ShardOf(blocknum).blockmap.find(blocknum))).second;
+}
+
+void BufferCache::LockAllShards() const
 {
-  // In a real buffer cache, we would use a priority queue to make this O(1)
+  for (SIZE_T i=0; i<shards.size(); i++) {
+    shards[i]->lock.lock();
+  }
+}
 
-  map<SIZE_T, Block, cache_compare_lessthan>::iterator oldestptr=blockmap.end();
-  double oldest = curtime+1;
+void BufferCache::UnlockAllShards() const
+{
+  for (SIZE_T i=shards.size(); i>0; i--) {
+    shards[i-1]->lock.unlock();
+  }
+}
+
+void BufferCache::AdvanceClock(const double t)
+{
+  double now=curtime;
+
+  while (t>now && !curtime.compare_exchange_weak(now,t)) {
+  }
+}
+
+void BufferCache::GetDirtyBlocks(vector<SIZE_T> &blocknums) const
+{
+  blocknums.clear();
+  for (SIZE_T s=0; s<shards.size(); s++) {
+    const CacheMap &blockmap=shards[s]->blockmap;
+    for (CacheMap::const_iterator i=blockmap.begin(); i!=blockmap.end(); ++i) {
+      if ((*i).second.block.dirty) {
+	blocknums.push_back((*i).first);
+      }
+    }
+  }
+  sort(blocknums.begin(),blocknums.end());
+}
 
-  // Only delete if the cache is full
-  if (blockmap.size() < cachesize) {
+ERROR_T BufferCache::WriteRun(const SIZE_T first, const SIZE_T num, const bool async)
+{
+  vector<Block> blocks;
+  double reqtime;
+  int rc;
+
+  blocks.reserve(num);
+  for (SIZE_T i=first; i<first+num; i++) { 
+    blocks.push_back(EntryOf(i).block);
+  }
+
+  {
+    lock_guard<mutex> d(disklock);
+    rc=disk->SubmitWrite(first,num,blocks,reqtime);
+    ChargeDiskTime(reqtime,async);
+  }
+  diskwrites+=num;
+  if (rc!=ERROR_NOERROR) { 
+    return rc;
+  }
+  for (SIZE_T i=first; i<first+num; i++) { 
+    Block &block=EntryOf(i).block;
+    if (block.dirty) { 
+      block.dirty=false;
+      numdirty--;
+    }
+  }
+  return ERROR_NOERROR;
+}
+
+ERROR_T BufferCache::WriteBackBlocks(const vector<SIZE_T> &blocknums, const bool async)
+{
+  vector<SIZE_T> runstart, runlen;
+
+  for (SIZE_T i=0; i<blocknums.size(); i++) { 
+    if (i>0 && blocknums[i]==blocknums[i-1]+1) { 
+      runlen.back()++;
+    } else {
+      runstart.push_back(blocknums[i]);
+      runlen.push_back(1);
+    }
+  }
+
+  if (runstart.empty()) { 
     return ERROR_NOERROR;
   }
 
-  // Find oldest
+  // Queue them all and let the disk's scheduler pick the order
+  ERROR_T rc=ERROR_NOERROR;
+  vector<double> reqtimes;
+  {
+    lock_guard<mutex> d(disklock);
+    disk->StartBatch();
+  }
+  for (SIZE_T r=0; r<runstart.size() && rc==ERROR_NOERROR; r++) { 
+    rc=WriteRun(runstart[r],runlen[r],async);
+  }
+  {
+    lock_guard<mutex> d(disklock);
+    disk->EndBatch(reqtimes);
+    for (SIZE_T i=0; i<reqtimes.size(); i++) { 
+      ChargeDiskTime(reqtimes[i],async);
+    }
+  }
+  return rc;
+}
 
-  for (map<SIZE_T, Block, cache_compare_lessthan>::iterator i=blockmap.begin();
-	 i!=blockmap.end();
-	 ++i) {
-       if ((*i).second.lastaccessed<oldest) { 
-	 oldestptr=i;
-	 oldest=(*i).second.lastaccessed;
-       }
+void BufferCache::MarkDirty(CacheEntry &e)
+{
+  if (!e.block.dirty) { 
+    e.block.dirty=true;
+    numdirty++;
   }
-  
-  // write and delete it if it exists
- 
-  if (oldestptr!=blockmap.end()) { 
-    if ((*oldestptr).second.dirty) {
-      double reqtime;
-      int rc=disk->Write((*oldestptr).first,
-			 (*oldestptr).second,
-			 reqtime);
-      curtime+=reqtime;
-      diskwrites++;
+}
+
+ERROR_T BufferCache::CheckWriteBack()
+{
+  if (writebackhigh>=1 || numdirty<=writebackhigh*cachesize) { 
+    return ERROR_NOERROR;
+  }
+
+  LockAllShards();
+
+  // Clean the least recently used dirty blocks, since they are the
+  // least likely to be dirtied again.  Pinned blocks may be in the
+  // middle of being changed, so they wait.
+  vector<pair<double,SIZE_T> > dirty;
+
+  for (SIZE_T s=0; s<shards.size(); s++) {
+    const CacheMap &blockmap=shards[s]->blockmap;
+    for (CacheMap::const_iterator i=blockmap.begin(); i!=blockmap.end(); ++i) {
+      if ((*i).second.block.dirty && (*i).second.pincount==0) {
+	dirty.push_back(make_pair((*i).second.block.lastaccessed,(*i).first));
+      }
+    }
+  }
+  sort(dirty.begin(),dirty.end());
+
+  SIZE_T keep=(SIZE_T)(writebacklow*cachesize);
+  vector<SIZE_T> blocknums;
+
+  for (SIZE_T i=0; i+keep<dirty.size(); i++) { 
+    blocknums.push_back(dirty[i].second);
+  }
+  sort(blocknums.begin(),blocknums.end());
+
+  // Nobody waits for these, though they do keep the disk busy
+  writebacks+=blocknums.size();
+  ERROR_T rc=WriteBackBlocks(blocknums,true);
+
+  UnlockAllShards();
+  return rc;
+}
+
+double BufferCache::ChargeDiskTime(const double reqtime, const bool async)
+{
+  // The disk does one request at a time, so a request starts once
+  // both we and the disk are ready
+  double now=curtime;
+  double start = diskbusyuntil>now ? diskbusyuntil : now;
+
+  diskbusyuntil = start+reqtime;
+
+  if (!async) { 
+    AdvanceClock(diskbusyuntil);
+  }
+  return diskbusyuntil;
+}
+
+ERROR_T BufferCache::WaitForBlock(CacheShard &s, CacheMap::iterator b)
+{
+  ERROR_T rc=FinishRead(s,b);
+
+  if (rc!=ERROR_NOERROR) { 
+    return rc;
+  }
+  AdvanceClock((*b).second.readytime);
+  return ERROR_NOERROR;
+}
+
+ERROR_T BufferCache::FinishRead(CacheShard &s, CacheMap::iterator b)
+{
+  CacheEntry &e=(*b).second;
+
+  if (!e.ioread) { 
+    return ERROR_NOERROR;
+  }
+
+  vector<Block> blocks;
+  ERROR_T rc;
+  {
+    lock_guard<mutex> d(disklock);
+    rc=disk->Complete(e.ioread,&blocks);
+  }
+  e.ioread=0;
+
+  if (rc!=ERROR_NOERROR) { 
+    s.policy->Remove((*b).first);
+    s.blockmap.erase(b);
+    return rc;
+  }
+
+  double t=e.block.lastaccessed;
+  e.block=blocks[0];
+  e.block.lastaccessed=t;
+  e.block.dirty=false;
+  return ERROR_NOERROR;
+}
+
+ERROR_T BufferCache::FinishAllReads()
+{
+  ERROR_T rc=ERROR_NOERROR;
+
+  for (SIZE_T i=0; i<shards.size(); i++) {
+    CacheShard &s=*shards[i];
+    vector<SIZE_T> inflight;
+
+    for (CacheMap::const_iterator b=s.blockmap.begin(); b!=s.blockmap.end(); ++b) {
+      if ((*b).second.ioread) {
+	inflight.push_back((*b).first);
+      }
+    }
+    // a block whose read failed just goes, but we still wait for the
+    // rest before reporting the first failure
+    for (SIZE_T j=0; j<inflight.size(); j++) {
+      ERROR_T r=FinishRead(s,s.blockmap.find(inflight[j]));
+      if (rc==ERROR_NOERROR) {
+	rc=r;
+      }
+    }
+  }
+  return rc;
+}
+
+void BufferCache::CancelRead(CacheEntry &e)
+{
+  if (e.ioread) { 
+    lock_guard<mutex> d(disklock);
+    disk->Complete(e.ioread);
+    e.ioread=0;
+  }
+}
+
+ERROR_T BufferCache::CheckDeleteOldest(CacheShard &s, const SIZE_T incoming, const bool async)
+{
+  CacheMap &blockmap=s.blockmap;
+  SIZE_T victimnum;
+
+  // Only delete if the shard is full.  The policy never picks pinned
+  // blocks, so if everything is pinned the shard runs over size until
+  // some are unpinned.
+  while (blockmap.size() >= s.cachesize && s.policy->Evict(victimnum,incoming)) {
+    CacheMap::iterator victim=blockmap.find(victimnum);
+
+    // write and delete it
+    if ((*victim).second.block.dirty) {
+      // The seek is the expensive part, so take any dirty neighbors
+      // along in the same request.  Only those in this shard, since
+      // those are the only ones we have locked, and not pinned ones,
+      // since whoever pinned them may be changing them right now.
+      SIZE_T first=victimnum, last=victimnum;
+      CacheMap::const_iterator n;
+      while (first>0 && (n=blockmap.find(first-1))!=blockmap.end() && (*n).second.block.dirty && (*n).second.pincount==0) { 
+	first--;
+      }
+      while ((n=blockmap.find(last+1))!=blockmap.end() && (*n).second.block.dirty && (*n).second.pincount==0) { 
+	last++;
+      }
+      ERROR_T rc=WriteRun(first,last-first+1,async);
       if (rc!=ERROR_NOERROR) { 
+	// it's still here
+	s.policy->Insert(victimnum,curtime);
 	return rc;
       }
     }
-    blockmap.erase(oldestptr);
+    CancelRead((*victim).second);
+    blockmap.erase(victim);
   }
   return ERROR_NOERROR;
 }
 
 BufferCache::BufferCache(DiskSystem *d,
-			 SIZE_T cs) : 
-   disk(d), cachesize(cs), curtime(0),
+			 SIZE_T cs,
+			 const ReplacementPolicyType p,
+			 const SIZE_T ns) :
+   disk(d), cachesize(cs),
+   curtime(0), diskbusyuntil(0),
    allocs(0), deallocs(0), reads(0), writes(0),
-   diskreads(0), diskwrites(0)
-{}
+   diskreads(0), diskwrites(0), prefetches(0),
+   hits(0), misses(0), numdirty(0),
+   writebackhigh(1), writebacklow(1), writebacks(0),
+   mrc(0), mrcreport(0), warmstart(false), warmcontents(false)
+{
+  SIZE_T numshards=ns;
+
+  if (numshards>cs) {
+    numshards=cs;
+  }
+  if (numshards<1) {
+    numshards=1;
+  }
+  for (SIZE_T i=0; i<numshards; i++) {
+    shards.push_back(new CacheShard(p,cs/numshards+(i<cs%numshards ? 1 : 0)));
+  }
+}
 
 
 BufferCache::~BufferCache()
@@ -55,36 +321,73 @@ BufferCache::~BufferCache()
   if (disk) { 
     Detach();
   }
-  disk=0; cachesize=0; curtime=0;
+  for (SIZE_T i=0; i<shards.size(); i++) {
+    delete shards[i];
+  }
+  shards.clear();
+  delete mrc;
+  disk=0; cachesize=0; curtime=0; mrc=0;
 }
 
 ERROR_T BufferCache::Attach()
 {
-  blockmap.clear();
-  return ERROR_NOERROR;
+  LockAllShards();
+  for (SIZE_T i=0; i<shards.size(); i++) {
+    shards[i]->blockmap.clear();
+    shards[i]->policy->Clear();
+    shards[i]->numpinned=0;
+  }
+  numdirty=0;
+  ERROR_T rc=ERROR_NOERROR;
+  if (warmstart) {
+    rc=LoadWarmStart();
+  }
+  UnlockAllShards();
+  return rc;
 }
 
 ERROR_T BufferCache::Detach()
 {
   // write out all of our data and then throw it away
+  vector<SIZE_T> dirty;
 
-  for (map<SIZE_T, Block, cache_compare_lessthan>::iterator i=blockmap.begin();
-	 i!=blockmap.end();
-	 ++i) {
-    if ((*i).second.dirty) { 
-      double reqtime;
-      int rc=disk->Write((*i).first,
-			 (*i).second,
-			 reqtime);
-      curtime+=reqtime;
-      diskwrites++;
-      if (rc!=ERROR_NOERROR) { 
-	return rc;
-      }
+  LockAllShards();
+
+  GetDirtyBlocks(dirty);
+
+  ERROR_T rc=WriteBackBlocks(dirty);
+
+  if (rc!=ERROR_NOERROR) { 
+    UnlockAllShards();
+    return rc;
+  }
+  // and wait for any prefetches still in progress, and for the
+  // writes to really finish.  We wait for all of them even after a
+  // failure, but report the first one, and then don't save a warm
+  // start that would claim writes the disk never got.
+  rc=FinishAllReads();
+  {
+    lock_guard<mutex> d(disklock);
+    ChargeDiskTime(0);
+    ERROR_T wrc=disk->CompleteAll();
+    if (rc==ERROR_NOERROR) { 
+      rc=wrc;
     }
   }
-  blockmap.clear();
-  return ERROR_NOERROR;
+  if (mrc && mrcreport) {
+    PrintMissRatioCurve(*mrcreport);
+  }
+  if (rc==ERROR_NOERROR && warmstart) {
+    rc=SaveWarmStart();
+  }
+  for (SIZE_T i=0; i<shards.size(); i++) {
+    shards[i]->blockmap.clear();
+    shards[i]->policy->Clear();
+    shards[i]->numpinned=0;
+  }
+  numdirty=0;
+  UnlockAllShards();
+  return rc;
 }
 
 
@@ -93,6 +396,54 @@ SIZE_T BufferCache::GetCacheSize() const
   return cachesize;
 }
 
+ERROR_T BufferCache::SetCacheSize(const SIZE_T newsize)
+{
+  if (newsize<shards.size()) {
+    return ERROR_BADCONFIG;
+  }
+
+  LockAllShards();
+
+  vector<SIZE_T> victims, dirty;
+
+  for (SIZE_T i=0; i<shards.size(); i++) {
+    CacheShard &s=*shards[i];
+    SIZE_T left=s.blockmap.size();
+    SIZE_T victimnum;
+
+    s.cachesize=newsize/shards.size()+(i<newsize%shards.size() ? 1 : 0);
+    s.policy->Resize(s.cachesize);
+    while (left>s.cachesize && s.policy->Evict(victimnum,NO_INCOMING_BLOCK)) {
+      victims.push_back(victimnum);
+      if (EntryOf(victimnum).block.dirty) {
+	dirty.push_back(victimnum);
+      }
+      left--;
+    }
+  }
+  cachesize=newsize;
+
+  // Write all the dirty victims back in one sweep, rather than one
+  // at a time in the order the policy gave them up
+  sort(dirty.begin(),dirty.end());
+  ERROR_T rc=WriteBackBlocks(dirty);
+
+  for (SIZE_T i=0; i<victims.size(); i++) {
+    CacheShard &s=ShardOf(victims[i]);
+    CacheMap::iterator b=s.blockmap.find(victims[i]);
+    if ((*b).second.block.dirty) {
+      // the write failed, so it's still here
+      s.policy->Insert(victims[i],curtime);
+    } else {
+      CancelRead((*b).second);
+      s.blockmap.erase(b);
+    }
+  }
+
+  UnlockAllShards();
+  return rc;
+}
+
 
 SIZE_T BufferCache::GetBlockSize() const
 {
@@ -109,14 +460,276 @@ double BufferCache::GetCurrentTime() const
   return curtime;
 }
 
+ReplacementPolicyType BufferCache::GetPolicy() const
+{
+  return shards[0]->policy->GetType();
+}
+
+SIZE_T BufferCache::GetNumShards() const
+{
+  return shards.size();
+}
+
+ERROR_T BufferCache::SetWriteBackWatermarks(const double high, const double low)
+{
+  if (low<0 || low>=high || high>1) { 
+    return ERROR_BADCONFIG;
+  }
+  writebackhigh=high;
+  writebacklow=low;
+  return CheckWriteBack();
+}
+
+ERROR_T BufferCache::EnableMissRatioCurve(const double samplerate, ostream *report)
+{
+  if (samplerate<=0 || samplerate>1) {
+    return ERROR_BADCONFIG;
+  }
+  delete mrc;
+  mrc=new MissRatioTracker(samplerate);
+  mrcreport=report;
+  return ERROR_NOERROR;
+}
+
+ostream & BufferCache::PrintMissRatioCurve(ostream &os) const
+{
+  if (!mrc) {
+    return os;
+  }
+
+  SIZE_T footprint=mrc->GetFootprint();
+  SIZE_T references=mrc->GetNumReferences();
+  SIZE_T requests=diskreads+diskwrites;
+  double now=curtime;
+  double permiss=requests>0 ? now/requests : 0;
+  double ourmisses=references*(1-mrc->GetHitRatio(cachesize));
+
+  os << "Predicted LRU miss ratio curve ("<<references<<" references, "
+     << footprint<<" distinct blocks)\n";
+  os << "cachesize\thitratio\ttime\n";
+
+  vector<SIZE_T> sizes;
+
+  for (SIZE_T c=1; ; c*=2) {
+    sizes.push_back(c);
+    if (c>=footprint) {
+      break;
+    }
+  }
+  if (find(sizes.begin(),sizes.end(),cachesize)==sizes.end()) {
+    sizes.push_back(cachesize);
+    sort(sizes.begin(),sizes.end());
+  }
+
+  for (SIZE_T i=0; i<sizes.size(); i++) {
+    double hitratio=mrc->GetHitRatio(sizes[i]);
+    double misses=references*(1-hitratio);
+    os << sizes[i] << "\t\t" << hitratio << "\t\t"
+       << now+(misses-ourmisses)*permiss
+       << (sizes[i]==cachesize ? "\t(this run)" : "") << "\n";
+  }
+  return os;
+}
+
+void BufferCache::EnableWarmStart(const bool withcontents)
+{
+  warmstart=true;
+  warmcontents=withcontents;
+}
+
+string BufferCache::WarmStartFileName() const
+{
+  return disk->GetFileStem()+".warm";
+}
+
+//
+// The warm start file is one text line
+//
+//   warmstart 1 blocksize count hascontents stamp
+//
+// followed by count block numbers, one per line, each followed by
+// the raw block if hascontents is 1.  The stamp is the disk's data
+// stamp when the file was written.
+//
+ERROR_T BufferCache::SaveWarmStart()
+{
+  vector<pair<double,SIZE_T> > byage;
+
+  for (SIZE_T s=0; s<shards.size(); s++) {
+    const CacheMap &blockmap=shards[s]->blockmap;
+    for (CacheMap::const_iterator i=blockmap.begin(); i!=blockmap.end(); ++i) {
+      byage.push_back(make_pair(-(*i).second.block.lastaccessed,(*i).first));
+    }
+  }
+  if (byage.empty()) {
+    // Nothing new to say (we are being detached a second time)
+    return ERROR_NOERROR;
+  }
+  sort(byage.begin(),byage.end());
+
+  string stamp="-";
+
+  if (warmcontents && disk->GetDataStamp(stamp)!=ERROR_NOERROR) {
+    return ERROR_NOFILE;
+  }
+
+  FILE *f=fopen(WarmStartFileName().c_str(),"w");
+
+  if (!f) {
+    return ERROR_NOFILE;
+  }
+  fprintf(f,"warmstart 1 %llu %llu %d %s\n",GetBlockSize(),(SIZE_T)byage.size(),warmcontents ? 1 : 0,stamp.c_str());
+  for (SIZE_T i=0; i<byage.size(); i++) {
+    fprintf(f,"%llu\n",byage[i].second);
+    if (warmcontents) {
+      const Block &block=EntryOf(byage[i].second).block;
+      fwrite(block.data,1,block.length,f);
+    }
+  }
+  if (fclose(f)) {
+    return ERROR_NOFILE;
+  }
+  return ERROR_NOERROR;
+}
+
+ERROR_T BufferCache::LoadWarmStart()
+{
+  FILE *f=fopen(WarmStartFileName().c_str(),"r");
+
+  if (!f) {
+    // first run
+    return ERROR_NOERROR;
+  }
+
+  // The file is only a hint, so anything odd about it means we
+  // just start cold
+  char line[256], stamp[128];
+  SIZE_T version, blocksize, count;
+  int hascontents;
+  string current;
+
+  if (!fgets(line,256,f)
+      || sscanf(line,"warmstart %llu %llu %llu %d %127s",&version,&blocksize,&count,&hascontents,stamp)!=5
+      || version!=1 || blocksize!=GetBlockSize()) {
+    fclose(f);
+    return ERROR_NOERROR;
+  }
+
+  bool fresh=hascontents && disk->GetDataStamp(current)==ERROR_NOERROR && current==stamp;
+  vector<SIZE_T> order, toread;
+  Block scratch(blocksize);
+
+  for (SIZE_T i=0; i<count; i++) {
+    SIZE_T blocknum;
+    if (!fgets(line,256,f) || sscanf(line,"%llu",&blocknum)!=1) {
+      break;
+    }
+    BYTE_T *data=scratch.data;
+    CacheShard &s=ShardOf(blocknum);
+    bool room=blocknum<GetNumBlocks() && s.blockmap.size()<s.cachesize
+      && s.blockmap.find(blocknum)==s.blockmap.end();
+    if (room && fresh) {
+      CacheEntry &e=s.blockmap[blocknum];
+      e.block.Resize(blocksize,false);
+      data=e.block.data;
+    }
+    if (hascontents && fread(data,1,blocksize,f)!=blocksize) {
+      if (room && fresh) {
+	s.blockmap.erase(blocknum);
+      }
+      break;
+    }
+    if (room) {
+      order.push_back(blocknum);
+      if (!fresh) {
+	// keep its place until we read it
+	s.blockmap[blocknum];
+	toread.push_back(blocknum);
+      }
+    }
+  }
+  fclose(f);
+
+  // Everything else comes off the disk in one batch, with each run
+  // of neighboring blocks in a single request, for the disk's
+  // scheduler to order.  The requests all go in before we wait for
+  // any of them, so that the real reads can overlap.
+  sort(toread.begin(),toread.end());
+
+  vector<SIZE_T> runstart, runlen, request;
+  vector<double> reqtimes;
+  ERROR_T rc=ERROR_NOERROR;
+
+  {
+    lock_guard<mutex> d(disklock);
+    disk->StartBatch();
+  }
+  for (SIZE_T i=0; i<toread.size(); ) {
+    SIZE_T num=1;
+    while (i+num<toread.size() && toread[i+num]==toread[i]+num) {
+      num++;
+    }
+    double reqtime;
+    SIZE_T r;
+    {
+      lock_guard<mutex> d(disklock);
+      rc=disk->SubmitRead(toread[i],num,reqtime,r);
+    }
+    if (rc!=ERROR_NOERROR) {
+      break;
+    }
+    diskreads+=num;
+    runstart.push_back(toread[i]);
+    runlen.push_back(num);
+    request.push_back(r);
+    i+=num;
+  }
+  {
+    lock_guard<mutex> d(disklock);
+    disk->EndBatch(reqtimes);
+    for (SIZE_T i=0; i<reqtimes.size(); i++) {
+      ChargeDiskTime(reqtimes[i]);
+    }
+  }
+  for (SIZE_T i=0; i<request.size(); i++) {
+    vector<Block> blocks;
+    ERROR_T crc;
+    {
+      lock_guard<mutex> d(disklock);
+      crc=disk->Complete(request[i],&blocks);
+    }
+    if (crc!=ERROR_NOERROR) {
+      rc=crc;
+      continue;
+    }
+    for (SIZE_T j=0; j<runlen[i]; j++) {
+      EntryOf(runstart[i]+j).block=blocks[j];
+    }
+  }
+  if (rc!=ERROR_NOERROR) {
+    return rc;
+  }
+
+  // Oldest first, so that the hottest blocks are the last to go
+  for (SIZE_T i=order.size(); i>0; i--) {
+    CacheEntry &e=EntryOf(order[i-1]);
+    e.block.dirty=false;
+    e.block.lastaccessed=curtime;
+    ShardOf(order[i-1]).policy->Insert(order[i-1],curtime);
+  }
+  return ERROR_NOERROR;
+}
+
 ERROR_T BufferCache::NotifyAllocateBlock(const SIZE_T outblocknum)
 {
+  lock_guard<mutex> d(disklock);
   allocs++;
   return disk->NotifyAllocateBlocks(outblocknum,1);
 }
 
 ERROR_T BufferCache::NotifyDeallocateBlock(const SIZE_T inblocknum)
 {
+  lock_guard<mutex> d(disklock);
   deallocs++;
   return disk->NotifyDeallocateBlocks(inblocknum,1);
 }
@@ -124,114 +737,294 @@ ERROR_T BufferCache::NotifyDeallocateBlock(const SIZE_T inblocknum)
 
 bool  BufferCache::IsBlockAllocated(const SIZE_T inblocknum)
 {
+  lock_guard<mutex> d(disklock);
   return disk->IsBlockAllocated(inblocknum);
 }
 
 
-ERROR_T BufferCache::ReadBlock(const SIZE_T inblocknum, Block &outblock) 
+ERROR_T BufferCache::LoadBlock(CacheShard &s, const SIZE_T blocknum, const bool fetch, CacheMap::iterator &b, const bool async)
 {
-  map<SIZE_T, Block, cache_compare_lessthan>::iterator b;
+  // It's not in cache, so time to allocate it
+  CheckDeleteOldest(s,blocknum,async);
 
-  b = blockmap.find(inblocknum);
+  b=s.blockmap.insert(CacheMap::value_type(blocknum,CacheEntry())).first;
 
-  if (b!=blockmap.end()) {
-    // It's in  cache, just update its lastaccessed and return it
-    outblock=(*b).second;
-    (*b).second.lastaccessed=curtime;
-    reads++;
-    return ERROR_NOERROR;
-  } else {
-    // It's not in cache, so time to allocate it
-    CheckDeleteOldest();
+  Block &block=(*b).second.block;
+
+  if (fetch) { 
     // read it from disk
-    if (!(disk->IsBlockAllocated(inblocknum))) { 
-      if (PRINT_BUFFERCACHE_ALLOCATION_ERRORS) {
-	cerr << "BufferCache::ReadBlock: Attempt to read unallocated block " << inblocknum<<endl;
+    int rc;
+    {
+      lock_guard<mutex> d(disklock);
+      if (!(disk->IsBlockAllocated(blocknum))) {
+	if (PRINT_BUFFERCACHE_ALLOCATION_ERRORS) {
+	  cerr << "BufferCache::ReadBlock: Attempt to read unallocated block " << blocknum<<endl;
+	}
       }
-    }
-    double reqtime;
-    int rc = disk->Read(inblocknum,
-			outblock,
+      double reqtime;
+      if (async) { 
+	// the data is filled in when someone first wants it
+	rc = disk->SubmitRead(blocknum,1,reqtime,(*b).second.ioread);
+      } else {
+	rc = disk->Read(blocknum,
+			block,
 			reqtime);
-    curtime+=reqtime;
+      }
+      (*b).second.readytime=ChargeDiskTime(reqtime,async);
+    }
     diskreads++;
+    if (rc!=ERROR_NOERROR) { 
+      s.blockmap.erase(b);
+      return rc;
+    }
+  } else {
+    // the caller is about to overwrite all of it
+    if (PRINT_BUFFERCACHE_ALLOCATION_ERRORS) {
+      if (!IsBlockAllocated(blocknum)) {
+	cerr << "BufferCache::WriteBlock: Attempt to write unallocated block " << blocknum << endl;
+      }
+    }
+    ERROR_T rc = block.Resize(GetBlockSize(),false);
+    if (rc!=ERROR_NOERROR) { 
+      s.blockmap.erase(b);
+      return rc;
+    }
+    memset(block.data,0,block.length);
+  }
+  block.dirty=false;
+  block.lastaccessed=curtime;
+  s.policy->Insert(blocknum,curtime);
+  return ERROR_NOERROR;
+}
+
+
+ERROR_T BufferCache::ReadBlock(const SIZE_T inblocknum, Block &outblock) 
+{
+  CacheShard &s=ShardOf(inblocknum);
+  lock_guard<mutex> l(s.lock);
+  CacheMap::iterator b;
+
+  b = s.blockmap.find(inblocknum);
+
+  if (mrc) {
+    mrc->Reference(inblocknum);
+  }
+
+  if (b!=s.blockmap.end()) {
+    // It's in  cache, just update its lastaccessed and return it
+    // (once it has actually arrived, if it was prefetched)
+    ERROR_T rc = WaitForBlock(s,b);
+    if (rc!=ERROR_NOERROR) { 
+      return rc;
+    }
+    (*b).second.block.lastaccessed=curtime;
+    s.policy->Touch(inblocknum,curtime);
+    hits++;
+  } else {
+    misses++;
+    ERROR_T rc = LoadBlock(s,inblocknum,true,b);
     if (rc!=ERROR_NOERROR) { 
       return rc;
-    } else {
-      outblock.lastaccessed=curtime;
-      outblock.dirty=false;
-      blockmap[inblocknum]=outblock;
-      reads++;
-      return ERROR_NOERROR;
     }
   }
-} 
- 
+  outblock=(*b).second.block;
+  reads++;
+  return ERROR_NOERROR;
+}
+
 ERROR_T BufferCache::WriteBlock(const SIZE_T inblocknum, const Block &inblock)
 {
-  map<SIZE_T, Block, cache_compare_lessthan>::iterator b;
-  
-  b = blockmap.find(inblocknum);
+  CacheShard &s=ShardOf(inblocknum);
+  {
+    lock_guard<mutex> l(s.lock);
+    CacheMap::iterator b;
 
-  if (b!=blockmap.end()) {
-    // It's in  cache, so just replace the block
-    (*b).second=inblock;
-    (*b).second.lastaccessed=curtime;
-    (*b).second.dirty=true;
+    b = s.blockmap.find(inblocknum);
+
+    if (mrc) {
+      mrc->Reference(inblocknum);
+    }
+
+    if (b==s.blockmap.end()) {
+      misses++;
+      ERROR_T rc = LoadBlock(s,inblocknum,false,b);
+      if (rc!=ERROR_NOERROR) { 
+	return rc;
+      }
+    } else {
+      // don't let a prefetch land on top of the new contents
+      ERROR_T rc = FinishRead(s,b);
+      if (rc!=ERROR_NOERROR) { 
+	return rc;
+      }
+      (*b).second.block.lastaccessed=curtime;
+      s.policy->Touch(inblocknum,curtime);
+      hits++;
+    }
+
+    // Replace the contents in place so that pinned pointers stay valid
+    CacheEntry &e=(*b).second;
+    if (e.block.length==inblock.length) {
+      memcpy(e.block.data,inblock.data,inblock.length);
+    } else {
+      double t=e.block.lastaccessed;
+      bool d=e.block.dirty;
+      e.block=inblock;
+      e.block.lastaccessed=t;
+      e.block.dirty=d;
+    }
+    MarkDirty(e);
     writes++;
-    return ERROR_NOERROR;
+  }
+  return CheckWriteBack();
+}
+
+
+ERROR_T BufferCache::PinBlock(const SIZE_T blocknum, Block *&block, const bool fetch)
+{
+  CacheShard &s=ShardOf(blocknum);
+  lock_guard<mutex> l(s.lock);
+  CacheMap::iterator b;
+
+  b = s.blockmap.find(blocknum);
+
+  if (mrc) {
+    mrc->Reference(blocknum);
+  }
+
+  if (b==s.blockmap.end()) {
+    misses++;
+    ERROR_T rc = LoadBlock(s,blocknum,fetch,b);
+    if (rc!=ERROR_NOERROR) { 
+      return rc;
+    }
   } else {
-    // It's not in cache, so time to allocate it
-    CheckDeleteOldest();
-    if (!(disk->IsBlockAllocated(inblocknum))) { 
-      if (PRINT_BUFFERCACHE_ALLOCATION_ERRORS) {
-	cerr << "BufferCache::WriteBlock: Attempt to write unallocated block " << inblocknum << endl;
-      }
+    hits++;
+    ERROR_T rc = fetch ? WaitForBlock(s,b) : FinishRead(s,b);
+    if (rc!=ERROR_NOERROR) { 
+      return rc;
     }
-    Block myblock=inblock;
-    myblock.lastaccessed=curtime;
-    myblock.dirty=true;
-    blockmap[inblocknum]=myblock;
+    (*b).second.block.lastaccessed=curtime;
+    s.policy->Touch(blocknum,curtime);
+  }
+
+  CacheEntry &e=(*b).second;
+
+  // pinned blocks can't be victims
+  if (e.pincount==0) { 
+    s.policy->Pin(blocknum);
+    s.numpinned++;
+  }
+  e.pincount++;
+
+  if (fetch) { 
+    reads++;
+  }
+  block=&(e.block);
+  return ERROR_NOERROR;
+}
+
+
+ERROR_T BufferCache::UnpinBlock(const SIZE_T blocknum, const bool dirty)
+{
+  CacheShard &s=ShardOf(blocknum);
+  {
+    lock_guard<mutex> l(s.lock);
+    CacheMap::iterator b;
+
+    b = s.blockmap.find(blocknum);
+
+    if (b==s.blockmap.end() || (*b).second.pincount==0) {
+      cerr << "BufferCache::UnpinBlock: Block "<<blocknum<<" is not pinned"<<endl;
+      return ERROR_NOSUCHBLOCK;
+    }
+
+    CacheEntry &e=(*b).second;
+
+    e.pincount--;
+    if (e.pincount==0) {
+      e.block.lastaccessed=curtime;
+      s.policy->Unpin(blocknum,curtime);
+      s.numpinned--;
+    }
+    if (!dirty) {
+      return ERROR_NOERROR;
+    }
+    MarkDirty(e);
     writes++;
-    return ERROR_NOERROR;
   }
+  return CheckWriteBack();
 }
-  
+
 ERROR_T BufferCache::PrefetchBlock (const SIZE_T blocknum)
 {
-  // Not implemented yet
-  return ERROR_IMPLBUG;
+  if (blocknum>=GetNumBlocks()) { 
+    return ERROR_NOSUCHBLOCK;
+  }
+
+  CacheShard &s=ShardOf(blocknum);
+  lock_guard<mutex> l(s.lock);
+  CacheMap::iterator b;
+
+  b = s.blockmap.find(blocknum);
+
+  if (b!=s.blockmap.end()) {
+    // Already here or on its way
+    return ERROR_NOERROR;
+  }
+
+  if (s.blockmap.size()>=s.cachesize && s.numpinned==s.blockmap.size()) {
+    // Everything is pinned
+    return ERROR_NOFETCH;
+  }
+
+  // Issue the read (and the write back of any dirty victim) without
+  // waiting for it.  The block is marked with the time it will
+  // arrive, and whoever reads it first waits until then.
+  ERROR_T rc = LoadBlock(s,blocknum,true,b,true);
+
+  if (rc!=ERROR_NOERROR) { 
+    return rc;
+  }
+  prefetches++;
+  return ERROR_NOERROR;
 }
-  
+
 ERROR_T BufferCache::FlushBlock(const SIZE_T blocknum)
 {
-  map<SIZE_T, Block, cache_compare_lessthan>::iterator b;
-  
-  b = blockmap.find(blocknum);
+  CacheShard &s=ShardOf(blocknum);
+  lock_guard<mutex> l(s.lock);
+  CacheMap::iterator b;
+
+  b = s.blockmap.find(blocknum);
 
-  if (b==blockmap.end()) { 
+  if (b==s.blockmap.end()) {
     return ERROR_NOERROR;
   } else {
-    if ((*b).second.dirty) { 
-      double reqtime;
-      int rc;
-      rc=disk->Write((*b).first,
-		     (*b).second,
-		     reqtime);
-      diskwrites++;
-      curtime+=reqtime;
+    if ((*b).second.block.dirty) { 
+      ERROR_T rc=WriteRun(blocknum,1);
       if (rc!=ERROR_NOERROR) { 
 	return rc;
       }
     }
-    blockmap.erase(b);
+    if ((*b).second.pincount>0) { 
+      // someone still holds a pointer to it
+      return ERROR_NOERROR;
+    }
+    CancelRead((*b).second);
+    s.policy->Remove(blocknum);
+    s.blockmap.erase(b);
     return ERROR_NOERROR;
   }
 }
-  
+
 ostream & BufferCache::Print(ostream &os) const
 {
+  LockAllShards();
+
   os << "BufferCache(cachesize="<<cachesize
+     << ", policy="<<GetReplacementPolicyName(GetPolicy())
+     << ", shards="<<shards.size()
      << ", blocksize="<<GetBlockSize()
      << ", curtime="<<curtime
      << ", allocs="<<allocs
@@ -240,19 +1033,34 @@ ostream & BufferCache::Print(ostream &os) const
      << ", writes="<<writes
      << ", diskreads="<<diskreads
      << ", diskwrites="<<diskwrites
+     << ", prefetches="<<prefetches
+     << ", writebacks="<<writebacks
+     << ", hits="<<hits
+     << ", misses="<<misses
      << ", blocks = {";
 
-  
-  for (map<SIZE_T, Block, cache_compare_lessthan>::const_iterator b=blockmap.begin(); 
-       b!=blockmap.end(); 
-       ++b) {
-    if (b!=blockmap.begin()) { 
+  vector<SIZE_T> blocknums;
+
+  for (SIZE_T s=0; s<shards.size(); s++) {
+    const CacheMap &blockmap=shards[s]->blockmap;
+    for (CacheMap::const_iterator b=blockmap.begin(); b!=blockmap.end(); ++b) {
+      blocknums.push_back((*b).first);
+    }
+  }
+  sort(blocknums.begin(),blocknums.end());
+
+  for (vector<SIZE_T>::const_iterator b=blocknums.begin(); b!=blocknums.end(); ++b) {
+    if (b!=blocknums.begin()) { 
       os << ", ";
     }
-    os << (*b).first << ((*b).second.dirty ? "(dirty)" : "");
+    const CacheMap &blockmap=ShardOf(*b).blockmap;
+    os << *b << (blockmap.find(*b)->second.block.dirty ? "(dirty)" : "");
   }
-  os << "}, disk="<<*disk<<")";
-  
+  {
+    lock_guard<mutex> d(disklock);
+    os << "}, disk="<<*disk<<")";
+  }
+
+  UnlockAllShards();
   return os;
 }
-  
@@ -2,39 +2,146 @@
 #define _buffercache
 
 #include <iostream>
-#include <map>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
 
 #include "global.h"
 #include "block.h"
 #include "disksystem.h"
+#include "replacement.h"
+#include "missratio.h"
 
 using namespace std;
 
-struct cache_compare_lessthan {
-  bool operator()(const SIZE_T s1, const SIZE_T s2) const {
-    return s1<s2;
-  }
+struct CacheEntry {
+  Block                   block;
+  SIZE_T                  pincount;
+  double                  readytime; // when a prefetched block arrives
+  SIZE_T                  ioread;    // disk request still bringing it in, or 0
+
+  CacheEntry() : pincount(0), readytime(0), ioread(0) {}
+};
+
+typedef unordered_map<SIZE_T, CacheEntry> CacheMap;
+
+// Blocks are spread over the shards in stripes of this many, so that
+// neighboring blocks usually share a shard and can be written together
+#define BUFFERCACHE_SHARD_STRIPE 16
+
+// One lock-protected slice of the cache, with its own replacement
+// policy over its own share of the cache size
+struct CacheShard {
+  mutex              lock;
+  CacheMap           blockmap;
+  ReplacementPolicy *policy;
+  SIZE_T             cachesize;
+  SIZE_T             numpinned;
+
+  CacheShard(const ReplacementPolicyType p, const SIZE_T cs) : 
+    policy(CreateReplacementPolicy(p,cs)), cachesize(cs), numpinned(0) {}
+  ~CacheShard() { delete policy; }
 };
 
 
 //
-// LRU block cache with single step prefetch
+// Block cache with single step prefetch
 //
 // Write Back
 // Write Allocate
+// Replacement policy chosen at construction (LRU by default)
+//
+// Dirty blocks are normally written when they are evicted.  With
+// write back watermarks set, once more than the high fraction of the
+// cache is dirty the oldest dirty blocks are cleaned in the
+// background, in disk order, until only the low fraction is dirty,
+// so that most misses find a clean victim.
+//
+// The cache is safe to share between threads.  It is split into
+// shards by block number, each with its own lock and replacement
+// policy, so that hits on different shards don't contend.  The disk
+// and the simulated clock sit behind a single lock, since the disk
+// does one request at a time anyway.  Locks are always taken shard
+// first, then disk, and several shards only in shard order.
 class BufferCache {
  private:
   DiskSystem *disk;
-  SIZE_T cachesize;
-  map<SIZE_T, Block, cache_compare_lessthan> blockmap;
-  double curtime;
-  SIZE_T allocs, deallocs, reads, writes, diskreads, diskwrites;
+  atomic<SIZE_T> cachesize;
+  vector<CacheShard *> shards;
+  mutable mutex disklock;   // disk, diskbusyuntil, and disk side of curtime
+  atomic<double> curtime;
+  double diskbusyuntil;  // completion time of the last queued disk request
+  atomic<SIZE_T> allocs, deallocs, reads, writes, diskreads, diskwrites, prefetches;
+  atomic<SIZE_T> hits, misses;
+  atomic<SIZE_T> numdirty;
+  double writebackhigh, writebacklow;
+  atomic<SIZE_T> writebacks;
+  MissRatioTracker *mrc;
+  ostream *mrcreport;
+  bool warmstart, warmcontents;
  protected:
-  ERROR_T CheckDeleteOldest();
+  CacheShard &ShardOf(const SIZE_T blocknum) const;
+  // Entry for a block that must be in the cache, with its shard locked
+  CacheEntry &EntryOf(const SIZE_T blocknum);
+  void    LockAllShards() const;
+  void    UnlockAllShards() const;
+  // Move curtime forward (never back) to t
+  void    AdvanceClock(const double t);
+  // Charge a disk request to the simulated clock.  A synchronous
+  // request advances curtime to its completion.  An asynchronous one
+  // only occupies the disk and returns when it will complete.
+  // Caller holds disklock.
+  double  ChargeDiskTime(const double reqtime, const bool async=false);
+  // Wait for a prefetched block to arrive, both really and on the
+  // simulated clock.  Caller holds the shard lock.  If the read
+  // failed, the block is dropped from the cache, b is no longer any
+  // good, and the error is returned.
+  ERROR_T WaitForBlock(CacheShard &s, CacheMap::iterator b);
+  // Same, but without waiting on the simulated clock
+  ERROR_T FinishRead(CacheShard &s, CacheMap::iterator b);
+  // Same for every block in the cache, returning the first failure.
+  // Caller holds all the shard locks.
+  ERROR_T FinishAllReads();
+  // Forget the read of a block that is leaving the cache before it
+  // arrived
+  void    CancelRead(CacheEntry &e);
+  // Evict from the shard until there is room for incoming
+  ERROR_T CheckDeleteOldest(CacheShard &s, const SIZE_T incoming, const bool async=false);
+  // Bring a block that is not in the cache in, reading it from disk
+  // only if fetch is set.  b is left pointing at the new entry.
+  // Caller holds the shard lock.
+  ERROR_T LoadBlock(CacheShard &s, const SIZE_T blocknum, const bool fetch, CacheMap::iterator &b, const bool async=false);
+  // Dirty blocks in the cache, in block order.  Caller holds all
+  // the shard locks.
+  void GetDirtyBlocks(vector<SIZE_T> &blocknums) const;
+  // Write the cached blocks first..first+num-1 in a single request.
+  // The blocks are clean once it is submitted.  If the disk does
+  // asynchronous I/O, a failure shows up later, at Detach.
+  // Caller holds the locks of the shards they are in.
+  ERROR_T WriteRun(const SIZE_T first, const SIZE_T num, const bool async=false);
+  // Write a sorted set of cached blocks, with adjacent blocks
+  // coalesced into one request, in a single batch so that the disk's
+  // scheduler orders the requests
+  ERROR_T WriteBackBlocks(const vector<SIZE_T> &blocknums, const bool async=false);
+  void    MarkDirty(CacheEntry &e);
+  // Start background write back if we are over the high watermark.
+  // Caller must hold no shard locks.
+  ERROR_T CheckWriteBack();
+  // Warm start file handling.  Caller holds all the shard locks.
+  string  WarmStartFileName() const;
+  ERROR_T SaveWarmStart();
+  ERROR_T LoadWarmStart();
  public:
-  // Cache size is in number of blocks
+  // Cache size is in number of blocks.  The cache is split evenly
+  // among numshards shards (at most one per block).  Use one shard
+  // unless several threads share the cache: each shard replaces
+  // blocks on its own, so more shards is a slightly worse
+  // approximation of the policy over the whole cache.
   BufferCache(DiskSystem *disk,
-	      const SIZE_T cachesize);
+	      const SIZE_T cachesize,
+	      const ReplacementPolicyType policy=POLICY_LRU,
+	      const SIZE_T numshards=1);
   BufferCache() { throw 0; }
   BufferCache(const BufferCache &rhs) { throw 0; } 
   BufferCache & operator=(const BufferCache &rhs) { throw 0; return *this; } 
@@ -47,12 +154,46 @@ class BufferCache {
 
   // Number of blocks in the cache
   SIZE_T GetCacheSize() const;
+  // Grow or shrink the cache while it is attached.  Shrinking evicts
+  // with the replacement policy and writes the dirty victims back
+  // together in disk order.  Pinned blocks are never evicted, so the
+  // cache can stay over size until they are unpinned.
+  // Returns ERROR_BADCONFIG if that's less than one block per shard.
+  ERROR_T SetCacheSize(const SIZE_T cachesize);
   // Number of bytes per block
   SIZE_T GetBlockSize() const;
   // Number of blocks in the underlying device
   SIZE_T GetNumBlocks() const;
   // Current time in the simulation (starts at zero)
   double GetCurrentTime() const;
+  // Replacement policy in use
+  ReplacementPolicyType GetPolicy() const;
+  SIZE_T GetNumShards() const;
+
+  // Fractions of the cache that may be dirty before background write
+  // back starts, and at which it stops.  Need 0 <= low < high.  A high
+  // watermark of 1 (the default) turns background write back off.
+  // Returns ERROR_BADCONFIG if the watermarks make no sense.
+  ERROR_T SetWriteBackWatermarks(const double high, const double low);
+
+  // Track the reuse distances of all reads, writes, and pins from
+  // now on, sampling samplerate of the blocks (see missratio.h).  If
+  // report is given, Detach prints the miss ratio curve to it.
+  // Returns ERROR_BADCONFIG unless 0 < samplerate <= 1.
+  ERROR_T EnableMissRatioCurve(const double samplerate=1.0, ostream *report=0);
+  // Predicted hit ratio and simulated time for a range of cache sizes.
+  // The time is what we took, plus or minus one average disk request
+  // per predicted extra or saved miss, so it is only a rough guide.
+  ostream & PrintMissRatioCurve(ostream &os) const;
+
+  // Warm start for short runs.  Detach saves the numbers of the
+  // blocks in the cache, most recently used first, to filestem.warm
+  // next to the disk's files, along with their contents if
+  // withcontents is set.  Attach brings them back in: straight from
+  // that file if it has the contents and the disk's data file hasn't
+  // changed since, otherwise from the disk in sorted multi-block
+  // reads.  Call before Attach.
+  void EnableWarmStart(const bool withcontents=false);
 
   // outblocknum is the number of the block that we just allocated
   // if the error return is nonzero
@@ -71,8 +212,23 @@ class BufferCache {
   // ERROR_WRONGSIZEBLOCK or other nonzero error codes
   ERROR_T WriteBlock(const SIZE_T inblocknum, const Block &inblock);
   
+  // Zero-copy access to the cached copy of a block.  PinBlock returns
+  // a pointer to the cache's own Block, which will not be evicted or
+  // moved until the matching UnpinBlock.  Pass dirty=true to UnpinBlock
+  // if you modified the data.  Pins nest.
+  //
+  // fetch=false skips the disk read on a miss and hands back a zeroed
+  // block - use it only when you will overwrite the whole block.
+  // A pin with fetch counts as a read, an unpin with dirty as a write.
+  //
+  // All blocks must be unpinned before Detach.
+  ERROR_T PinBlock(const SIZE_T blocknum, Block *&block, const bool fetch=true);
+  ERROR_T UnpinBlock(const SIZE_T blocknum, const bool dirty=false);
+
   // Request that a block be read into the cache
-  // This returns immediately.
+  // This returns immediately.  The read overlaps with whatever
+  // we do next, and a later read of the block waits only for
+  // whatever part of the disk time is left.
   // ERROR_NOFETCH means that there is no room currently
   // to prefetch the block and it was not prefetched.
   ERROR_T PrefetchBlock (const SIZE_T blocknum);
@@ -88,6 +244,12 @@ class BufferCache {
   SIZE_T GetNumWrites() const { return writes;}
   SIZE_T GetNumDiskReads() const { return diskreads;}
   SIZE_T GetNumDiskWrites() const { return diskwrites;}
+  SIZE_T GetNumPrefetches() const { return prefetches;}
+  // Blocks cleaned by background write back
+  SIZE_T GetNumWriteBacks() const { return writebacks;}
+  // Lookups (reads, writes, pins) that found / didn't find the block
+  SIZE_T GetNumHits() const { return hits;}
+  SIZE_T GetNumMisses() const { return misses;}
 
   ostream & Print(ostream &os) const;
   
@@ -0,0 +1,176 @@
+#include <string.h>
+#include <stdint.h>
+
+#include "compress.h"
+
+#define LZ_MINMATCH   4
+#define LZ_MAXOFFSET  65535
+#define LZ_HASHBITS   12
+// Matches stop short of the end, which is always literals
+#define LZ_LASTLITERALS 5
+
+static inline uint32_t Read32(const BYTE_T *p)
+{
+  uint32_t x;
+  memcpy(&x,p,4);
+  return x;
+}
+
+static inline SIZE_T Hash(const BYTE_T *p)
+{
+  return (Read32(p)*2654435761U) >> (32-LZ_HASHBITS);
+}
+
+// Writes the extension bytes of a count that didn't fit in its
+// four bits
+static inline bool PutCount(SIZE_T n, BYTE_T *&op, const BYTE_T *oend)
+{
+  while (n>=255) {
+    if (op>=oend) {
+      return false;
+    }
+    *op++=255;
+    n-=255;
+  }
+  if (op>=oend) {
+    return false;
+  }
+  *op++=(BYTE_T)n;
+  return true;
+}
+
+static inline bool PutSequence(const BYTE_T *lit, const SIZE_T numlit,
+			       const SIZE_T offset, const SIZE_T matchlen,
+			       BYTE_T *&op, const BYTE_T *oend)
+{
+  SIZE_T ml=matchlen ? matchlen-LZ_MINMATCH : 0;
+
+  if (op>=oend) {
+    return false;
+  }
+  BYTE_T *token=op++;
+  *token=(BYTE_T)(((numlit<15 ? numlit : 15)<<4) | (ml<15 ? ml : 15));
+  if (numlit>=15 && !PutCount(numlit-15,op,oend)) {
+    return false;
+  }
+  if ((SIZE_T)(oend-op)<numlit) {
+    return false;
+  }
+  memcpy(op,lit,numlit);
+  op+=numlit;
+  if (!matchlen) {
+    return true;
+  }
+  if (oend-op<2) {
+    return false;
+  }
+  *op++=(BYTE_T)(offset&0xff);
+  *op++=(BYTE_T)(offset>>8);
+  if (ml>=15 && !PutCount(ml-15,op,oend)) {
+    return false;
+  }
+  return true;
+}
+
+SIZE_T LZCompress(const BYTE_T *in, const SIZE_T len, BYTE_T *out, const SIZE_T outmax)
+{
+  // where each hash of four bytes was last seen, plus one
+  SIZE_T table[1<<LZ_HASHBITS];
+  const BYTE_T *ip=in, *anchor=in;
+  const BYTE_T *iend=in+len;
+  const BYTE_T *mflimit=len>LZ_LASTLITERALS+LZ_MINMATCH ? iend-LZ_LASTLITERALS-LZ_MINMATCH : in;
+  BYTE_T *op=out;
+  const BYTE_T *oend=out+outmax;
+
+  memset(table,0,sizeof(table));
+
+  while (ip<mflimit) {
+    SIZE_T h=Hash(ip);
+    SIZE_T cand=table[h];
+    table[h]=(ip-in)+1;
+
+    if (!cand || (SIZE_T)(ip-in)-(cand-1)>LZ_MAXOFFSET || Read32(in+cand-1)!=Read32(ip)) {
+      ip++;
+      continue;
+    }
+
+    const BYTE_T *match=in+cand-1;
+    const BYTE_T *mend=ip+LZ_MINMATCH;
+    while (mend<iend-LZ_LASTLITERALS && *mend==match[mend-ip]) {
+      mend++;
+    }
+
+    if (!PutSequence(anchor,ip-anchor,ip-match,mend-ip,op,oend)) {
+      return 0;
+    }
+    ip=anchor=mend;
+  }
+
+  if (!PutSequence(anchor,iend-anchor,0,0,op,oend)) {
+    return 0;
+  }
+  return op-out;
+}
+
+// Reads the extension bytes of a count
+static inline bool GetCount(SIZE_T &n, const BYTE_T *&ip, const BYTE_T *iend)
+{
+  BYTE_T b;
+  do {
+    if (ip>=iend) {
+      return false;
+    }
+    b=*ip++;
+    n+=b;
+  } while (b==255);
+  return true;
+}
+
+ERROR_T LZDecompress(const BYTE_T *in, const SIZE_T len, BYTE_T *out, const SIZE_T outlen)
+{
+  const BYTE_T *ip=in, *iend=in+len;
+  BYTE_T *op=out, *oend=out+outlen;
+
+  while (ip<iend) {
+    BYTE_T token=*ip++;
+    SIZE_T numlit=token>>4;
+
+    if (numlit==15 && !GetCount(numlit,ip,iend)) {
+      return ERROR_INSANE;
+    }
+    if ((SIZE_T)(iend-ip)<numlit || (SIZE_T)(oend-op)<numlit) {
+      return ERROR_INSANE;
+    }
+    memcpy(op,ip,numlit);
+    ip+=numlit;
+    op+=numlit;
+
+    if (ip==iend) {
+      // the last sequence
+      break;
+    }
+
+    if (iend-ip<2) {
+      return ERROR_INSANE;
+    }
+    SIZE_T offset=ip[0] | (ip[1]<<8);
+    ip+=2;
+    SIZE_T matchlen=token&0xf;
+    if (matchlen==15 && !GetCount(matchlen,ip,iend)) {
+      return ERROR_INSANE;
+    }
+    matchlen+=LZ_MINMATCH;
+
+    if (offset==0 || offset>(SIZE_T)(op-out) || (SIZE_T)(oend-op)<matchlen) {
+      return ERROR_INSANE;
+    }
+    // byte at a time, since the match may overlap what it makes
+    const BYTE_T *match=op-offset;
+    for (SIZE_T i=0;i<matchlen;i++) {
+      op[i]=match[i];
+    }
+    op+=matchlen;
+  }
+
+  return op==oend ? ERROR_NOERROR : ERROR_INSANE;
+}
@@ -0,0 +1,25 @@
+#ifndef _compress
+#define _compress
+
+#include "global.h"
+
+//
+// A small LZ77 codec for disk blocks, in the style of LZ4
+//
+// The output is a series of sequences, each a token byte (literal
+// count in the high four bits, match length less four in the low
+// four, with 15 meaning more bytes of count follow, each adding up
+// to 255), the literals, and a two byte little endian offset back to
+// the match.  The last sequence has only literals.  It is fast
+// rather than tight, which is the right trade under a disk model.
+//
+
+// Compresses len bytes of in into out, which has room for outmax
+// bytes.  Returns the compressed length, or 0 if it would not fit.
+SIZE_T LZCompress(const BYTE_T *in, const SIZE_T len, BYTE_T *out, const SIZE_T outmax);
+
+// Decompresses len bytes of in, which must come to exactly outlen
+// bytes, into out.  Returns ERROR_INSANE if the input is corrupt.
+ERROR_T LZDecompress(const BYTE_T *in, const SIZE_T len, BYTE_T *out, const SIZE_T outlen);
+
+#endif
@@ -0,0 +1,678 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <string.h>
+#include <stdio.h>
+
+#include <algorithm>
+
+#include "compressedvolume.h"
+#include "compress.h"
+
+
+#define COMPRESSEDVOLUME_MAGIC "# compressed volume config file"
+
+
+CompressedVolume::CompressedVolume(const string &filestem,
+				   const bool   create,
+				   const string &stem,
+				   const SIZE_T blocks,
+				   const SIZE_T ssize) :
+  DiskSystem(),
+  memberstem(stem),
+  member(0),
+  slotsize(ssize),
+  slotsperblock(0),
+  mapdirty(false),
+  nextslot(0),
+  nextrequest(1),
+  storedbytes(0),
+  logicalbytes(0)
+{
+  SIZE_T numblocks=blocks;
+
+  if (!create && ReadConfig(filestem,numblocks)!=ERROR_NOERROR) {
+    cerr << "Can't read the volume configuration.\n";
+    return;
+  }
+
+  member=OpenDiskSystem(memberstem);
+
+  if (member->GetNumBlocks()==0) {
+    cerr << "Member "<<memberstem<<" is missing.\n";
+    return;
+  }
+  if (slotsize<1 || member->GetBlockSize()%slotsize) {
+    cerr << "The slot size must divide the member's block size.\n";
+    return;
+  }
+  slotsperblock=member->GetBlockSize()/slotsize;
+  if (numblocks==0) {
+    numblocks=member->GetNumBlocks();
+  }
+
+  if (create) {
+    struct stat s;
+
+    if (stat((filestem+".config").c_str(),&s)!=-1 ||
+	stat((filestem+".bitmap").c_str(),&s)!=-1 ||
+	stat((filestem+".map").c_str(),&s)!=-1) {
+      cerr << "Configuration, bitmap, or map files exist for this name!\n";
+      return;
+    }
+  }
+
+  if (InitWithoutData(filestem,numblocks,member->GetBlockSize(),create)!=ERROR_NOERROR) {
+    return;
+  }
+
+  if (create) {
+    if (WriteConfig(filestem)!=ERROR_NOERROR) {
+      return;
+    }
+    SlotMapEntry blank={0,0};
+    slotmap.assign(numblocks,blank);
+    freeslots[0]=member->GetNumBlocks()*slotsperblock;
+    mapdirty=true;
+  } else if (ReadMap()!=ERROR_NOERROR) {
+    cerr << "Can't read the volume's map.\n";
+  }
+}
+
+CompressedVolume::~CompressedVolume()
+{
+  if (mapdirty) {
+    WriteMap();
+  }
+  requests.clear();
+  delete member;
+}
+
+bool CompressedVolume::IsCompressedVolume(const string &filestem)
+{
+  FILE *f;
+  char buf[80];
+  bool isvolume;
+
+  if ((f=fopen((filestem+".config").c_str(),"r"))==0) {
+    return false;
+  }
+  isvolume = fgets(buf,80,f) && !strncmp(buf,COMPRESSEDVOLUME_MAGIC,strlen(COMPRESSEDVOLUME_MAGIC));
+  fclose(f);
+  return isvolume;
+}
+
+
+ERROR_T CompressedVolume::WriteConfig(const string &filestem)
+{
+  FILE *f;
+
+  if ((f=fopen((filestem+".config").c_str(),"w"))==0) {
+    return ERROR_NOFILE;
+  }
+  fprintf(f,"%s version 1.0\n",COMPRESSEDVOLUME_MAGIC);
+  fprintf(f,"# filestem\n");
+  fprintf(f,"%s\n",filestem.c_str());
+  fprintf(f,"# numblocks\n");
+  fprintf(f,"%llu\n",GetNumBlocks());
+  fprintf(f,"# slotsize\n");
+  fprintf(f,"%llu\n",slotsize);
+  fprintf(f,"# member\n");
+  fprintf(f,"%s\n",memberstem.c_str());
+  fclose(f);
+
+  return ERROR_NOERROR;
+}
+
+ERROR_T CompressedVolume::ReadConfig(const string &filestem, SIZE_T &blocks)
+{
+  FILE *f;
+  char buf[1024];
+
+#define GETNEXTLINE do { if (!fgets(buf,1024,f)) { fclose(f); return ERROR_BADCONFIG; } } while (buf[0]=='#')
+#define CHOMP do { if (strlen(buf)>0 && buf[strlen(buf)-1]=='\n') { buf[strlen(buf)-1]=0; } } while (0)
+
+  if ((f=fopen((filestem+".config").c_str(),"r"))==0) {
+    return ERROR_NOFILE;
+  }
+  // filestem, which is just for show
+  GETNEXTLINE;
+  GETNEXTLINE;
+  sscanf(buf,"%llu",&blocks);
+  GETNEXTLINE;
+  sscanf(buf,"%llu",&slotsize);
+  GETNEXTLINE;
+  CHOMP;
+  memberstem=string(buf);
+  fclose(f);
+
+  return ERROR_NOERROR;
+}
+
+
+ERROR_T CompressedVolume::WriteMap()
+{
+  FILE *f;
+
+  if ((f=fopen((GetFileStem()+".map").c_str(),"w"))==0) {
+    return ERROR_NOFILE;
+  }
+  if (slotmap.size()>0 && fwrite(&(slotmap[0]),sizeof(SlotMapEntry),slotmap.size(),f)!=slotmap.size()) {
+    fclose(f);
+    return ERROR_NOFILE;
+  }
+  fclose(f);
+  mapdirty=false;
+  return ERROR_NOERROR;
+}
+
+ERROR_T CompressedVolume::ReadMap()
+{
+  FILE *f;
+  SIZE_T numslots=member->GetNumBlocks()*slotsperblock;
+  SlotMapEntry blank={0,0};
+
+  slotmap.assign(GetNumBlocks(),blank);
+
+  if ((f=fopen((GetFileStem()+".map").c_str(),"r"))==0) {
+    return ERROR_NOFILE;
+  }
+  if (slotmap.size()>0 && fread(&(slotmap[0]),sizeof(SlotMapEntry),slotmap.size(),f)!=slotmap.size()) {
+    fclose(f);
+    return ERROR_BADCONFIG;
+  }
+  fclose(f);
+
+  // The free runs are the gaps between the blocks
+  vector<pair<SIZE_T, SIZE_T> > used;
+
+  for (SIZE_T i=0;i<slotmap.size();i++) {
+    if (slotmap[i].length) {
+      used.push_back(make_pair(slotmap[i].firstslot,SlotsFor(slotmap[i].length)));
+      storedbytes+=slotmap[i].length;
+      logicalbytes+=GetBlockSize();
+    }
+  }
+  sort(used.begin(),used.end());
+
+  SIZE_T at=0;
+  for (SIZE_T i=0;i<used.size();i++) {
+    if (used[i].first>at) {
+      freeslots[at]=used[i].first-at;
+    }
+    at=max(at,used[i].first+used[i].second);
+  }
+  if (at<numslots) {
+    freeslots[at]=numslots-at;
+  }
+  return ERROR_NOERROR;
+}
+
+
+SIZE_T CompressedVolume::SlotsFor(const SIZE_T length) const
+{
+  return (length+slotsize-1)/slotsize;
+}
+
+void CompressedVolume::ReserveSlots(const SIZE_T first, const SIZE_T num)
+{
+  SIZE_T end=first+num;
+  map<SIZE_T, SIZE_T>::iterator i=freeslots.upper_bound(first);
+
+  if (i!=freeslots.begin()) {
+    --i;
+  }
+  while (i!=freeslots.end() && (*i).first<end) {
+    SIZE_T runfirst=(*i).first, runend=(*i).first+(*i).second;
+    map<SIZE_T, SIZE_T>::iterator next=i;
+    ++next;
+    if (runend>first) {
+      freeslots.erase(i);
+      if (runfirst<first) {
+	freeslots[runfirst]=first-runfirst;
+      }
+      if (runend>end) {
+	freeslots[end]=runend-end;
+      }
+    }
+    i=next;
+  }
+}
+
+void CompressedVolume::FreeSlots(const SIZE_T first, const SIZE_T num)
+{
+  SIZE_T runfirst=first, runlen=num;
+  map<SIZE_T, SIZE_T>::iterator next=freeslots.lower_bound(first);
+
+  if (num==0) {
+    return;
+  }
+  // join the runs on either side
+  if (next!=freeslots.end() && (*next).first==first+num) {
+    runlen+=(*next).second;
+    freeslots.erase(next++);
+  }
+  if (next!=freeslots.begin()) {
+    map<SIZE_T, SIZE_T>::iterator prev=next;
+    --prev;
+    if ((*prev).first+(*prev).second==first) {
+      runfirst=(*prev).first;
+      runlen+=(*prev).second;
+      freeslots.erase(prev);
+    }
+  }
+  freeslots[runfirst]=runlen;
+}
+
+ERROR_T CompressedVolume::AllocateSlots(const SIZE_T num, SIZE_T &first)
+{
+  map<SIZE_T, SIZE_T>::iterator start=freeslots.upper_bound(nextslot);
+
+  // right where the last allocation left off, if there is room
+  if (start!=freeslots.begin()) {
+    map<SIZE_T, SIZE_T>::iterator prev=start;
+    --prev;
+    if ((*prev).first+(*prev).second>=nextslot+num) {
+      first=nextslot;
+      ReserveSlots(first,num);
+      nextslot=first+num;
+      return ERROR_NOERROR;
+    }
+  }
+  // otherwise the next run that is big enough, wrapping around
+  for (map<SIZE_T, SIZE_T>::iterator i=start; ; ) {
+    if (i==freeslots.end()) {
+      i=freeslots.begin();
+    }
+    if (i==freeslots.end()) {
+      break;
+    }
+    if ((*i).second>=num) {
+      first=(*i).first;
+      ReserveSlots(first,num);
+      nextslot=first+num;
+      return ERROR_NOERROR;
+    }
+    ++i;
+    if (i==start) {
+      break;
+    }
+  }
+  return ERROR_NOSPACE;
+}
+
+
+double CompressedVolume::GetCompressionRatio() const
+{
+  return logicalbytes ? (double)storedbytes/(double)logicalbytes : 1.0;
+}
+
+
+ERROR_T CompressedVolume::ReadV(const SIZE_T   inoffblock,
+				const SIZE_T   numblock,
+				BYTE_T * const bufs[],
+				double        &reqtime)
+{
+  SIZE_T blocksize=GetBlockSize();
+
+  reqtime=0;
+
+  if (inoffblock+numblock > GetNumBlocks()) {
+    cerr << "CompressedVolume::Read: Attempt to read blocks "<<inoffblock<<" to "<<(inoffblock+numblock-1)<<", but maxmimum block is only "<<(GetNumBlocks()-1)<<endl;
+    return ERROR_NOSPACE;
+  }
+
+  // The member blocks holding the slots, read a contiguous run at a
+  // time.  runs maps the first block of a run to its contents.
+  vector<SIZE_T> needed;
+  map<SIZE_T, vector<BYTE_T> > runs;
+
+  for (SIZE_T i=0;i<numblock;i++) {
+    const SlotMapEntry &e=slotmap[inoffblock+i];
+    if (e.length) {
+      for (SIZE_T b=e.firstslot/slotsperblock; b<=(e.firstslot+SlotsFor(e.length)-1)/slotsperblock; b++) {
+	needed.push_back(b);
+      }
+    }
+  }
+  sort(needed.begin(),needed.end());
+  needed.erase(unique(needed.begin(),needed.end()),needed.end());
+
+  for (SIZE_T i=0; i<needed.size(); ) {
+    SIZE_T j=i+1;
+    while (j<needed.size() && needed[j]==needed[j-1]+1) {
+      j++;
+    }
+    vector<BYTE_T> &image=runs[needed[i]];
+    vector<BYTE_T *> ptrs(j-i);
+    double t;
+
+    image.resize((j-i)*blocksize);
+    for (SIZE_T k=0;k<j-i;k++) {
+      ptrs[k]=&(image[k*blocksize]);
+    }
+    ERROR_T rc=member->ReadV(needed[i],j-i,&(ptrs[0]),t);
+    reqtime+=t;
+    if (rc!=ERROR_NOERROR) {
+      return rc;
+    }
+    i=j;
+  }
+
+  for (SIZE_T i=0;i<numblock;i++) {
+    const SlotMapEntry &e=slotmap[inoffblock+i];
+
+    if (!e.length) {
+      // never written
+      memset(bufs[i],0,blocksize);
+      continue;
+    }
+
+    map<SIZE_T, vector<BYTE_T> >::iterator r=runs.upper_bound(e.firstslot/slotsperblock);
+    --r;
+    const BYTE_T *stored=&((*r).second[e.firstslot*slotsize-(*r).first*blocksize]);
+
+    if (e.length==blocksize) {
+      memcpy(bufs[i],stored,blocksize);
+    } else if (LZDecompress(stored,e.length,bufs[i],blocksize)!=ERROR_NOERROR) {
+      cerr << "CompressedVolume::Read: block "<<(inoffblock+i)<<" is corrupt"<<endl;
+      return ERROR_INSANE;
+    }
+  }
+
+  return ERROR_NOERROR;
+}
+
+ERROR_T CompressedVolume::WriteV(const SIZE_T   inoffblock,
+				 const SIZE_T   numblock,
+				 const BYTE_T * const bufs[],
+				 double        &reqtime)
+{
+  SIZE_T blocksize=GetBlockSize();
+
+  reqtime=0;
+
+  if (inoffblock+numblock > GetNumBlocks()) {
+    cerr << "CompressedVolume::Write: Attempt to write blocks "<<inoffblock<<" to "<<(inoffblock+numblock-1)<<", but maxmimum block is only "<<(GetNumBlocks()-1)<<endl;
+    return ERROR_NOSPACE;
+  }
+
+  // Compress each block into its own blocksize of packed.  A block
+  // that doesn't save at least a slot is stored as is.
+  vector<BYTE_T> packed(numblock*blocksize);
+  vector<SlotMapEntry> placed(numblock), old(numblock);
+
+  for (SIZE_T i=0;i<numblock;i++) {
+    BYTE_T *p=&(packed[i*blocksize]);
+    SIZE_T len=LZCompress(bufs[i],blocksize,p,blocksize-slotsize);
+    if (!len) {
+      memcpy(p,bufs[i],blocksize);
+      len=blocksize;
+    }
+    placed[i].length=len;
+    old[i]=slotmap[inoffblock+i];
+  }
+
+  // Blocks that fit where they were stay there, and the rest give
+  // their old slots back before any new ones are handed out
+  vector<bool> moved(numblock,false);
+
+  for (SIZE_T i=0;i<numblock;i++) {
+    SIZE_T need=SlotsFor(placed[i].length);
+    SIZE_T have=SlotsFor(old[i].length);
+    if (have>=need) {
+      placed[i].firstslot=old[i].firstslot;
+      FreeSlots(old[i].firstslot+need,have-need);
+    } else {
+      FreeSlots(old[i].firstslot,have);
+      moved[i]=true;
+    }
+  }
+  for (SIZE_T i=0;i<numblock;i++) {
+    if (moved[i] && AllocateSlots(SlotsFor(placed[i].length),placed[i].firstslot)!=ERROR_NOERROR) {
+      // put everything back as it was
+      for (SIZE_T j=0;j<i;j++) {
+	if (moved[j]) {
+	  FreeSlots(placed[j].firstslot,SlotsFor(placed[j].length));
+	}
+      }
+      for (SIZE_T j=0;j<numblock;j++) {
+	ReserveSlots(old[j].firstslot,SlotsFor(old[j].length));
+      }
+      return ERROR_NOSPACE;
+    }
+  }
+
+  // The member blocks the slots fall in, and how many of each block's
+  // slots are being written.  Those not wholly written have to be
+  // read first.
+  map<SIZE_T, SIZE_T> touched;
+
+  for (SIZE_T i=0;i<numblock;i++) {
+    SIZE_T s=placed[i].firstslot, end=s+SlotsFor(placed[i].length);
+    while (s<end) {
+      SIZE_T b=s/slotsperblock;
+      SIZE_T next=min((b+1)*slotsperblock,end);
+      touched[b]+=next-s;
+      s=next;
+    }
+  }
+
+  map<SIZE_T, vector<BYTE_T> > runs;
+
+  for (map<SIZE_T, SIZE_T>::iterator i=touched.begin(); i!=touched.end(); ) {
+    SIZE_T first=(*i).first, num=0;
+    map<SIZE_T, SIZE_T>::iterator j=i;
+    while (j!=touched.end() && (*j).first==first+num) {
+      num++;
+      ++j;
+    }
+    vector<BYTE_T> &image=runs[first];
+    image.resize(num*blocksize);
+    for (; i!=j; ++i) {
+      if ((*i).second<slotsperblock) {
+	BYTE_T *p=&(image[((*i).first-first)*blocksize]);
+	double t;
+	ERROR_T rc=member->ReadV((*i).first,1,&p,t);
+	reqtime+=t;
+	if (rc!=ERROR_NOERROR) {
+	  return rc;
+	}
+      }
+    }
+  }
+
+  for (SIZE_T i=0;i<numblock;i++) {
+    map<SIZE_T, vector<BYTE_T> >::iterator r=runs.upper_bound(placed[i].firstslot/slotsperblock);
+    --r;
+    memcpy(&((*r).second[placed[i].firstslot*slotsize-(*r).first*blocksize]),&(packed[i*blocksize]),placed[i].length);
+  }
+
+  for (map<SIZE_T, vector<BYTE_T> >::iterator r=runs.begin(); r!=runs.end(); ++r) {
+    SIZE_T num=(*r).second.size()/blocksize;
+    vector<const BYTE_T *> ptrs(num);
+    double t;
+    for (SIZE_T k=0;k<num;k++) {
+      ptrs[k]=&((*r).second[k*blocksize]);
+    }
+    ERROR_T rc=member->WriteV((*r).first,num,&(ptrs[0]),t);
+    reqtime+=t;
+    if (rc!=ERROR_NOERROR) {
+      return rc;
+    }
+  }
+
+  for (SIZE_T i=0;i<numblock;i++) {
+    if (old[i].length) {
+      storedbytes-=old[i].length;
+    } else {
+      logicalbytes+=blocksize;
+    }
+    storedbytes+=placed[i].length;
+    slotmap[inoffblock+i]=placed[i];
+  }
+  mapdirty=true;
+
+  return ERROR_NOERROR;
+}
+
+
+ERROR_T CompressedVolume::Sync()
+{
+  ERROR_T rc=member->Sync();
+
+  if (rc==ERROR_NOERROR && mapdirty) {
+    rc=WriteMap();
+  }
+  return rc;
+}
+
+void CompressedVolume::SetSyncWrites(const bool sync)
+{
+  member->SetSyncWrites(sync);
+}
+
+ERROR_T CompressedVolume::EnableMemoryMap()
+{
+  return member->EnableMemoryMap();
+}
+
+bool CompressedVolume::IsMemoryMapped() const
+{
+  return member->IsMemoryMapped();
+}
+
+ERROR_T CompressedVolume::EnableAsyncIO(const AsyncIOType type)
+{
+  return member->EnableAsyncIO(type);
+}
+
+bool CompressedVolume::GetAsyncIOType(AsyncIOType &type) const
+{
+  return member->GetAsyncIOType(type);
+}
+
+void CompressedVolume::SetScheduler(const DiskSchedulerType type)
+{
+  DiskSystem::SetScheduler(type);
+  member->SetScheduler(type);
+}
+
+void CompressedVolume::StartBatch()
+{
+  member->StartBatch();
+}
+
+void CompressedVolume::EndBatch(vector<double> &reqtimes)
+{
+  member->EndBatch(reqtimes);
+}
+
+SIZE_T CompressedVolume::GetNumRequests() const
+{
+  return member->GetNumRequests();
+}
+
+double CompressedVolume::GetSeekTime() const
+{
+  return member->GetSeekTime();
+}
+
+double CompressedVolume::GetRotationTime() const
+{
+  return member->GetRotationTime();
+}
+
+double CompressedVolume::GetTransferTime() const
+{
+  return member->GetTransferTime();
+}
+
+ERROR_T CompressedVolume::GetDataStamp(string &stamp)
+{
+  return member->GetDataStamp(stamp);
+}
+
+
+ERROR_T CompressedVolume::SubmitRead(const SIZE_T inoffblock,
+				     const SIZE_T numblock,
+				     double &reqtime,
+				     SIZE_T &request)
+{
+  VolumeRequest r;
+
+  r.rc=Read(inoffblock,numblock,r.blocks,reqtime);
+  if (r.rc!=ERROR_NOERROR) {
+    return r.rc;
+  }
+  request=nextrequest++;
+  requests[request].blocks.swap(r.blocks);
+  requests[request].rc=ERROR_NOERROR;
+  return ERROR_NOERROR;
+}
+
+ERROR_T CompressedVolume::SubmitWrite(const SIZE_T inoffblock,
+				      const SIZE_T numblock,
+				      const vector<Block> &blocks,
+				      double &reqtime,
+				      SIZE_T *request)
+{
+  ERROR_T rc=Write(inoffblock,numblock,blocks,reqtime);
+
+  if (request) {
+    *request=nextrequest++;
+    requests[*request].rc=rc;
+    return ERROR_NOERROR;
+  }
+  return rc;
+}
+
+bool CompressedVolume::IsComplete(const SIZE_T request)
+{
+  return true;
+}
+
+ERROR_T CompressedVolume::Complete(const SIZE_T request, vector<Block> *blocks)
+{
+  map<SIZE_T, VolumeRequest>::iterator i=requests.find(request);
+
+  if (i==requests.end()) {
+    return ERROR_NONEXISTENT;
+  }
+
+  ERROR_T rc=(*i).second.rc;
+
+  if (rc==ERROR_NOERROR && blocks) {
+    vector<Block> &from=(*i).second.blocks;
+    SIZE_T start=blocks->size();
+    blocks->resize(start+from.size());
+    for (SIZE_T k=0;k<from.size();k++) {
+      // hand the data over instead of copying it
+      swap(from[k].data,(*blocks)[start+k].data);
+      swap(from[k].length,(*blocks)[start+k].length);
+    }
+  }
+  requests.erase(i);
+  return rc;
+}
+
+ERROR_T CompressedVolume::CompleteAll()
+{
+  return ERROR_NOERROR;
+}
+
+
+ostream & CompressedVolume::Print(ostream &os) const
+{
+  os << "CompressedVolume(diskfilestem="<<GetFileStem()
+     << ", numblocks="<<GetNumBlocks()
+     << ", blocksize="<<GetBlockSize()
+     << ", slotsize="<<slotsize
+     << ", compressionratio="<<GetCompressionRatio()
+     << ", member=";
+  member->Print(os);
+  os << ", bitmap=";
+  PrintBitMap(os);
+  os << ")";
+  return os;
+}
@@ -0,0 +1,143 @@
+#ifndef _compressedvolume
+#define _compressedvolume
+
+#include <string>
+#include <iostream>
+#include <vector>
+#include <map>
+
+#include "global.h"
+#include "block.h"
+#include "disksystem.h"
+
+using namespace std;
+
+//
+// A volume that compresses its blocks onto another disk
+//
+// Each block written is compressed (see compress.h) and stored in a
+// run of slots on the member disk, slotsize bytes each, so a block
+// takes only as many slots as it compresses to.  A block that
+// doesn't compress is stored as is.  filestem.map says where each
+// block is.  Space is handed out next fit, so blocks written
+// together are stored together, and a block rewritten in no more
+// slots than before stays where it is.
+//
+// All of the time is the member's, for the member blocks actually
+// read and written, so it is charged on compressed bytes.  Writing
+// slots that share a member block with others means reading that
+// block first.
+//
+// The volume has its own filestem.config, filestem.bitmap, and
+// filestem.map, but no data file.  It may have more blocks than the
+// member, and then writes fail with ERROR_NOSPACE if the data
+// doesn't compress well enough.
+//
+class CompressedVolume : public DiskSystem {
+ private:
+  string      memberstem;
+  DiskSystem *member;
+  SIZE_T      slotsize;
+  SIZE_T      slotsperblock;   // per member block
+
+  // Where a block is stored.  length is the compressed length, or
+  // the block size if it is stored as is, or 0 if it has never been
+  // written (it reads as zeros).
+  struct SlotMapEntry {
+    SIZE_T firstslot;
+    SIZE_T length;
+  };
+
+  vector<SlotMapEntry> slotmap;
+  bool                 mapdirty;
+  // free runs of slots, first slot -> number of slots
+  map<SIZE_T, SIZE_T>  freeslots;
+  SIZE_T               nextslot;   // where the next fit search starts
+
+  // Finished asynchronous requests waiting to be Completed
+  struct VolumeRequest {
+    ERROR_T       rc;
+    vector<Block> blocks;
+  };
+  map<SIZE_T, VolumeRequest> requests;
+  SIZE_T                     nextrequest;
+
+  SIZE_T storedbytes;      // compressed bytes of the blocks written
+  SIZE_T logicalbytes;     // their uncompressed bytes
+
+  ERROR_T ReadConfig(const string &filestem, SIZE_T &blocks);
+  ERROR_T WriteConfig(const string &filestem);
+  ERROR_T ReadMap();
+  ERROR_T WriteMap();
+
+  SIZE_T  SlotsFor(const SIZE_T length) const;
+  // A run of num free slots, or ERROR_NOSPACE
+  ERROR_T AllocateSlots(const SIZE_T num, SIZE_T &first);
+  void    FreeSlots(const SIZE_T first, const SIZE_T num);
+  // Take first..first+num-1 out of the free runs
+  void    ReserveSlots(const SIZE_T first, const SIZE_T num);
+
+ public:
+  // The config is stored in file "filestem.config".  When creating,
+  // the member must already exist.  With blocks 0, the volume has as
+  // many blocks as the member.
+  CompressedVolume(const string &filestem,
+		   const bool create=false,
+		   const string &member="",
+		   const SIZE_T blocks=0,
+		   const SIZE_T slotsize=64);
+  CompressedVolume(const CompressedVolume &rhs) { throw GenericException();}
+  CompressedVolume & operator=(const CompressedVolume &rhs) { throw GenericException(); return *this;}
+
+  virtual ~CompressedVolume();
+
+  // Whether filestem.config describes a compressed volume
+  static bool IsCompressedVolume(const string &filestem);
+
+  // Stored bytes per byte written, over the blocks now on the volume
+  double  GetCompressionRatio() const;
+
+  ERROR_T ReadV(const SIZE_T inoffblock,
+		const SIZE_T numblock,
+		BYTE_T * const bufs[],
+		double &reqtime);
+  ERROR_T WriteV(const SIZE_T inoffblock,
+		 const SIZE_T numblock,
+		 const BYTE_T * const bufs[],
+		 double &reqtime);
+
+  // These go to the member
+  ERROR_T Sync();
+  void    SetSyncWrites(const bool sync);
+  ERROR_T EnableMemoryMap();
+  bool    IsMemoryMapped() const;
+  ERROR_T EnableAsyncIO(const AsyncIOType type=ASYNCIO_URING);
+  bool    GetAsyncIOType(AsyncIOType &type) const;
+  void    SetScheduler(const DiskSchedulerType type);
+  void    StartBatch();
+  void    EndBatch(vector<double> &reqtimes);
+  SIZE_T  GetNumRequests() const;
+  double  GetSeekTime() const;
+  double  GetRotationTime() const;
+  double  GetTransferTime() const;
+  ERROR_T GetDataStamp(string &stamp);
+
+  // Requests are carried out as they are submitted, since the
+  // compression has to happen in between the member's transfers
+  ERROR_T SubmitRead(const SIZE_T inoffblock,
+		     const SIZE_T numblock,
+		     double &reqtime,
+		     SIZE_T &request);
+  ERROR_T SubmitWrite(const SIZE_T inoffblock,
+		      const SIZE_T numblock,
+		      const vector<Block> &blocks,
+		      double &reqtime,
+		      SIZE_T *request=0);
+  bool    IsComplete(const SIZE_T request);
+  ERROR_T Complete(const SIZE_T request, vector<Block> *blocks=0);
+  ERROR_T CompleteAll();
+
+  ostream & Print(ostream &os) const;
+};
+
+#endif
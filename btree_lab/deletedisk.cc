@@ -20,6 +20,8 @@ int main(int argc, char *argv[])
   remove((string(argv[1])+".data").c_str());
   remove((string(argv[1])+".bitmap").c_str());
   remove((string(argv[1])+".config").c_str());
+  remove((string(argv[1])+".warm").c_str());
+  remove((string(argv[1])+".map").c_str());
 
   cerr << "Done.\n";
 
@@ -1,73 +1,111 @@
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <errno.h>
+#include <limits.h>
 
 #include <string.h>
+#include <ctype.h>
 #include <stdio.h>
 
 #include <math.h>
 
 #include "disksystem.h"
+#include "stripedvolume.h"
+#include "flashdisk.h"
+#include "compressedvolume.h"
 
 
-static SIZE_T mywrite(FILE *f, const SIZE_T off, const BYTE_T *buf, const int len)
+// Drops the first n bytes from an iovec array
+static void skipiov(struct iovec *&iov, int &iovcnt, SIZE_T n)
 {
-  SIZE_T left=len;
-  SIZE_T sent;
+  while (iovcnt>0 && n>=iov->iov_len) {
+    n-=iov->iov_len;
+    iov++;
+    iovcnt--;
+  }
+  if (iovcnt>0) {
+    iov->iov_base=((BYTE_T*)iov->iov_base)+n;
+    iov->iov_len-=n;
+  }
+}
 
-  fseek(f,off,SEEK_SET);
-  while (left>0) {
-    sent=fwrite(&(buf[len-left]),1,left,f);
-    if (sent<0) {	
-      return 0;
+// Positioned, gathering write of everything in iov, retrying short
+// writes.  iov is consumed.  Returns the number of bytes written.
+static SIZE_T mywritev(int fd, const off_t off, struct iovec *iov, int iovcnt)
+{
+  SIZE_T done=0;
+  ssize_t sent;
+
+  while (iovcnt>0) {
+    sent=pwritev(fd,iov,iovcnt<IOV_MAX ? iovcnt : IOV_MAX,off+done);
+    if (sent<0) {
+      if (errno==EINTR) {
+	continue;
+      }
+      break;
     } else if (sent==0) {
       break;
     } else {
-      left-=sent;
+      done+=sent;
+      skipiov(iov,iovcnt,sent);
     }
   }
-  return len-left;
+  return done;
 }
 
-static SIZE_T myread(FILE *f, const SIZE_T off, BYTE_T *buf, const int len, bool trunconeof=true)
+// Positioned, scattering read.  If we run off the end of the file,
+// the likely cause is that we are reading a block that has not been
+// written yet.  It reads as zeros if zeroeof is set, which is what
+// extending the file would give us, but without changing the file
+// on a read.
+static SIZE_T myreadv(int fd, const off_t off, struct iovec *iov, int iovcnt, bool zeroeof=true)
 {
-  SIZE_T left=len;
-  SIZE_T sent;
-
-  fseek(f,off,SEEK_SET);
-  while (left>0) {
-    sent=fread(&(buf[len-left]),1,left,f);
-    if (sent<0) {	
-      return 0;
-    } else if (sent==0) {
-      // if we reached this point, the likely cause is that we
-      // are trying to read a block which has not been allocated yet
-      // Hence, we will try to ftruncate to this size and then retry the
-      // read.  However, we don't want to loop forever doing this,
-      // hence the trunconeof parameter
-      if (!feof(f)) { 
-	// OK, the end of file is not the problem
-	break;
-      } else {
-	// EOF case... should we truncate and try again?
-	if (!trunconeof) { 
-	  break;
-	} else {
-	  // yes!
-	  if (ftruncate(fileno(f),off+len)) { 
-	    // uh oh, something weird is going on
-	    break;
-	  } else {
-	    // OK, now retry, but don't truncate a second time
-	    return myread(f,off,buf,len,false);
-	  }
+  SIZE_T done=0;
+  ssize_t got;
+
+  while (iovcnt>0) {
+    got=preadv(fd,iov,iovcnt<IOV_MAX ? iovcnt : IOV_MAX,off+done);
+    if (got<0) {
+      if (errno==EINTR) {
+	continue;
+      }
+      break;
+    } else if (got==0) {
+      if (zeroeof) {
+	for (int i=0;i<iovcnt;i++) {
+	  memset(iov[i].iov_base,0,iov[i].iov_len);
+	  done+=iov[i].iov_len;
 	}
       }
+      break;
     } else {
-      left-=sent;
+      done+=got;
+      skipiov(iov,iovcnt,got);
     }
   }
-  return len-left;
+  return done;
+}
+
+static SIZE_T mywrite(int fd, const off_t off, const BYTE_T *buf, const int len)
+{
+  struct iovec iov;
+
+  iov.iov_base=(void*)buf;
+  iov.iov_len=len;
+  return mywritev(fd,off,&iov,1);
+}
+
+static SIZE_T myread(int fd, const off_t off, BYTE_T *buf, const int len, bool zeroeof=true)
+{
+  struct iovec iov;
+
+  iov.iov_base=buf;
+  iov.iov_len=len;
+  return myreadv(fd,off,&iov,1,zeroeof);
 }
 
 
@@ -82,10 +120,18 @@ DiskSystem::DiskSystem(const string &filestem,
 		       const double avgseek,
 		       const double trackseek,
 		       const double rotlat) :
-  bitmap(0),
-  datafilefd(0),
+  datafilefd(-1),
   configfilefd(0),
-  bitmapfilefd(0),
+  bitmapfilefd(-1),
+  syncwrites(false),
+  datamap(0),
+  datamaplen(0),
+  dirtylo(0),
+  dirtyhi(0),
+  aio(0),
+  nextrequest(1),
+  numinflight(0),
+  detachederror(ERROR_NOERROR),
   diskfilestem(filestem), 
   offset(offset),
   numblocks(blcks),
@@ -97,7 +143,14 @@ DiskSystem::DiskSystem(const string &filestem,
   last_sector(0),
   averageseeklatency(avgseek),
   trackseeklatency(trackseek),
-  rotationallatency(rotlat)
+  rotationallatency(rotlat),
+  numrequests(0),
+  seektime(0),
+  rotationtime(0),
+  transfertime(0),
+  scheduler(DISKSCHED_CLOOK),
+  batching(false),
+  scanup(true)
 {
   if (create) { 
     // Only in this case are the parameters used:
@@ -107,14 +160,62 @@ DiskSystem::DiskSystem(const string &filestem,
   }
 }
 
+DiskSystem::DiskSystem() :
+  datafilefd(-1),
+  configfilefd(0),
+  bitmapfilefd(-1),
+  syncwrites(false),
+  datamap(0),
+  datamaplen(0),
+  dirtylo(0),
+  dirtyhi(0),
+  aio(0),
+  nextrequest(1),
+  numinflight(0),
+  detachederror(ERROR_NOERROR),
+  offset(0),
+  numblocks(0),
+  blocksize(0),
+  numheads(0),
+  blockspertrack(0),
+  numtracks(0),
+  last_track(0),
+  last_sector(0),
+  averageseeklatency(0),
+  trackseeklatency(0),
+  rotationallatency(0),
+  numrequests(0),
+  seektime(0),
+  rotationtime(0),
+  transfertime(0),
+  scheduler(DISKSCHED_CLOOK),
+  batching(false),
+  scanup(true)
+{
+}
+
 DiskSystem::~DiskSystem()
 {
-  WriteConfig();
-  WriteBitMap();
-  fclose(configfilefd);
-  fclose(bitmapfilefd);
-  fclose(datafilefd);
-  delete [] bitmap;
+  CompleteAll();
+  for (map<SIZE_T, DiskRequest *>::iterator i=requests.begin(); i!=requests.end(); ++i) { 
+    delete [] (*i).second->buf;
+    delete (*i).second;
+  }
+  delete aio;
+  if (configfilefd) { 
+    WriteConfig();
+    fclose(configfilefd);
+  }
+  if (bitmapfilefd>=0) { 
+    WriteBitMap();
+    close(bitmapfilefd);
+  }
+  if (datamap) { 
+    munmap(datamap,datamaplen);
+  }
+  if (datafilefd>=0) { 
+    close(datafilefd);
+  }
 }
 
 ERROR_T DiskSystem::SanityCheckConfig()
@@ -136,21 +237,21 @@ ERROR_T DiskSystem::WriteConfig()
 {
   ftruncate(fileno(configfilefd),0);
   rewind(configfilefd);
-  fprintf(configfilefd,"# disksystem config file version 0.9\n");
+  fprintf(configfilefd,"# disksystem config file version 1.0\n");
   fprintf(configfilefd,"# filestem\n");
   fprintf(configfilefd,"%s\n",diskfilestem.c_str());
   fprintf(configfilefd,"# offset\n");
-  fprintf(configfilefd,"%u\n",offset);
+  fprintf(configfilefd,"%llu\n",offset);
   fprintf(configfilefd,"# numblocks\n");
-  fprintf(configfilefd,"%u\n",numblocks);
+  fprintf(configfilefd,"%llu\n",numblocks);
   fprintf(configfilefd,"# blocksize\n");
-  fprintf(configfilefd,"%u\n",blocksize);
+  fprintf(configfilefd,"%llu\n",blocksize);
   fprintf(configfilefd,"# numheads\n");
-  fprintf(configfilefd,"%u\n",numheads);
+  fprintf(configfilefd,"%llu\n",numheads);
   fprintf(configfilefd,"# blockspertrack\n");
-  fprintf(configfilefd,"%u\n",blockspertrack);
+  fprintf(configfilefd,"%llu\n",blockspertrack);
   fprintf(configfilefd,"# numtracks\n");
-  fprintf(configfilefd,"%u\n",numtracks);
+  fprintf(configfilefd,"%llu\n",numtracks);
   fprintf(configfilefd,"# averageseeklatency\n");
   fprintf(configfilefd,"%lf\n",averageseeklatency);
   fprintf(configfilefd,"# trackseeklatency\n");
@@ -169,7 +270,7 @@ ERROR_T DiskSystem::ReadConfig()
   char buf[80];
 
 #define GETNEXTVAL do { fgets(buf,80,configfilefd); } while (buf[0]=='#')  
-#define PARSEUNSIGNED(x) do { sscanf(buf,"%u",x); } while (0)
+#define PARSEUNSIGNED(x) do { sscanf(buf,"%llu",x); } while (0)
 #define PARSEDOUBLE(x) do { sscanf(buf,"%lf",x); } while (0)
 
   rewind(configfilefd);
@@ -201,13 +302,11 @@ ERROR_T DiskSystem::ReadConfig()
 }
 
 
+// Only the parts of the bitmap changed since it was last read or
+// written go out
 ERROR_T DiskSystem::WriteBitMap()
 {
-  rewind(bitmapfilefd);
-  
-  SIZE_T numbitmapbytes = numblocks / 8 + (numblocks%8 != 0); 
-
-  if (mywrite(bitmapfilefd,0,bitmap,numbitmapbytes)!=numbitmapbytes) { 
+  if (bitmap.Write(bitmapfilefd)!=ERROR_NOERROR) { 
     cerr << "Can't write bitmap file\n";
     return ERROR_IMPLBUG;
   }
@@ -216,15 +315,9 @@ ERROR_T DiskSystem::WriteBitMap()
 
 ERROR_T DiskSystem::ReadBitMap()
 {
-  rewind(bitmapfilefd);
-  
-  SIZE_T numbitmapbytes = numblocks / 8 + (numblocks%8 != 0); 
-
-  if (bitmap) { delete [] bitmap; } ;
-
-  bitmap = new BYTE_T [numbitmapbytes];
+  bitmap.Resize(numblocks);
 
-  if (myread(bitmapfilefd,0,bitmap,numbitmapbytes,false)!=numbitmapbytes) { 
+  if (bitmap.Read(bitmapfilefd)!=ERROR_NOERROR) { 
     cerr << "Can't read bitmap file\n";
     return ERROR_IMPLBUG;
   }
@@ -257,16 +350,16 @@ ERROR_T DiskSystem::InitFromConfigFile()
     return rc;
   }
 
-  if (datafilefd) { fclose(datafilefd);}
+  if (datafilefd>=0) { close(datafilefd);}
 
-  if ((datafilefd = fopen(dataname.c_str(),"r+"))==0) { 
+  if ((datafilefd = open(dataname.c_str(),O_RDWR))<0) { 
     return ERROR_NOFILE;
   }
 
 
-  if (bitmapfilefd) { fclose(bitmapfilefd);}
+  if (bitmapfilefd>=0) { close(bitmapfilefd);}
 
-  if ((bitmapfilefd = fopen(bitmapname.c_str(),"r+"))==0) { 
+  if ((bitmapfilefd = open(bitmapname.c_str(),O_RDWR))<0) { 
     return ERROR_NOFILE;
   }
   
@@ -324,17 +417,13 @@ ERROR_T DiskSystem::InitFromInMemoryConfig()
 
   // allocate in-memory bitmap
 
-  SIZE_T numbitmapbytes = numblocks / 8 + (numblocks%8 != 0); 
-  
-  bitmap = new BYTE_T [numbitmapbytes];
-
-  memset(bitmap,0,numbitmapbytes);
+  bitmap.Resize(numblocks);
 
   // create the bitmap file and write out the bitmap
 
-  if (bitmapfilefd) { fclose(bitmapfilefd); }
+  if (bitmapfilefd>=0) { close(bitmapfilefd); }
 
-  if ((bitmapfilefd = fopen(bitmapname.c_str(),"w+"))==0) { 
+  if ((bitmapfilefd = open(bitmapname.c_str(),O_RDWR|O_CREAT|O_TRUNC,0666))<0) { 
     return ERROR_NOFILE;
   }
 
@@ -348,16 +437,16 @@ ERROR_T DiskSystem::InitFromInMemoryConfig()
   // notice that we will REUSE an existing data file if it exists
   // The idea is that we will write only from offset to offset+blocksize*numblocks
 
-  if (datafilefd) { fclose(datafilefd);}
+  if (datafilefd>=0) { close(datafilefd);}
 
   if (stat(dataname.c_str(),&s)!=-1) { 
     // reuse existing datafile
-    if ((datafilefd = fopen(dataname.c_str(),"r+"))==0) { 
+    if ((datafilefd = open(dataname.c_str(),O_RDWR))<0) { 
       return ERROR_NOFILE;
     }
   } else {
     // create new data file
-    if ((datafilefd = fopen(dataname.c_str(),"w+"))==0) { 
+    if ((datafilefd = open(dataname.c_str(),O_RDWR|O_CREAT|O_TRUNC,0666))<0) { 
       return ERROR_NOFILE;
     }
   }
@@ -367,13 +456,65 @@ ERROR_T DiskSystem::InitFromInMemoryConfig()
 
 
 
+
+ERROR_T DiskSystem::InitWithoutData(const string &filestem,
+				    const SIZE_T blcks,
+				    const SIZE_T blcksize,
+				    const bool   create)
+{
+  string bitmapname = filestem + ".bitmap";
+
+  diskfilestem=filestem;
+  numblocks=blcks;
+  blocksize=blcksize;
+
+  if (bitmapfilefd>=0) { close(bitmapfilefd); }
+
+  if (create) { 
+    bitmap.Resize(numblocks);
+
+    if ((bitmapfilefd = open(bitmapname.c_str(),O_RDWR|O_CREAT|O_TRUNC,0666))<0) { 
+      return ERROR_NOFILE;
+    }
+    return WriteBitMap();
+  } else {
+    if ((bitmapfilefd = open(bitmapname.c_str(),O_RDWR))<0) { 
+      return ERROR_NOFILE;
+    }
+    return ReadBitMap();
+  }
+}
+
+ERROR_T DiskSystem::InitWithData(const string &filestem,
+				 const SIZE_T blcks,
+				 const SIZE_T blcksize,
+				 const bool   create)
+{
+  string dataname = filestem + ".data";
+
+  ERROR_T rc=InitWithoutData(filestem,blcks,blcksize,create);
+
+  if (rc) { 
+    return rc;
+  }
+
+  if (datafilefd>=0) { close(datafilefd);}
+
+  // as with an ordinary disk, an existing data file is reused
+  if ((datafilefd = open(dataname.c_str(),create ? O_RDWR|O_CREAT : O_RDWR,0666))<0) { 
+    return ERROR_NOFILE;
+  }
+
+  return ERROR_NOERROR;
+}
+
     
 
 //
 // Note, this assumes disk is kept continously busy
 // or that time does not advance except during a disk op
 //
-double DiskSystem::ModelAccess(const SIZE_T offblock, const SIZE_T numblock) 
+double DiskSystem::ModelAccess(const SIZE_T offblock, const SIZE_T numblock, const bool write) 
 {
 
   SIZE_T req_trackstart = (offblock) / (numheads*blockspertrack);
@@ -409,14 +550,152 @@ double DiskSystem::ModelAccess(const SIZE_T offblock, const SIZE_T numblock)
   last_track=req_trackend;
   last_sector=req_sectorend;
 
+  numrequests++;
+  seektime+=timeinseek;
+  rotationtime+=timeinrotation;
+  transfertime+=timeintrackbytrackhops+timeinreadsectors;
+
   return timeinseek+timeinrotation+timeintrackbytrackhops+timeinreadsectors;
 }
 
 
-ERROR_T DiskSystem::Read(const SIZE_T   inoffblock,
-			 const SIZE_T   numblock,
-			 vector<Block> &blocks,
-			 double        &reqtime)
+double DiskSystem::ChargeRequest(const SIZE_T offblock, const SIZE_T numblock, const bool write)
+{
+  if (batching) { 
+    QueuedRequest q;
+    q.first=offblock;
+    q.num=numblock;
+    q.write=write;
+    queue.push_back(q);
+    return 0;
+  }
+  return ModelAccess(offblock,numblock,write);
+}
+
+SIZE_T DiskSystem::PickNextRequest()
+{
+  SIZE_T head=GetHeadPosition();
+  // a disk with no geometry (flash) is one block per track
+  SIZE_T pertrack=numheads*blockspertrack;
+  if (pertrack==0) { 
+    pertrack=1;
+  }
+  SIZE_T best=0;
+
+  switch (scheduler) { 
+  case DISKSCHED_SSTF: {
+    for (SIZE_T i=1;i<queue.size();i++) { 
+      SIZE_T ti=queue[i].first/pertrack, tb=queue[best].first/pertrack, th=head/pertrack;
+      SIZE_T di = ti>th ? ti-th : th-ti;
+      SIZE_T db = tb>th ? tb-th : th-tb;
+      // on the same track, the nearest block
+      SIZE_T bi = queue[i].first>head ? queue[i].first-head : head-queue[i].first;
+      SIZE_T bb = queue[best].first>head ? queue[best].first-head : head-queue[best].first;
+      if (di<db || (di==db && bi<bb)) { 
+	best=i;
+      }
+    }
+    break;
+  }
+  case DISKSCHED_SCAN:
+  case DISKSCHED_CLOOK: {
+    // the lowest request at or above the head
+    bool found=false;
+    for (SIZE_T i=0;i<queue.size();i++) { 
+      if (queue[i].first>=head && (!found || queue[i].first<queue[best].first)) { 
+	best=i;
+	found=true;
+      }
+    }
+    if (scheduler==DISKSCHED_CLOOK) { 
+      if (!found) { 
+	// back to the lowest
+	for (SIZE_T i=1;i<queue.size();i++) { 
+	  if (queue[i].first<queue[best].first) { 
+	    best=i;
+	  }
+	}
+      }
+      break;
+    }
+    if (scanup && found) { 
+      break;
+    }
+    // the highest request at or below the head, turning around if
+    // there is nothing left that way
+    found=false;
+    for (SIZE_T i=0;i<queue.size();i++) { 
+      if (queue[i].first<=head && (!found || queue[i].first>queue[best].first)) { 
+	best=i;
+	found=true;
+      }
+    }
+    if (found) { 
+      scanup=false;
+      break;
+    }
+    scanup=true;
+    return PickNextRequest();
+  }
+  case DISKSCHED_FIFO:
+  default:
+    break;
+  }
+  return best;
+}
+
+void DiskSystem::SetScheduler(const DiskSchedulerType type)
+{
+  scheduler=type;
+}
+
+DiskSchedulerType DiskSystem::GetScheduler() const
+{
+  return scheduler;
+}
+
+void DiskSystem::StartBatch()
+{
+  batching=true;
+}
+
+void DiskSystem::EndBatch(vector<double> &reqtimes)
+{
+  reqtimes.clear();
+  batching=false;
+
+  while (!queue.empty()) { 
+    SIZE_T next=PickNextRequest();
+    reqtimes.push_back(ModelAccess(queue[next].first,queue[next].num,queue[next].write));
+    queue.erase(queue.begin()+next);
+  }
+}
+
+SIZE_T DiskSystem::GetNumRequests() const
+{
+  return numrequests;
+}
+
+double DiskSystem::GetSeekTime() const
+{
+  return seektime;
+}
+
+double DiskSystem::GetRotationTime() const
+{
+  return rotationtime;
+}
+
+double DiskSystem::GetTransferTime() const
+{
+  return transfertime;
+}
+
+
+ERROR_T DiskSystem::ReadV(const SIZE_T   inoffblock,
+			  const SIZE_T   numblock,
+			  BYTE_T * const bufs[],
+			  double        &reqtime)
 {
   reqtime=0;
 
@@ -425,29 +704,41 @@ ERROR_T DiskSystem::Read(const SIZE_T   inoffblock,
     return ERROR_NOSPACE;
   }
 
-  reqtime=ModelAccess(inoffblock,numblock);
+  ERROR_T rc=WaitForOverlap(inoffblock,numblock);
+  if (rc!=ERROR_NOERROR) { 
+    return rc;
+  }
+
+  reqtime=ModelAccess(inoffblock,numblock,false);
+
+  // Read the whole run straight into the buffers with one call
+  vector<struct iovec> iov(datamap ? 0 : numblock);
 
   for (SIZE_T i=0;i<numblock;i++) { 
-    Block b(blocksize);
     if (!IsBlockAllocated(inoffblock+i)) { 
       if (PRINT_DISKSYSTEM_ALLOCATION_ERRORS) {
 	cerr <<"DiskSystem::Read: reading unallocated block "<<(i+inoffblock)<<endl;
       }
     }
-    if (myread(datafilefd,offset+(inoffblock+i)*blocksize,b.data,blocksize,true)!=blocksize) { 
-      cerr << "DiskSystem::Read: myread has failed"<<endl;
-      return ERROR_IMPLBUG;
+    if (datamap) { 
+      memcpy(bufs[i],datamap+BlockOffset(inoffblock+i),blocksize);
+    } else {
+      iov[i].iov_base=bufs[i];
+      iov[i].iov_len=blocksize;
     }
-    blocks.push_back(b);
+  }
+  if (!datamap && numblock>0 && myreadv(datafilefd,BlockOffset(inoffblock),&(iov[0]),numblock)!=(SIZE_T)numblock*blocksize) { 
+    cerr << "DiskSystem::Read: myreadv has failed"<<endl;
+    return ERROR_IMPLBUG;
   }
 
   return ERROR_NOERROR;
 }
 
-ERROR_T DiskSystem::Write(const SIZE_T   inoffblock,
-			  const SIZE_T   numblock,
-			  const vector<Block> &blocks,
-			  double        &reqtime)
+ERROR_T DiskSystem::WriteV(const SIZE_T   inoffblock,
+			   const SIZE_T   numblock,
+			   const BYTE_T * const bufs[],
+			   double        &reqtime)
 {
   reqtime=0;
 
@@ -456,7 +747,14 @@ ERROR_T DiskSystem::Write(const SIZE_T   inoffblock,
     return ERROR_NOSPACE;
   }
 
-  reqtime=ModelAccess(inoffblock,numblock);
+  ERROR_T rc=WaitForOverlap(inoffblock,numblock);
+  if (rc!=ERROR_NOERROR) { 
+    return rc;
+  }
+
+  reqtime=ModelAccess(inoffblock,numblock,true);
+
+  vector<struct iovec> iov(datamap ? 0 : numblock);
 
   for (SIZE_T i=0;i<numblock;i++) { 
     if (!IsBlockAllocated(inoffblock+i)) { 
@@ -464,67 +762,507 @@ ERROR_T DiskSystem::Write(const SIZE_T   inoffblock,
 	cerr <<"DiskSystem::Write: writing unallocated block "<<(i+inoffblock)<<endl;
       }
     }
-    if (mywrite(datafilefd,offset+(inoffblock+i)*blocksize,blocks[i].data,blocksize)!=blocksize) {  
-      cerr << "DiskSystem::Write: mywrite has failed"<<endl;
-      return ERROR_IMPLBUG;
+    if (datamap) { 
+      memcpy(datamap+BlockOffset(inoffblock+i),bufs[i],blocksize);
+    } else {
+      iov[i].iov_base=(void*)bufs[i];
+      iov[i].iov_len=blocksize;
     }
   }
+  if (datamap) { 
+    MarkMapDirty(inoffblock,numblock);
+  } else if (numblock>0 && mywritev(datafilefd,BlockOffset(inoffblock),&(iov[0]),numblock)!=(SIZE_T)numblock*blocksize) {  
+    cerr << "DiskSystem::Write: mywritev has failed"<<endl;
+    return ERROR_IMPLBUG;
+  }
+
+  if (syncwrites) { 
+    return Sync();
+  }
 
   return ERROR_NOERROR;
 }
 
 
-ERROR_T DiskSystem::Read(const SIZE_T inoffblock, Block &blocks, double &reqtime)
+ERROR_T DiskSystem::Read(const SIZE_T   inoffblock,
+			 const SIZE_T   numblock,
+			 vector<Block> &blocks,
+			 double        &reqtime)
 {
-  vector<Block> bl;
+  // Allocate the new blocks in place and read into them
+  SIZE_T first=blocks.size();
+  vector<BYTE_T *> bufs(numblock);
+
+  blocks.resize(first+numblock);
+  for (SIZE_T i=0;i<numblock;i++) { 
+    blocks[first+i].Resize(GetBlockSize(),false);
+    bufs[i]=blocks[first+i].data;
+  }
 
-  ERROR_T rc = Read(inoffblock,1,bl,reqtime);
+  ERROR_T rc=ReadV(inoffblock,numblock,numblock ? &(bufs[0]) : 0,reqtime);
 
   if (rc!=ERROR_NOERROR) { 
-    return rc;
+    blocks.resize(first);
+  }
+  return rc;
+}
+
+ERROR_T DiskSystem::Write(const SIZE_T   inoffblock,
+			  const SIZE_T   numblock,
+			  const vector<Block> &blocks,
+			  double        &reqtime)
+{
+  vector<const BYTE_T *> bufs(numblock);
+
+  for (SIZE_T i=0;i<numblock;i++) { 
+    bufs[i]=blocks[i].data;
+  }
+  return WriteV(inoffblock,numblock,numblock ? &(bufs[0]) : 0,reqtime);
+}
+
+
+ERROR_T DiskSystem::Read(const SIZE_T inoffblock, Block &block, double &reqtime)
+{
+  // Straight into the caller's block, reusing its buffer if it is
+  // already the right size
+  if (block.length!=GetBlockSize()) { 
+    ERROR_T rc=block.Resize(GetBlockSize(),false);
+    if (rc!=ERROR_NOERROR) { 
+      return rc;
+    }
   }
 
-  blocks = bl[0];
+  BYTE_T *buf=block.data;
+
+  return ReadV(inoffblock,1,&buf,reqtime);
+}
+
+ERROR_T DiskSystem::Write(const SIZE_T inoffblock, const Block &block, double &reqtime)
+{
+  const BYTE_T *buf=block.data;
+
+  return WriteV(inoffblock,1,&buf,reqtime);
+}
+
+
+SIZE_T DiskSystem::GetBlockSize() const
+{
+  return blocksize;
+}
+
+SIZE_T DiskSystem::GetNumBlocks() const
+{
+  return numblocks;
+}
+
+SIZE_T DiskSystem::GetHeadPosition() const
+{
+  return last_track*(numheads*blockspertrack)+last_sector;
+}
+
+off_t DiskSystem::BlockOffset(const SIZE_T block) const
+{
+  return (off_t)offset+(off_t)block*blocksize;
+}
 
+ERROR_T DiskSystem::Sync()
+{
+  ERROR_T rc=CompleteAll();
+  if (rc!=ERROR_NOERROR) { 
+    return rc;
+  }
+
+  if (datamap) { 
+    if (dirtylo<dirtyhi) { 
+      // msync wants a page aligned start
+      off_t start=BlockOffset(dirtylo) & ~((off_t)sysconf(_SC_PAGESIZE)-1);
+      if (msync(datamap+start,BlockOffset(dirtyhi)-start,MS_SYNC)) { 
+	cerr << "DiskSystem::Sync: msync has failed"<<endl;
+	return ERROR_IMPLBUG;
+      }
+      dirtylo=dirtyhi=0;
+    }
+    return ERROR_NOERROR;
+  }
+  if (fdatasync(datafilefd)) { 
+    cerr << "DiskSystem::Sync: fdatasync has failed"<<endl;
+    return ERROR_IMPLBUG;
+  }
   return ERROR_NOERROR;
 }
 
-ERROR_T DiskSystem::Write(const SIZE_T inoffblock, const Block &blocks, double &reqtime)
+ERROR_T DiskSystem::EnableMemoryMap()
 {
-  vector<Block> bl;
+  struct stat st;
+  void *m;
+
+  if (datamap) { 
+    return ERROR_NOERROR;
+  }
+
+  ERROR_T rc=CompleteAll();
+  if (rc!=ERROR_NOERROR) { 
+    return rc;
+  }
 
-  bl.push_back(blocks);
+  datamaplen=BlockOffset(numblocks);
 
-  ERROR_T rc = Write(inoffblock,1,bl,reqtime);
+  // Touching a page of the mapping beyond the end of the file is a
+  // bus error, so the file has to cover the whole disk
+  if (fstat(datafilefd,&st)) { 
+    return ERROR_NOFILE;
+  }
+  if (st.st_size<(off_t)datamaplen && ftruncate(datafilefd,datamaplen)) { 
+    cerr << "DiskSystem::EnableMemoryMap: can't extend data file"<<endl;
+    return ERROR_NOSPACE;
+  }
 
+  if ((m=mmap(0,datamaplen,PROT_READ|PROT_WRITE,MAP_SHARED,datafilefd,0))==MAP_FAILED) { 
+    cerr << "DiskSystem::EnableMemoryMap: mmap has failed"<<endl;
+    return ERROR_NOMEM;
+  }
+  datamap=(BYTE_T*)m;
+  dirtylo=dirtyhi=0;
+
+  return ERROR_NOERROR;
+}
+
+bool DiskSystem::IsMemoryMapped() const
+{
+  return datamap!=0;
+}
+
+
+ERROR_T DiskSystem::EnableAsyncIO(const AsyncIOType type)
+{
+  ERROR_T rc=CompleteAll();
   if (rc!=ERROR_NOERROR) { 
     return rc;
   }
 
+  delete aio;
+  if ((aio=CreateAsyncIO(type))==0 && type==ASYNCIO_URING) { 
+    aio=CreateAsyncIO(ASYNCIO_THREADS);
+  }
+  return aio ? ERROR_NOERROR : ERROR_UNIMPL;
+}
+
+bool DiskSystem::GetAsyncIOType(AsyncIOType &type) const
+{
+  if (!aio) { 
+    return false;
+  }
+  type=aio->GetType();
+  return true;
+}
+
+void DiskSystem::MarkMapDirty(const SIZE_T first, const SIZE_T num)
+{
+  if (dirtylo>=dirtyhi) { 
+    dirtylo=first;
+    dirtyhi=first+num;
+  } else {
+    dirtylo=first<dirtylo ? first : dirtylo;
+    dirtyhi=first+num>dirtyhi ? first+num : dirtyhi;
+  }
+}
+
+ERROR_T DiskSystem::StartRequest(const SIZE_T id, DiskRequest *r)
+{
+  SIZE_T len=r->num*blocksize;
+  ERROR_T rc;
+
+  requests[id]=r;
+
+  if (datamap) { 
+    if (r->write) { 
+      memcpy(datamap+BlockOffset(r->first),r->buf,len);
+      MarkMapDirty(r->first,r->num);
+    } else {
+      memcpy(r->buf,datamap+BlockOffset(r->first),len);
+    }
+    FinishRequest(id,len);
+    return ERROR_NOERROR;
+  }
+
+  if (!aio) { 
+    FinishRequest(id,0);
+    return ERROR_NOERROR;
+  }
+
+  if (aio->GetNumInFlight()>=ASYNCIO_DEPTH) { 
+    if ((rc=ReapRequests(1))!=ERROR_NOERROR) { 
+      return rc;
+    }
+  }
+  if ((rc=aio->Submit(r->write,datafilefd,BlockOffset(r->first),r->buf,len,id))!=ERROR_NOERROR) { 
+    // do it ourselves
+    FinishRequest(id,0);
+    return ERROR_NOERROR;
+  }
+  numinflight++;
   return ERROR_NOERROR;
 }
 
+void DiskSystem::FinishRequest(const SIZE_T id, const ssize_t res)
+{
+  map<SIZE_T, DiskRequest *>::iterator i=requests.find(id);
+  DiskRequest *r=(*i).second;
+  SIZE_T len=r->num*blocksize;
+
+  r->rc=ERROR_NOERROR;
+  if (res<0) { 
+    cerr << "DiskSystem: asynchronous "<<(r->write ? "write" : "read")<<" of blocks "<<r->first<<" to "<<(r->first+r->num-1)<<" has failed"<<endl;
+    r->rc=ERROR_IMPLBUG;
+  } else if ((SIZE_T)res<len) { 
+    // Short, or never started.  Finish it here.
+    SIZE_T left=len-res;
+    SIZE_T moved = r->write ? mywrite(datafilefd,BlockOffset(r->first)+res,r->buf+res,left)
+                            : myread(datafilefd,BlockOffset(r->first)+res,r->buf+res,left);
+    if (moved!=left) { 
+      cerr << "DiskSystem: "<<(r->write ? "write" : "read")<<" of blocks "<<r->first<<" to "<<(r->first+r->num-1)<<" has failed"<<endl;
+      r->rc=ERROR_IMPLBUG;
+    }
+  }
+  r->done=true;
+
+  if (r->detached) { 
+    if (r->rc!=ERROR_NOERROR && detachederror==ERROR_NOERROR) { 
+      detachederror=r->rc;
+    }
+    delete [] r->buf;
+    delete r;
+    requests.erase(i);
+  }
+}
 
-SIZE_T DiskSystem::GetBlockSize() const
+ERROR_T DiskSystem::ReapRequests(const SIZE_T min)
 {
-  return blocksize;
+  vector<pair<SIZE_T, ssize_t> > done;
+
+  ERROR_T rc=aio->Reap(done,min);
+
+  for (SIZE_T i=0; i<done.size(); i++) { 
+    numinflight--;
+    FinishRequest(done[i].first,done[i].second);
+  }
+  return rc;
 }
 
-SIZE_T DiskSystem::GetNumBlocks() const
+ERROR_T DiskSystem::WaitForOverlap(const SIZE_T first, const SIZE_T num)
 {
-  return numblocks;
+  while (numinflight>0) { 
+    map<SIZE_T, DiskRequest *>::const_iterator i;
+    for (i=requests.begin(); i!=requests.end(); ++i) { 
+      const DiskRequest *r=(*i).second;
+      if (!r->done && r->first<first+num && first<r->first+r->num) { 
+	break;
+      }
+    }
+    if (i==requests.end()) { 
+      return ERROR_NOERROR;
+    }
+    ERROR_T rc=ReapRequests(1);
+    if (rc!=ERROR_NOERROR) { 
+      return rc;
+    }
+  }
+  return ERROR_NOERROR;
 }
 
+ERROR_T DiskSystem::SubmitRead(const SIZE_T inoffblock,
+			       const SIZE_T numblock,
+			       double &reqtime,
+			       SIZE_T &request)
+{
+  reqtime=0;
+
+  if (inoffblock+numblock > numblocks) { 
+    cerr << "DiskSystem::SubmitRead: Attempt to read blocks "<<inoffblock<<" to "<<(inoffblock+numblock-1)<<", but maxmimum block is only "<<(numblocks-1)<<endl;
+    return ERROR_NOSPACE;
+  }
+
+  ERROR_T rc=WaitForOverlap(inoffblock,numblock);
+  if (rc!=ERROR_NOERROR) { 
+    return rc;
+  }
+
+  reqtime=ChargeRequest(inoffblock,numblock,false);
+
+  DiskRequest *r=new DiskRequest;
+  r->first=inoffblock;
+  r->num=numblock;
+  r->write=false;
+  r->done=false;
+  r->detached=false;
+  r->buf=new BYTE_T [numblock*blocksize];
+  r->rc=ERROR_NOERROR;
 
+  request=nextrequest++;
+  return StartRequest(request,r);
+}
+
+ERROR_T DiskSystem::SubmitWrite(const SIZE_T inoffblock,
+				const SIZE_T numblock,
+				const vector<Block> &blocks,
+				double &reqtime,
+				SIZE_T *request)
+{
+  reqtime=0;
+
+  if ((!aio || datamap) && !batching) { 
+    // Nothing to overlap with, so don't bother copying
+    ERROR_T rc=Write(inoffblock,numblock,blocks,reqtime);
+    if (request) { 
+      DiskRequest *r=new DiskRequest;
+      r->first=inoffblock;
+      r->num=numblock;
+      r->write=true;
+      r->done=true;
+      r->detached=false;
+      r->buf=0;
+      r->rc=rc;
+      *request=nextrequest++;
+      requests[*request]=r;
+      return ERROR_NOERROR;
+    }
+    return rc;
+  }
+
+  if (inoffblock+numblock > numblocks) { 
+    cerr << "DiskSystem::SubmitWrite: Attempt to write blocks "<<inoffblock<<" to "<<(inoffblock+numblock-1)<<", but maxmimum block is only "<<(numblocks-1)<<endl;
+    return ERROR_NOSPACE;
+  }
+
+  ERROR_T rc=WaitForOverlap(inoffblock,numblock);
+  if (rc!=ERROR_NOERROR) { 
+    return rc;
+  }
+
+  reqtime=ChargeRequest(inoffblock,numblock,true);
+
+  DiskRequest *r=new DiskRequest;
+  r->first=inoffblock;
+  r->num=numblock;
+  r->write=true;
+  r->done=false;
+  r->detached=(request==0);
+  r->buf=new BYTE_T [numblock*blocksize];
+  r->rc=ERROR_NOERROR;
+
+  for (SIZE_T i=0;i<numblock;i++) { 
+    if (!IsBlockAllocated(inoffblock+i)) { 
+      if (PRINT_DISKSYSTEM_ALLOCATION_ERRORS) {
+	cerr <<"DiskSystem::SubmitWrite: writing unallocated block "<<(i+inoffblock)<<endl;
+      }
+    }
+    memcpy(r->buf+i*blocksize,blocks[i].data,blocksize);
+  }
+
+  SIZE_T id=nextrequest++;
+  if (request) { 
+    *request=id;
+  }
+  return StartRequest(id,r);
+}
+
+bool DiskSystem::IsComplete(const SIZE_T request)
+{
+  if (numinflight>0) { 
+    ReapRequests(0);
+  }
+
+  map<SIZE_T, DiskRequest *>::const_iterator i=requests.find(request);
+
+  return i==requests.end() || (*i).second->done;
+}
+
+ERROR_T DiskSystem::Complete(const SIZE_T request, vector<Block> *blocks)
+{
+  map<SIZE_T, DiskRequest *>::iterator i=requests.find(request);
+
+  if (i==requests.end()) { 
+    return ERROR_NONEXISTENT;
+  }
+
+  DiskRequest *r=(*i).second;
+
+  while (!r->done) { 
+    ERROR_T rc=ReapRequests(1);
+    if (rc!=ERROR_NOERROR) { 
+      return rc;
+    }
+  }
+
+  ERROR_T rc=r->rc;
+
+  if (rc==ERROR_NOERROR && !r->write && blocks) { 
+    SIZE_T first=blocks->size();
+    blocks->resize(first+r->num);
+    for (SIZE_T j=0;j<r->num;j++) { 
+      (*blocks)[first+j].Resize(blocksize,false);
+      memcpy((*blocks)[first+j].data,r->buf+j*blocksize,blocksize);
+    }
+  }
+  delete [] r->buf;
+  delete r;
+  requests.erase(request);
+  return rc;
+}
+
+ERROR_T DiskSystem::CompleteAll()
+{
+  ERROR_T rc=ERROR_NOERROR;
+
+  while (numinflight>0 && rc==ERROR_NOERROR) { 
+    rc=ReapRequests(1);
+  }
+  if (rc==ERROR_NOERROR) { 
+    rc=detachederror;
+  }
+  detachederror=ERROR_NOERROR;
+  return rc;
+}
+
+void DiskSystem::SetSyncWrites(const bool sync)
+{
+  syncwrites=sync;
+}
+
+const string & DiskSystem::GetFileStem() const
+{
+  return diskfilestem;
+}
+
+ERROR_T DiskSystem::GetDataStamp(string &stamp)
+{
+  struct stat st;
+  char buf[128];
+
+  if (fstat(datafilefd,&st)) { 
+    return ERROR_NOFILE;
+  }
+  snprintf(buf,128,"%lld:%lld.%09ld",(long long)st.st_size,(long long)st.st_mtim.tv_sec,(long)st.st_mtim.tv_nsec);
+  stamp=buf;
+  return ERROR_NOERROR;
+}
 
-#define GETBIT(x) ((bitmap[(x)/8] >> (7-((x)%8))) & 0x1)
-#define SETBIT(x) do { bitmap[(x)/8] |= 0x1 << (7-((x)%8)); } while (0)
-#define CLEARBIT(x) do { bitmap[(x)/8] &= ~(0x1 << (7-((x)%8))); } while (0)
 
 
 bool DiskSystem::IsBlockAllocated(const SIZE_T block)
 {
-  return GETBIT(block);
+  return bitmap.IsSet(block);
+}
+
+SIZE_T DiskSystem::GetNumAllocatedBlocks() const
+{
+  return bitmap.Count(0,numblocks);
+}
+
+ERROR_T DiskSystem::FindUnallocatedBlock(SIZE_T &block, const SIZE_T from) const
+{
+  block=bitmap.FindClear(from);
+  return block<numblocks ? ERROR_NOERROR : ERROR_NOSPACE;
 }
 
 
@@ -536,14 +1274,14 @@ ERROR_T DiskSystem::NotifyAllocateBlocks(const SIZE_T offset, const SIZE_T innum
   }
 
 
-  for (SIZE_T i=offset; i<(offset+innumblocks); i++) { 
-    if (IsBlockAllocated(i)) {
-      if (PRINT_DISKSYSTEM_ALLOCATION_ERRORS) {
+  if (PRINT_DISKSYSTEM_ALLOCATION_ERRORS && bitmap.Count(offset,innumblocks)>0) { 
+    for (SIZE_T i=offset; i<(offset+innumblocks); i++) { 
+      if (IsBlockAllocated(i)) {
 	cerr << "Disksystem: NotifyAllocateBlocks: Block "<<i<<" is being allocated, but it's already allocated!"<<endl;
       }
     }
-    SETBIT(i);
   }
+  bitmap.Set(offset,innumblocks);
 
   return ERROR_NOERROR;
 }
@@ -556,14 +1294,14 @@ ERROR_T DiskSystem::NotifyDeallocateBlocks(const SIZE_T offset,const SIZE_T innu
   }
 
 
-  for (SIZE_T i=offset; i<(offset+innumblocks); i++) { 
-    if (!IsBlockAllocated(i)) {
-      if (PRINT_DISKSYSTEM_ALLOCATION_ERRORS) {
+  if (PRINT_DISKSYSTEM_ALLOCATION_ERRORS && bitmap.Count(offset,innumblocks)<innumblocks) { 
+    for (SIZE_T i=offset; i<(offset+innumblocks); i++) { 
+      if (!IsBlockAllocated(i)) {
 	cerr << "Disksystem: NotifyDeallocateBlocks: Block "<<i<<" is being deallocated, but it's already deallocated!"<<endl;
       }
     }
-    CLEARBIT(i);
   }
+  bitmap.Clear(offset,innumblocks);
 
   return ERROR_NOERROR;
 }
@@ -584,19 +1322,68 @@ ostream & DiskSystem::Print(ostream &os) const
      << ", trackseeklatency="<<trackseeklatency
      << ", rotationallatency="<<rotationallatency
      << ", bitmap=";
-
-  for (SIZE_T i=0;i<numblocks;i++) { 
-    if (GETBIT(i)) { 
-      os <<"*";
-    } else {
-      os <<".";
-    }
-  }
-
+  PrintBitMap(os);
   os <<")";
   return os;
 }
 
+ostream & DiskSystem::PrintBitMap(ostream &os) const
+{
+  return bitmap.Print(os);
+}
+
+
+DiskSystem *OpenDiskSystem(const string &filestem)
+{
+  if (StripedVolume::IsStripedVolume(filestem)) { 
+    return new StripedVolume(filestem);
+  }
+  if (FlashDiskSystem::IsFlashDisk(filestem)) { 
+    return new FlashDiskSystem(filestem);
+  }
+  if (CompressedVolume::IsCompressedVolume(filestem)) { 
+    return new CompressedVolume(filestem);
+  }
+  return new DiskSystem(filestem);
+}
+
   
 
 
+ERROR_T ParseDiskScheduler(const string &name, DiskSchedulerType &type)
+{
+  string n=name;
+
+  for (SIZE_T i=0;i<n.size();i++) {
+    n[i]=toupper(n[i]);
+  }
+
+  if (n=="FIFO") {
+    type=DISKSCHED_FIFO;
+  } else if (n=="SSTF") {
+    type=DISKSCHED_SSTF;
+  } else if (n=="SCAN") {
+    type=DISKSCHED_SCAN;
+  } else if (n=="CLOOK" || n=="C-LOOK") {
+    type=DISKSCHED_CLOOK;
+  } else {
+    return ERROR_BADCONFIG;
+  }
+  return ERROR_NOERROR;
+}
+
+const char *GetDiskSchedulerName(const DiskSchedulerType type)
+{
+  switch (type) {
+  case DISKSCHED_FIFO:
+    return "FIFO";
+  case DISKSCHED_SSTF:
+    return "SSTF";
+  case DISKSCHED_SCAN:
+    return "SCAN";
+  case DISKSCHED_CLOOK:
+    return "CLOOK";
+  default:
+    return "UNKNOWN";
+  }
+}
@@ -4,23 +4,80 @@
 #include <string>
 #include <iostream>
 #include <vector>
+#include <map>
+#include <memory>
+
+#include <sys/types.h>
+#include <stdio.h>
 
 #include "global.h"
 #include "block.h"
+#include "asyncio.h"
+#include "bitmap.h"
 
 using namespace std;
 
+//
+// Disk schedulers, for the order in which a batch of queued requests
+// is serviced
+//
+// FIFO   the order they were made
+// SSTF   shortest seek first - the nearest track to the head next
+// SCAN   the elevator - sweep one way, then back the other way
+// CLOOK  sweep up from the head, then jump back to the lowest
+//        request and sweep up again
+//
+enum DiskSchedulerType {DISKSCHED_FIFO, DISKSCHED_SSTF, DISKSCHED_SCAN, DISKSCHED_CLOOK};
+
+// returns ERROR_BADCONFIG if there is no such scheduler
+ERROR_T ParseDiskScheduler(const string &name, DiskSchedulerType &type);
+const char *GetDiskSchedulerName(const DiskSchedulerType type);
+
+
 // Models a single disk with a single outstanding request
 //
+// The model charges requests one at a time in the order they are
+// made, but with asynchronous I/O enabled the real transfers to and
+// from the data file can overlap.
+//
 // Includes storage allocator and free space bitmap to 
 // simplify project - REAL DISKS DO NOT HAVE ALLOCATORS OR BITMAPS
 //
 class DiskSystem {
  private:
-  BYTE_T *bitmap;
-  FILE*  datafilefd;
+  AllocationBitmap bitmap;
+  // The data and bitmap files are accessed with positioned I/O
+  // (pread/pwrite and friends) on plain descriptors, so there is no
+  // stdio buffer in the way and no shared file position.
+  int    datafilefd;
   FILE*  configfilefd;
-  FILE*  bitmapfilefd;
+  int    bitmapfilefd;
+  bool   syncwrites;
+  // When the data file is memory mapped, Read and Write are copies
+  // to and from the mapping, and dirtylo..dirtyhi-1 are the blocks
+  // written since the last Sync
+  BYTE_T *datamap;
+  size_t datamaplen;
+  SIZE_T dirtylo;
+  SIZE_T dirtyhi;
+
+  // An asynchronous request.  Its data lives in buf while it is in
+  // flight, one block after another.
+  struct DiskRequest {
+    SIZE_T  first;
+    SIZE_T  num;
+    bool    write;
+    bool    done;
+    bool    detached;   // no one will Complete it
+    BYTE_T *buf;
+    ERROR_T rc;
+  };
+
+  AsyncIO *aio;
+  map<SIZE_T, DiskRequest *> requests;  // not yet Completed, by id
+  SIZE_T   nextrequest;
+  SIZE_T   numinflight;
+  ERROR_T  detachederror;   // first failure of a detached request
 
 
   //
@@ -41,8 +98,30 @@ class DiskSystem {
   double trackseeklatency;
   double rotationallatency;
 
+  // Where the modelled time went
+  SIZE_T numrequests;
+  double seektime;
+  double rotationtime;
+  double transfertime;
+
+  // Requests made during a batch wait here to be scheduled
+  struct QueuedRequest {
+    SIZE_T first;
+    SIZE_T num;
+    bool   write;
+  };
+
+  DiskSchedulerType     scheduler;
+  bool                  batching;
+  bool                  scanup;     // SCAN's direction
+  vector<QueuedRequest> queue;
+
  protected:
-  virtual double ModelAccess(const SIZE_T off, const SIZE_T num);
+  virtual double ModelAccess(const SIZE_T off, const SIZE_T num, const bool write);
+  // Charge a request now, or queue it if we are batching
+  double  ChargeRequest(const SIZE_T off, const SIZE_T num, const bool write);
+  // The queued request the scheduler would service next
+  SIZE_T  PickNextRequest();
 
   ERROR_T SanityCheckConfig();
   ERROR_T InitFromConfigFile();
@@ -51,6 +130,38 @@ class DiskSystem {
   ERROR_T WriteConfig();
   ERROR_T ReadBitMap();
   ERROR_T WriteBitMap();
+  ostream & PrintBitMap(ostream &os) const;
+  // byte offset of a block in the data file
+  off_t   BlockOffset(const SIZE_T block) const;
+  // Add blocks copied into the mapping to the range the next Sync
+  // msyncs
+  void    MarkMapDirty(const SIZE_T first, const SIZE_T num);
+
+  // Start a request's transfer, or do it right away if there is no
+  // asynchronous I/O
+  ERROR_T StartRequest(const SIZE_T id, DiskRequest *r);
+  // A transfer came back from aio with result res
+  void    FinishRequest(const SIZE_T id, const ssize_t res);
+  // Collect finished transfers, waiting for at least min of them
+  ERROR_T ReapRequests(const SIZE_T min);
+  // Wait out any request in flight that touches these blocks, so
+  // that requests to the same block happen in the order made
+  ERROR_T WaitForOverlap(const SIZE_T first, const SIZE_T num);
+
+  // For subclasses that keep their blocks somewhere other than a
+  // data file of their own.  Nothing is opened until InitWithoutData,
+  // which opens (or creates) just filestem.bitmap.
+  DiskSystem();
+  ERROR_T InitWithoutData(const string &filestem,
+			  const SIZE_T blocks,
+			  const SIZE_T blocksize,
+			  const bool create);
+  // For subclasses with a config file of their own, but the usual
+  // filestem.data and filestem.bitmap
+  ERROR_T InitWithData(const string &filestem,
+		       const SIZE_T blocks,
+		       const SIZE_T blocksize,
+		       const bool create);
   
    
  public:
@@ -68,34 +179,124 @@ class DiskSystem {
 	     const double avgseek=0,
 	     const double trackseek=0,
 	     const double rotlat=0);
-  DiskSystem() { throw GenericException(); } 
   DiskSystem(const DiskSystem &rhs) { throw GenericException();}
   DiskSystem & operator=(const DiskSystem &rhs) { throw GenericException(); return *this;}
 
   virtual ~DiskSystem();
 
   // Each returns the number of milliseconds the operation has taken
+  //
+  // The data path is virtual so that other kinds of disk (see
+  // stripedvolume.h) can stand in for this one under a BufferCache
 
-  ERROR_T Read(const SIZE_T inoffblock,
-	       const SIZE_T numblock,
-	       vector<Block> &blocks,
-	       double &reqtime);
+  virtual ERROR_T Read(const SIZE_T inoffblock,
+		       const SIZE_T numblock,
+		       vector<Block> &blocks,
+		       double &reqtime);
 
   ERROR_T Read(const SIZE_T inoffblock, 
 	       Block &blocks,
 	       double &reqtime);
 
-  ERROR_T Write(const SIZE_T inoffblock,
-		const SIZE_T numblock,
-		const vector<Block> &blocks,
-		double &reqtime);
+  virtual ERROR_T Write(const SIZE_T inoffblock,
+			const SIZE_T numblock,
+			const vector<Block> &blocks,
+			double &reqtime);
 
   ERROR_T Write(const SIZE_T inoffblock, 
 		const Block &blocks,
 		double &reqtime);
 
+  // Scatter/gather forms of the above.  The run is read straight
+  // into (or written straight from) the caller's buffers, one block
+  // each, with a single preadv (pwritev).  The others all come here.
+  virtual ERROR_T ReadV(const SIZE_T inoffblock,
+			const SIZE_T numblock,
+			BYTE_T * const bufs[],
+			double &reqtime);
+  virtual ERROR_T WriteV(const SIZE_T inoffblock,
+			 const SIZE_T numblock,
+			 const BYTE_T * const bufs[],
+			 double &reqtime);
+
+  // Writes reach the operating system's page cache, not necessarily
+  // the disk.  Sync forces everything written so far out with
+  // fdatasync.  With SetSyncWrites(true), every Write is synced before
+  // it returns, which is much slower in real time.  Neither changes
+  // the modelled time.
+  virtual ERROR_T Sync();
+  virtual void    SetSyncWrites(const bool sync);
+
+  // Maps the whole data file into memory (extending it to the full
+  // disk if need be) and serves Read and Write from the mapping
+  // instead of with system calls.  Worthwhile when the file is
+  // already in the page cache.  Sync then msyncs the blocks written
+  // since the last Sync.  The modelled time is charged as before.
+  virtual ERROR_T EnableMemoryMap();
+  virtual bool    IsMemoryMapped() const;
+
+  // Asynchronous requests.  Submitting a request charges the
+  // modelled time just as Read and Write do, in the order submitted,
+  // and starts the real transfer; Complete waits for it to finish and
+  // hands over the blocks of a read.  A write takes a copy of the
+  // blocks, so they can be changed as soon as SubmitWrite returns.  A
+  // write submitted without a place for its id is never Completed;
+  // CompleteAll reports if it failed.  Requests to the same blocks
+  // happen in the order they were made, whichever way they were made.
+  //
+  // Until EnableAsyncIO is called (and in memory mapped mode), each
+  // request is carried out as it is submitted.
+  virtual ERROR_T EnableAsyncIO(const AsyncIOType type=ASYNCIO_URING);
+  // io_uring falls back to threads if it isn't available
+  virtual bool    GetAsyncIOType(AsyncIOType &type) const;
+
+  virtual ERROR_T SubmitRead(const SIZE_T inoffblock,
+			     const SIZE_T numblock,
+			     double &reqtime,
+			     SIZE_T &request);
+  virtual ERROR_T SubmitWrite(const SIZE_T inoffblock,
+			      const SIZE_T numblock,
+			      const vector<Block> &blocks,
+			      double &reqtime,
+			      SIZE_T *request=0);
+  // Request scheduling.  Requests submitted between StartBatch and
+  // EndBatch are only queued (their reqtime is 0).  EndBatch then
+  // services the queue in the order the scheduler chooses, and gives
+  // the modelled time of each request in the order it was serviced.
+  // Outside a batch, and for the blocking Read and Write, requests are
+  // serviced as they come.  The real transfers are not reordered.
+  // The default scheduler is CLOOK.
+  virtual void    SetScheduler(const DiskSchedulerType type);
+  DiskSchedulerType GetScheduler() const;
+  virtual void    StartBatch();
+  virtual void    EndBatch(vector<double> &reqtimes);
+
+  // Modelled time spent seeking to the first track of each request,
+  // waiting for its first block to come around, and transferring
+  // (including track to track seeks along the way)
+  virtual SIZE_T  GetNumRequests() const;
+  virtual double  GetSeekTime() const;
+  virtual double  GetRotationTime() const;
+  virtual double  GetTransferTime() const;
+
+  // Whether a request has finished, without waiting for it
+  virtual bool    IsComplete(const SIZE_T request);
+  // Wait for a request and forget it.  A read's blocks are appended
+  // to blocks, if given.
+  virtual ERROR_T Complete(const SIZE_T request, vector<Block> *blocks=0);
+  // Wait for every request in flight.  Returns the first failure of
+  // a write submitted without an id since the last call.
+  virtual ERROR_T CompleteAll();
+
   SIZE_T GetBlockSize() const;
   SIZE_T GetNumBlocks() const;
+  // The block the head was left at by the last request
+  SIZE_T GetHeadPosition() const;
+  const string & GetFileStem() const;
+  // Changes whenever the data file does (its size and modification
+  // time), so that copies of its contents kept elsewhere can tell
+  // whether they are stale
+  virtual ERROR_T GetDataStamp(string &stamp);
 
   //
   // These are notification functions that should be called when
@@ -108,11 +309,19 @@ class DiskSystem {
 				 const SIZE_T innumblocks);
 
   bool    IsBlockAllocated(const SIZE_T offset);
+  SIZE_T  GetNumAllocatedBlocks() const;
+  // The first unallocated block at or after from, or ERROR_NOSPACE
+  ERROR_T FindUnallocatedBlock(SIZE_T &block, const SIZE_T from=0) const;
 
 
-  ostream & Print(ostream &os) const;
+  virtual ostream & Print(ostream &os) const;
 };
 
 inline ostream & operator<< (ostream &os, const DiskSystem &rhs) { return rhs.Print(os);}
 
+// Opens whatever kind of disk filestem.config describes: a single
+// DiskSystem, a FlashDiskSystem, a StripedVolume of several, or a
+// CompressedVolume on another
+DiskSystem *OpenDiskSystem(const string &filestem);
+
 #endif
@@ -0,0 +1,284 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <string.h>
+#include <stdio.h>
+
+#include "flashdisk.h"
+
+
+#define FLASHDISK_MAGIC "# flash disk config file"
+
+
+FlashDiskSystem::FlashDiskSystem(const string &filestem,
+				 const bool   create,
+				 const SIZE_T blocks,
+				 const SIZE_T blocksize,
+				 const SIZE_T ppb,
+				 const SIZE_T channels,
+				 const double readlat,
+				 const double programlat,
+				 const double eraselat) :
+  DiskSystem(),
+  pagesperblock(ppb),
+  numchannels(channels),
+  pagereadlatency(readlat),
+  pageprogramlatency(programlat),
+  blockeraselatency(eraselat),
+  numrequests(0),
+  hostpages(0),
+  copiedpages(0),
+  numerases(0),
+  readtime(0),
+  programtime(0),
+  mergetime(0)
+{
+  SIZE_T numblocks=blocks, pagesize=blocksize;
+
+  if (create) {
+    struct stat s;
+
+    if (stat((filestem+".config").c_str(),&s)!=-1 ||
+	stat((filestem+".bitmap").c_str(),&s)!=-1) {
+      cerr << "Configuration or bitmap files exist for this name!\n";
+      return;
+    }
+  } else if (ReadConfig(filestem,numblocks,pagesize)!=ERROR_NOERROR) {
+    cerr << "Can't read the flash disk configuration.\n";
+    return;
+  }
+
+  if (SanityCheckConfig(numblocks)!=ERROR_NOERROR) {
+    return;
+  }
+
+  if (InitWithData(filestem,numblocks,pagesize,create)!=ERROR_NOERROR) {
+    return;
+  }
+
+  if (create && WriteConfig(filestem)!=ERROR_NOERROR) {
+    return;
+  }
+
+  lognext.assign(numblocks/pagesperblock,0);
+}
+
+FlashDiskSystem::~FlashDiskSystem()
+{
+}
+
+bool FlashDiskSystem::IsFlashDisk(const string &filestem)
+{
+  FILE *f;
+  char buf[80];
+  bool isflash;
+
+  if ((f=fopen((filestem+".config").c_str(),"r"))==0) {
+    return false;
+  }
+  isflash = fgets(buf,80,f) && !strncmp(buf,FLASHDISK_MAGIC,strlen(FLASHDISK_MAGIC));
+  fclose(f);
+  return isflash;
+}
+
+
+ERROR_T FlashDiskSystem::SanityCheckConfig(const SIZE_T blocks)
+{
+  if (pagereadlatency<=0 || pageprogramlatency<=0 || blockeraselatency<=0) {
+    cerr << "Impossible performance.\n";
+    return ERROR_BADCONFIG;
+  }
+  if (numchannels<1 || pagesperblock<1 || blocks<1 || blocks%pagesperblock) {
+    cerr << "Geometry mismatch.\n";
+    return ERROR_BADCONFIG;
+  }
+  return ERROR_NOERROR;
+}
+
+ERROR_T FlashDiskSystem::WriteConfig(const string &filestem)
+{
+  FILE *f;
+
+  if ((f=fopen((filestem+".config").c_str(),"w"))==0) {
+    return ERROR_NOFILE;
+  }
+  fprintf(f,"%s version 1.0\n",FLASHDISK_MAGIC);
+  fprintf(f,"# filestem\n");
+  fprintf(f,"%s\n",filestem.c_str());
+  fprintf(f,"# numblocks\n");
+  fprintf(f,"%llu\n",GetNumBlocks());
+  fprintf(f,"# blocksize\n");
+  fprintf(f,"%llu\n",GetBlockSize());
+  fprintf(f,"# pagesperblock\n");
+  fprintf(f,"%llu\n",pagesperblock);
+  fprintf(f,"# numchannels\n");
+  fprintf(f,"%llu\n",numchannels);
+  fprintf(f,"# pagereadlatency\n");
+  fprintf(f,"%lf\n",pagereadlatency);
+  fprintf(f,"# pageprogramlatency\n");
+  fprintf(f,"%lf\n",pageprogramlatency);
+  fprintf(f,"# blockeraselatency\n");
+  fprintf(f,"%lf\n",blockeraselatency);
+  fclose(f);
+
+  return ERROR_NOERROR;
+}
+
+ERROR_T FlashDiskSystem::ReadConfig(const string &filestem,
+				    SIZE_T &blocks,
+				    SIZE_T &pagesize)
+{
+  FILE *f;
+  char buf[1024];
+
+#define GETNEXTLINE do { if (!fgets(buf,1024,f)) { fclose(f); return ERROR_BADCONFIG; } } while (buf[0]=='#')
+
+  if ((f=fopen((filestem+".config").c_str(),"r"))==0) {
+    return ERROR_NOFILE;
+  }
+  // filestem, which is just for show
+  GETNEXTLINE;
+  GETNEXTLINE;
+  sscanf(buf,"%llu",&blocks);
+  GETNEXTLINE;
+  sscanf(buf,"%llu",&pagesize);
+  GETNEXTLINE;
+  sscanf(buf,"%llu",&pagesperblock);
+  GETNEXTLINE;
+  sscanf(buf,"%llu",&numchannels);
+  GETNEXTLINE;
+  sscanf(buf,"%lf",&pagereadlatency);
+  GETNEXTLINE;
+  sscanf(buf,"%lf",&pageprogramlatency);
+  GETNEXTLINE;
+  sscanf(buf,"%lf",&blockeraselatency);
+  fclose(f);
+
+  return ERROR_NOERROR;
+}
+
+
+double FlashDiskSystem::ModelAccess(const SIZE_T offblock, const SIZE_T numblock, const bool write)
+{
+  // the channels take a page each at a time
+  double rounds=(numblock+numchannels-1)/numchannels;
+  double t;
+
+  numrequests++;
+
+  if (!write) {
+    t=rounds*pagereadlatency;
+    readtime+=t;
+    return t;
+  }
+
+  t=rounds*pageprogramlatency;
+  programtime+=t;
+  hostpages+=numblock;
+
+  // each erase block the run touches
+  for (SIZE_T b=offblock; b<offblock+numblock; ) {
+    SIZE_T eraseblock=b/pagesperblock;
+    SIZE_T end=(eraseblock+1)*pagesperblock;
+
+    if (end>offblock+numblock) {
+      end=offblock+numblock;
+    }
+    t+=ModelEraseBlockWrite(eraseblock,b%pagesperblock,end-b);
+    b=end;
+  }
+
+  return t;
+}
+
+double FlashDiskSystem::ModelEraseBlockWrite(const SIZE_T eraseblock,
+					     const SIZE_T first,
+					     const SIZE_T num)
+{
+  SIZE_T copies=0;
+  SIZE_T erases=0;
+
+  if (first!=lognext[eraseblock]) {
+    if (lognext[eraseblock]>0) {
+      // merge: fill out the log from the old block, and erase that
+      copies+=pagesperblock-lognext[eraseblock];
+      erases++;
+    }
+    // a new log, with the pages before this write copied in
+    copies+=first;
+    lognext[eraseblock]=first;
+  }
+
+  lognext[eraseblock]+=num;
+
+  if (lognext[eraseblock]==pagesperblock) {
+    // switch: the full log becomes the erase block, and the old one
+    // is erased
+    erases++;
+    lognext[eraseblock]=0;
+  }
+
+  double t=((copies+numchannels-1)/numchannels)*(pagereadlatency+pageprogramlatency)
+    +erases*blockeraselatency;
+
+  copiedpages+=copies;
+  numerases+=erases;
+  mergetime+=t;
+
+  return t;
+}
+
+
+SIZE_T FlashDiskSystem::GetNumRequests() const
+{
+  return numrequests;
+}
+
+double FlashDiskSystem::GetSeekTime() const
+{
+  return 0;
+}
+
+double FlashDiskSystem::GetRotationTime() const
+{
+  return 0;
+}
+
+double FlashDiskSystem::GetTransferTime() const
+{
+  return readtime+programtime+mergetime;
+}
+
+double FlashDiskSystem::GetMergeTime() const
+{
+  return mergetime;
+}
+
+double FlashDiskSystem::GetWriteAmplification() const
+{
+  return hostpages ? (double)(hostpages+copiedpages)/(double)hostpages : 1.0;
+}
+
+SIZE_T FlashDiskSystem::GetNumErases() const
+{
+  return numerases;
+}
+
+
+ostream & FlashDiskSystem::Print(ostream &os) const
+{
+  os << "FlashDiskSystem(diskfilestem="<<GetFileStem()
+     << ", numblocks="<<GetNumBlocks()
+     << ", blocksize="<<GetBlockSize()
+     << ", pagesperblock="<<pagesperblock
+     << ", numchannels="<<numchannels
+     << ", pagereadlatency="<<pagereadlatency
+     << ", pageprogramlatency="<<pageprogramlatency
+     << ", blockeraselatency="<<blockeraselatency
+     << ", writeamplification="<<GetWriteAmplification()
+     << ", numerases="<<numerases
+     << ", bitmap=";
+  PrintBitMap(os);
+  os << ")";
+  return os;
+}
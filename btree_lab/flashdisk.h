@@ -0,0 +1,107 @@
+#ifndef _flashdisk
+#define _flashdisk
+
+#include <string>
+#include <iostream>
+#include <vector>
+
+#include "global.h"
+#include "block.h"
+#include "disksystem.h"
+
+using namespace std;
+
+//
+// A flash (SSD) disk
+//
+// Each block is a flash page.  Reading a page takes pagereadlatency
+// and programming one takes pageprogramlatency.  Consecutive pages
+// are spread over the channels, which all work at once, so a run of
+// n pages takes n/channels page times.  There is no seek, and no
+// head to schedule for.
+//
+// Pages can only be programmed once between erases, and erasing is
+// done pagesperblock pages (an erase block) at a time.  The model is
+// a log-block FTL: writes to an erase block go to a log block, and
+// as long as they come in order the log simply becomes the new erase
+// block when it fills, and the old one is erased.  A write out of
+// order forces a merge - the pages the log is missing are copied
+// (read and programmed) into it, the old block is erased, and a new
+// log is started, copying in the pages ahead of the write.  So
+// sequential writes cost about one program per page, and random
+// ones up to a whole erase block of copying.  The log blocks are
+// only kept in memory, so each run starts with none.
+//
+// The data and bitmap files are the usual filestem.data and
+// filestem.bitmap.
+//
+class FlashDiskSystem : public DiskSystem {
+ private:
+  SIZE_T pagesperblock;
+  SIZE_T numchannels;
+  double pagereadlatency;
+  double pageprogramlatency;
+  double blockeraselatency;
+
+  // For each erase block, the next page its log block expects, or 0
+  // if it has no log block
+  vector<SIZE_T> lognext;
+
+  SIZE_T numrequests;
+  SIZE_T hostpages;       // written by requests
+  SIZE_T copiedpages;     // written by merges
+  SIZE_T numerases;
+  double readtime;
+  double programtime;
+  double mergetime;
+
+  ERROR_T ReadConfig(const string &filestem, SIZE_T &blocks, SIZE_T &blocksize);
+  ERROR_T WriteConfig(const string &filestem);
+  ERROR_T SanityCheckConfig(const SIZE_T blocks);
+
+  // Time for the FTL to take num pages written at page first of
+  // erase block eraseblock, which they must not run past
+  double  ModelEraseBlockWrite(const SIZE_T eraseblock,
+			       const SIZE_T first,
+			       const SIZE_T num);
+
+ protected:
+  double  ModelAccess(const SIZE_T off, const SIZE_T num, const bool write);
+
+ public:
+  // The config is stored in file "filestem.config".  Latencies are in
+  // milliseconds.  Only when creating are the parameters used.
+  FlashDiskSystem(const string &filestem,
+		  const bool create=false,
+		  const SIZE_T blocks=0,
+		  const SIZE_T blocksize=0,
+		  const SIZE_T pagesperblock=0,
+		  const SIZE_T channels=0,
+		  const double pagereadlatency=0,
+		  const double pageprogramlatency=0,
+		  const double blockeraselatency=0);
+  FlashDiskSystem(const FlashDiskSystem &rhs) { throw GenericException();}
+  FlashDiskSystem & operator=(const FlashDiskSystem &rhs) { throw GenericException(); return *this;}
+
+  virtual ~FlashDiskSystem();
+
+  // Whether filestem.config describes a flash disk
+  static bool IsFlashDisk(const string &filestem);
+
+  // There is no seek or rotation, so all of the time is transfer,
+  // including that spent merging
+  SIZE_T  GetNumRequests() const;
+  double  GetSeekTime() const;
+  double  GetRotationTime() const;
+  double  GetTransferTime() const;
+
+  // Time spent merging, pages programmed per page written, and
+  // erases done, since the disk was opened
+  double  GetMergeTime() const;
+  double  GetWriteAmplification() const;
+  SIZE_T  GetNumErases() const;
+
+  ostream & Print(ostream &os) const;
+};
+
+#endif
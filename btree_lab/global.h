@@ -3,7 +3,9 @@
 
 
 typedef unsigned char BYTE_T;
-typedef unsigned int SIZE_T;
+// Block numbers, sizes, and counts.  64 bits, so that disks and the
+// byte offsets within them can go past 4 GB.  Print with %llu.
+typedef unsigned long long SIZE_T;
 typedef int ERROR_T;
 
 
@@ -18,7 +18,8 @@ int main(int argc, char *argv[])
   }
 #endif
 
-  DiskSystem disk(argv[1]);
+  unique_ptr<DiskSystem> diskp(OpenDiskSystem(argv[1]));
+  DiskSystem &disk=*diskp;
   
   cerr << "Disk is as follows.\n" << disk << "\n";
 
@@ -0,0 +1,158 @@
+#include <string.h>
+
+#include "keysearch.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KEYSEARCH_X86
+#endif
+
+
+// The widest vector compare, and so the most a search key is padded to
+#define KEYSEARCH_MAXWIDTH 32
+
+//
+// The binary search, given how to compare a key of up to width bytes
+// and how wide a load that compare does.  The search key is copied
+// to a padded buffer once, so that it can be loaded whole too.
+//
+#define KEYSEARCH_BODY(COMPARE, WIDTH)					\
+  BYTE_T padded[KEYSEARCH_MAXWIDTH];					\
+  SIZE_T lo=0, hi=num;							\
+									\
+  memset(padded,0,KEYSEARCH_MAXWIDTH);					\
+  memcpy(padded,key,keysize);						\
+									\
+  while (lo<hi) {							\
+    SIZE_T mid=lo+(hi-lo)/2;						\
+    const BYTE_T *p=keys+mid*stride;					\
+    int c = p+(WIDTH)<=end ? COMPARE(p,padded,keysize) : memcmp(p,key,keysize); \
+    if (c<=0) {								\
+      lo=mid+1;								\
+    } else {								\
+      hi=mid;								\
+    }									\
+  }									\
+  return lo;
+
+
+static SIZE_T SearchScalar(const BYTE_T *keys, const SIZE_T stride, const SIZE_T num,
+			   const SIZE_T keysize, const BYTE_T *end, const BYTE_T *key)
+{
+  SIZE_T lo=0, hi=num;
+
+  while (lo<hi) {
+    SIZE_T mid=lo+(hi-lo)/2;
+    if (memcmp(keys+mid*stride,key,keysize)<=0) {
+      lo=mid+1;
+    } else {
+      hi=mid;
+    }
+  }
+  return lo;
+}
+
+
+#ifdef KEYSEARCH_X86
+
+// Like memcmp on len<=16 bytes: the first byte that differs decides
+__attribute__((target("sse2")))
+static inline int Compare16(const BYTE_T *a, const BYTE_T *b, const SIZE_T len)
+{
+  __m128i x=_mm_loadu_si128((const __m128i *)a);
+  __m128i y=_mm_loadu_si128((const __m128i *)b);
+  unsigned differ=~(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(x,y)) & (0xffffU>>(16-len));
+
+  if (!differ) {
+    return 0;
+  }
+  unsigned i=__builtin_ctz(differ);
+  return (int)a[i]-(int)b[i];
+}
+
+// The same on len<=32 bytes
+__attribute__((target("avx2")))
+static inline int Compare32(const BYTE_T *a, const BYTE_T *b, const SIZE_T len)
+{
+  __m256i x=_mm256_loadu_si256((const __m256i *)a);
+  __m256i y=_mm256_loadu_si256((const __m256i *)b);
+  unsigned differ=~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x,y)) & (0xffffffffU>>(32-len));
+
+  if (!differ) {
+    return 0;
+  }
+  unsigned i=__builtin_ctz(differ);
+  return (int)a[i]-(int)b[i];
+}
+
+__attribute__((target("sse2")))
+static SIZE_T SearchSSE2(const BYTE_T *keys, const SIZE_T stride, const SIZE_T num,
+			 const SIZE_T keysize, const BYTE_T *end, const BYTE_T *key)
+{
+  if (keysize>16) {
+    return SearchScalar(keys,stride,num,keysize,end,key);
+  }
+  KEYSEARCH_BODY(Compare16,16)
+}
+
+__attribute__((target("avx2")))
+static SIZE_T SearchAVX2(const BYTE_T *keys, const SIZE_T stride, const SIZE_T num,
+			 const SIZE_T keysize, const BYTE_T *end, const BYTE_T *key)
+{
+  if (keysize>32) {
+    return SearchScalar(keys,stride,num,keysize,end,key);
+  }
+  if (keysize<=16) {
+    // a narrower load runs off the end of the node less often
+    KEYSEARCH_BODY(Compare16,16)
+  }
+  KEYSEARCH_BODY(Compare32,32)
+}
+
+#endif
+
+
+typedef SIZE_T (*KeySearchFn)(const BYTE_T *, const SIZE_T, const SIZE_T,
+			      const SIZE_T, const BYTE_T *, const BYTE_T *);
+
+static KeySearchFn keysearch=0;
+static const char *keysearchtype="scalar";
+
+static void PickKeySearch()
+{
+  KeySearchFn fn=SearchScalar;
+
+#ifdef KEYSEARCH_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    fn=SearchAVX2;
+    keysearchtype="avx2";
+  } else if (__builtin_cpu_supports("sse2")) {
+    fn=SearchSSE2;
+    keysearchtype="sse2";
+  }
+#endif
+  keysearch=fn;
+}
+
+
+SIZE_T SearchKeys(const BYTE_T *keys,
+		  const SIZE_T stride,
+		  const SIZE_T num,
+		  const SIZE_T keysize,
+		  const BYTE_T *end,
+		  const BYTE_T *key)
+{
+  if (!keysearch) {
+    PickKeySearch();
+  }
+  return keysearch(keys,stride,num,keysize,end,key);
+}
+
+const char *GetKeySearchType()
+{
+  if (!keysearch) {
+    PickKeySearch();
+  }
+  return keysearchtype;
+}
@@ -0,0 +1,34 @@
+#ifndef _keysearch
+#define _keysearch
+
+#include "global.h"
+
+//
+// Searching the keys of a node
+//
+// Keys are compared as bytes, like memcmp.  A short key is compared
+// with a single vector compare rather than byte by byte: keys of up
+// to 16 bytes with SSE2, and up to 32 bytes with AVX2.  Which one is
+// used is decided the first time through, from what the CPU
+// supports.  Longer keys, other CPUs, and keys so near the end of
+// the node that a vector load would run past it use memcmp.
+//
+// The keys in a node are interleaved with pointers or values, so
+// each probe of the binary search compares one key; there is no
+// packed run of keys to compare several at a time.
+//
+
+// How many of the num keys, stride bytes apart starting at keys, are
+// <= key.  The keys must be in order, and the node's data must end
+// at end.
+SIZE_T SearchKeys(const BYTE_T *keys,
+		  const SIZE_T stride,
+		  const SIZE_T num,
+		  const SIZE_T keysize,
+		  const BYTE_T *end,
+		  const BYTE_T *key);
+
+// "avx2", "sse2", or "scalar"
+const char *GetKeySearchType();
+
+#endif
@@ -1,16 +1,78 @@
 #include <string>
+#include <vector>
 #include <stdlib.h>
 
 #include "disksystem.h"
+#include "stripedvolume.h"
+#include "flashdisk.h"
+#include "compressedvolume.h"
 
 
 void usage() 
 {
   cerr << "usage: makedisk filestem blocks blocksize heads blockspertrack tracks avgseek trackseek rotlat\n";
+  cerr << "       makedisk filestem FLASH blocks blocksize pagesperblock channels readlat programlat eraselat\n";
+  cerr << "       makedisk filestem STRIPE stripeunit member [member ...]\n";
+  cerr << "       makedisk filestem COMPRESS member [blocks [slotsize]]\n";
+  cerr << "       FLASH makes a flash disk, with pagesperblock blocks to an erase block\n";
+  cerr << "       STRIPE makes a volume striped across existing disks\n";
+  cerr << "       COMPRESS makes a volume that compresses its blocks onto an existing disk\n";
 }
 
 int main(int argc, char *argv[])
 {
+  if (argc>=5 && string(argv[2])=="STRIPE") { 
+    vector<string> members(argv+4,argv+argc);
+
+    StripedVolume volume(argv[1],
+			 true,
+			 atoi(argv[3]),
+			 members);
+
+    cerr << "Volume is as follows.\n" << volume << "\n";
+
+    cerr << "Done.\n";
+
+    return 0;
+  }
+
+  if (argc>=4 && string(argv[2])=="COMPRESS") { 
+    CompressedVolume volume(argv[1],
+			    true,
+			    argv[3],
+			    argc>=5 ? atoll(argv[4]) : 0,
+			    argc>=6 ? atoi(argv[5]) : 64);
+
+    cerr << "Volume is as follows.\n" << volume << "\n";
+
+    cerr << "Done.\n";
+
+    return 0;
+  }
+
+  if (argc>=3 && string(argv[2])=="FLASH") { 
+    if (argc<10) { 
+      usage();
+      exit(-1);
+    }
+
+    FlashDiskSystem disk(argv[1],
+			 true,
+			 atoll(argv[3]),
+			 atoi(argv[4]),
+			 atoi(argv[5]),
+			 atoi(argv[6]),
+			 atof(argv[7]),
+			 atof(argv[8]),
+			 atof(argv[9]));
+
+    cerr << "Disk is as follows.\n" << disk << "\n";
+
+    cerr << "Done.\n";
+
+    return 0;
+  }
+
   if (argc<10) { 
     usage();
     exit(-1);
@@ -19,11 +81,11 @@ int main(int argc, char *argv[])
   DiskSystem disk(argv[1],
 		  true,
 		  0,
-		  atoi(argv[2]),
+		  atoll(argv[2]),
 		  atoi(argv[3]),
 		  atoi(argv[4]),
 		  atoi(argv[5]),
-		  atoi(argv[6]),
+		  atoll(argv[6]),
 		  atof(argv[7]),
 		  atof(argv[8]),
 		  atof(argv[9]));
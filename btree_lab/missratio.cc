@@ -0,0 +1,133 @@
+#include <algorithm>
+
+#include "missratio.h"
+
+// Hashes are compared against a threshold out of this many
+#define MISSRATIO_HASH_MODULUS (1<<24)
+
+static SIZE_T HashBlock(const SIZE_T blocknum)
+{
+  // Knuth's multiplicative hash, so that sampled blocks are spread
+  // evenly over the disk rather than bunched up
+  return (SIZE_T)((blocknum*2654435761U)>>8)%MISSRATIO_HASH_MODULUS;
+}
+
+MissRatioTracker::MissRatioTracker(const double rate) :
+  samplerate(rate), references(0), sampled(0), coldmisses(0), now(0)
+{
+  if (samplerate>1 || samplerate<=0) {
+    samplerate=1;
+  }
+  threshold=(SIZE_T)(samplerate*MISSRATIO_HASH_MODULUS);
+  tree.resize(1024);
+}
+
+void MissRatioTracker::Add(SIZE_T t, const int delta)
+{
+  for (; t<tree.size(); t+=t&(-t)) {
+    tree[t]+=delta;
+  }
+}
+
+SIZE_T MissRatioTracker::Sum(SIZE_T t) const
+{
+  int sum=0;
+
+  for (; t>0; t-=t&(-t)) {
+    sum+=tree[t];
+  }
+  return sum;
+}
+
+void MissRatioTracker::Compact()
+{
+  vector<pair<SIZE_T,SIZE_T> > byage;
+
+  for (unordered_map<SIZE_T,SIZE_T>::const_iterator i=lastref.begin(); i!=lastref.end(); ++i) {
+    byage.push_back(make_pair((*i).second,(*i).first));
+  }
+  sort(byage.begin(),byage.end());
+
+  // leave room for at least as many more references
+  tree.assign(2*byage.size()+1024,0);
+  for (SIZE_T i=0; i<byage.size(); i++) {
+    lastref[byage[i].second]=i+1;
+    Add(i+1,1);
+  }
+  now=byage.size();
+}
+
+void MissRatioTracker::Reference(const SIZE_T blocknum)
+{
+  lock_guard<mutex> l(lock);
+
+  references++;
+  if (threshold<MISSRATIO_HASH_MODULUS && HashBlock(blocknum)>=threshold) {
+    return;
+  }
+  sampled++;
+
+  unordered_map<SIZE_T,SIZE_T>::iterator i=lastref.find(blocknum);
+
+  if (i==lastref.end()) {
+    coldmisses++;
+  } else {
+    // distinct blocks referenced since, counting this one
+    SIZE_T d=Sum(now)-Sum((*i).second)+1;
+    if (d>=histogram.size()) {
+      histogram.resize(d+1,0);
+    }
+    histogram[d]++;
+    Add((*i).second,-1);
+    lastref.erase(i);
+  }
+
+  if (now+1>=tree.size()) {
+    Compact();
+  }
+  now++;
+  lastref[blocknum]=now;
+  Add(now,1);
+}
+
+void MissRatioTracker::Clear()
+{
+  lock_guard<mutex> l(lock);
+
+  references=sampled=coldmisses=now=0;
+  lastref.clear();
+  tree.assign(1024,0);
+  histogram.clear();
+}
+
+SIZE_T MissRatioTracker::GetNumReferences() const
+{
+  lock_guard<mutex> l(lock);
+
+  return references;
+}
+
+SIZE_T MissRatioTracker::GetFootprint() const
+{
+  lock_guard<mutex> l(lock);
+
+  return (SIZE_T)(coldmisses/samplerate+0.5);
+}
+
+double MissRatioTracker::GetHitRatio(const SIZE_T cachesize) const
+{
+  lock_guard<mutex> l(lock);
+
+  if (sampled==0) {
+    return 0;
+  }
+
+  // a sampled distance of d stands for d/samplerate blocks
+  SIZE_T maxd=(SIZE_T)(cachesize*samplerate);
+  SIZE_T hits=0;
+
+  for (SIZE_T d=1; d<=maxd && d<histogram.size(); d++) {
+    hits+=histogram[d];
+  }
+  return ((double)hits)/sampled;
+}
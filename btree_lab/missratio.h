@@ -0,0 +1,65 @@
+#ifndef _missratio
+#define _missratio
+
+#include <iostream>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+
+#include "global.h"
+
+using namespace std;
+
+//
+// Miss ratio curve from reuse distances
+//
+// Watches the stream of block references and records, for each one,
+// how many distinct blocks were referenced since the last reference
+// to the same block.  A reference at distance d hits in any LRU
+// cache of at least d blocks, so one run gives the hit ratio of
+// every cache size.  For the other policies it is an estimate.
+//
+// To keep the cost down on big runs, only a sample of the block
+// numbers can be tracked, chosen by hashing the block number (as in
+// Waldspurger et al's SHARDS).  Distances measured among the sampled
+// blocks are scaled up by 1/samplerate.
+//
+class MissRatioTracker {
+ private:
+  double samplerate;
+  SIZE_T threshold;       // sample blocks whose hash falls below this
+  SIZE_T references;      // all references seen
+  SIZE_T sampled;         // references to sampled blocks
+  SIZE_T coldmisses;      // first references to sampled blocks
+  SIZE_T now;             // clock, ticks once per sampled reference
+  // block -> time of its last reference
+  unordered_map<SIZE_T, SIZE_T> lastref;
+  // Fenwick tree over times, with a one at the time of the last
+  // reference to each block
+  vector<int> tree;
+  // histogram[d] = sampled references at distance d
+  vector<SIZE_T> histogram;
+  mutable mutex lock;
+
+  void   Add(SIZE_T t, const int delta);
+  // number of last references at times 1..t
+  SIZE_T Sum(SIZE_T t) const;
+  // renumber the last references 1..n and rebuild the tree
+  void   Compact();
+
+ public:
+  // samplerate in (0,1]; 1 tracks every block exactly
+  MissRatioTracker(const double samplerate=1.0);
+
+  void Reference(const SIZE_T blocknum);
+  void Clear();
+
+  SIZE_T GetNumReferences() const;
+  // Distinct blocks seen, estimated if sampling
+  SIZE_T GetFootprint() const;
+  // Predicted fraction of references that hit in an LRU cache
+  // of cachesize blocks
+  double GetHitRatio(const SIZE_T cachesize) const;
+};
+
+#endif
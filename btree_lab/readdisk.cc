@@ -15,11 +15,12 @@ int main(int argc, char *argv[])
     usage();
     exit(-1);
   }
-  SIZE_T blocknum=atoi(argv[2]);
-  SIZE_T numblocks=atoi(argv[3]);
+  SIZE_T blocknum=atoll(argv[2]);
+  SIZE_T numblocks=atoll(argv[3]);
   double reqtime;
 
-  DiskSystem disk(argv[1]);
+  unique_ptr<DiskSystem> diskp(OpenDiskSystem(argv[1]));
+  DiskSystem &disk=*diskp;
 
   vector<Block> b;
 
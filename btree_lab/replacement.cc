@@ -0,0 +1,535 @@
+#include <ctype.h>
+
+#include "replacement.h"
+
+
+//
+// LRU
+//
+
+void LRUPolicy::Link(const SIZE_T blocknum, Node &n, const double now)
+{
+  if (groups.empty() || groups.back().lastaccessed!=now) {
+    groups.push_back(Group(now));
+  }
+  Group &newest=groups.back();
+  if (!newest.blocks.empty() && newest.blocks.back()>blocknum) {
+    newest.sorted=false;
+  }
+  newest.blocks.push_back(blocknum);
+  n.pinned=false;
+  n.group=--groups.end();
+  n.pos=--newest.blocks.end();
+}
+
+void LRUPolicy::Unlink(Node &n)
+{
+  n.group->blocks.erase(n.pos);
+  if (n.group->blocks.empty()) {
+    groups.erase(n.group);
+  }
+}
+
+void LRUPolicy::Insert(const SIZE_T blocknum, const double now)
+{
+  Link(blocknum,nodes[blocknum],now);
+}
+
+void LRUPolicy::Touch(const SIZE_T blocknum, const double now)
+{
+  unordered_map<SIZE_T, Node>::iterator i=nodes.find(blocknum);
+
+  if (i==nodes.end() || (*i).second.pinned) {
+    // pinned blocks are relinked when they are unpinned
+    return;
+  }
+
+  Node &n=(*i).second;
+
+  if (n.group->lastaccessed==now) {
+    // already in the newest group
+    return;
+  }
+
+  GroupList::iterator oldgroup=n.group;
+
+  if (groups.back().lastaccessed!=now) {
+    groups.push_back(Group(now));
+  }
+  Group &newest=groups.back();
+  if (!newest.blocks.empty() && newest.blocks.back()>blocknum) {
+    newest.sorted=false;
+  }
+  // splice rather than reallocate the list node
+  newest.blocks.splice(newest.blocks.end(),oldgroup->blocks,n.pos);
+  if (oldgroup->blocks.empty()) {
+    groups.erase(oldgroup);
+  }
+  n.group=--groups.end();
+}
+
+void LRUPolicy::Remove(const SIZE_T blocknum)
+{
+  unordered_map<SIZE_T, Node>::iterator i=nodes.find(blocknum);
+
+  if (i==nodes.end()) {
+    return;
+  }
+  if (!(*i).second.pinned) {
+    Unlink((*i).second);
+  }
+  nodes.erase(i);
+}
+
+void LRUPolicy::Pin(const SIZE_T blocknum)
+{
+  Node &n=nodes[blocknum];
+
+  Unlink(n);
+  n.pinned=true;
+}
+
+void LRUPolicy::Unpin(const SIZE_T blocknum, const double now)
+{
+  Link(blocknum,nodes[blocknum],now);
+}
+
+bool LRUPolicy::Evict(SIZE_T &victim, const SIZE_T incoming)
+{
+  if (groups.empty()) {
+    return false;
+  }
+
+  // The oldest group holds the least recently used blocks
+  Group &oldest=groups.front();
+
+  if (!oldest.sorted) {
+    oldest.blocks.sort();
+    oldest.sorted=true;
+  }
+
+  victim=oldest.blocks.front();
+  Remove(victim);
+  return true;
+}
+
+void LRUPolicy::Clear()
+{
+  groups.clear();
+  nodes.clear();
+}
+
+
+//
+// CLOCK
+//
+
+void ClockPolicy::Insert(const SIZE_T blocknum, const double now)
+{
+  SIZE_T f;
+
+  if (!freeframes.empty()) {
+    f=freeframes.back();
+    freeframes.pop_back();
+  } else {
+    f=frames.size();
+    frames.push_back(Frame());
+  }
+  frames[f].blocknum=blocknum;
+  frames[f].used=true;
+  frames[f].referenced=true;
+  frames[f].pinned=false;
+  index[blocknum]=f;
+}
+
+void ClockPolicy::Touch(const SIZE_T blocknum, const double now)
+{
+  unordered_map<SIZE_T, SIZE_T>::iterator i=index.find(blocknum);
+
+  if (i!=index.end()) {
+    frames[(*i).second].referenced=true;
+  }
+}
+
+void ClockPolicy::Remove(const SIZE_T blocknum)
+{
+  unordered_map<SIZE_T, SIZE_T>::iterator i=index.find(blocknum);
+
+  if (i==index.end()) {
+    return;
+  }
+  frames[(*i).second].used=false;
+  freeframes.push_back((*i).second);
+  index.erase(i);
+}
+
+void ClockPolicy::Pin(const SIZE_T blocknum)
+{
+  frames[index[blocknum]].pinned=true;
+}
+
+void ClockPolicy::Unpin(const SIZE_T blocknum, const double now)
+{
+  frames[index[blocknum]].pinned=false;
+}
+
+bool ClockPolicy::Evict(SIZE_T &victim, const SIZE_T incoming)
+{
+  if (frames.empty()) {
+    return false;
+  }
+
+  // Two full sweeps clear every reference bit, so if we haven't
+  // found anything by then, everything is pinned
+  for (SIZE_T n=0; n<2*frames.size(); n++) {
+    Frame &f=frames[hand];
+    hand=(hand+1)%frames.size();
+    if (!f.used || f.pinned) {
+      continue;
+    }
+    if (f.referenced) {
+      // second chance
+      f.referenced=false;
+      continue;
+    }
+    victim=f.blocknum;
+    Remove(victim);
+    return true;
+  }
+  return false;
+}
+
+void ClockPolicy::Clear()
+{
+  frames.clear();
+  freeframes.clear();
+  index.clear();
+  hand=0;
+}
+
+
+//
+// Multiple queue plumbing
+//
+
+int MultiQueuePolicy::QueueOf(const SIZE_T blocknum) const
+{
+  unordered_map<SIZE_T, Node>::const_iterator i=nodes.find(blocknum);
+
+  return i==nodes.end() ? -1 : (*i).second.queue;
+}
+
+void MultiQueuePolicy::PushBack(const SIZE_T blocknum, const int queue)
+{
+  Node &n=nodes[blocknum];
+
+  queues[queue].push_back(blocknum);
+  n.queue=queue;
+  n.pinned=false;
+  n.pos=--queues[queue].end();
+}
+
+void MultiQueuePolicy::MoveToBack(const SIZE_T blocknum, const int queue)
+{
+  Node &n=nodes[blocknum];
+
+  queues[queue].splice(queues[queue].end(),queues[n.queue],n.pos);
+  n.queue=queue;
+}
+
+void MultiQueuePolicy::Erase(const SIZE_T blocknum)
+{
+  unordered_map<SIZE_T, Node>::iterator i=nodes.find(blocknum);
+
+  if (i==nodes.end()) {
+    return;
+  }
+  queues[(*i).second.queue].erase((*i).second.pos);
+  nodes.erase(i);
+}
+
+void MultiQueuePolicy::DropOldest(const int queue)
+{
+  if (!queues[queue].empty()) {
+    Erase(queues[queue].front());
+  }
+}
+
+bool MultiQueuePolicy::FindOldestUnpinned(const int queue, SIZE_T &blocknum) const
+{
+  for (list<SIZE_T>::const_iterator i=queues[queue].begin(); i!=queues[queue].end(); ++i) {
+    if (!(*nodes.find(*i)).second.pinned) {
+      blocknum=*i;
+      return true;
+    }
+  }
+  return false;
+}
+
+void MultiQueuePolicy::Remove(const SIZE_T blocknum)
+{
+  Erase(blocknum);
+}
+
+void MultiQueuePolicy::Pin(const SIZE_T blocknum)
+{
+  nodes[blocknum].pinned=true;
+}
+
+void MultiQueuePolicy::Unpin(const SIZE_T blocknum, const double now)
+{
+  nodes[blocknum].pinned=false;
+}
+
+void MultiQueuePolicy::Clear()
+{
+  for (SIZE_T i=0;i<queues.size();i++) {
+    queues[i].clear();
+  }
+  nodes.clear();
+}
+
+
+//
+// 2Q
+//
+// A1in is a FIFO of blocks seen once, A1out remembers blocks that fell
+// out of A1in, and Am is an LRU of blocks seen again after that.
+// The sizes are the ones recommended in the paper.
+//
+
+TwoQPolicy::TwoQPolicy(const SIZE_T cachesize) :
+  MultiQueuePolicy(3),
+  kin(cachesize/4 > 0 ? cachesize/4 : 1),
+  kout(cachesize/2 > 0 ? cachesize/2 : 1)
+{}
+
+void TwoQPolicy::Insert(const SIZE_T blocknum, const double now)
+{
+  if (QueueOf(blocknum)==A1OUT) {
+    // seen recently, so it's hot
+    MoveToBack(blocknum,AM);
+  } else {
+    PushBack(blocknum,A1IN);
+  }
+}
+
+void TwoQPolicy::Touch(const SIZE_T blocknum, const double now)
+{
+  // hits in A1in deliberately do nothing
+  if (QueueOf(blocknum)==AM) {
+    MoveToBack(blocknum,AM);
+  }
+}
+
+bool TwoQPolicy::Evict(SIZE_T &victim, const SIZE_T incoming)
+{
+  bool fromA1in = queues[A1IN].size()>kin || queues[AM].empty();
+
+  if (fromA1in && FindOldestUnpinned(A1IN,victim)) {
+  } else if (FindOldestUnpinned(AM,victim)) {
+    fromA1in=false;
+  } else if (FindOldestUnpinned(A1IN,victim)) {
+    fromA1in=true;
+  } else {
+    return false;
+  }
+
+  if (fromA1in) {
+    // remember it in case it comes back
+    MoveToBack(victim,A1OUT);
+    if (queues[A1OUT].size()>kout) {
+      DropOldest(A1OUT);
+    }
+  } else {
+    Erase(victim);
+  }
+  return true;
+}
+
+void TwoQPolicy::Resize(const SIZE_T cachesize)
+{
+  kin=cachesize/4 > 0 ? cachesize/4 : 1;
+  kout=cachesize/2 > 0 ? cachesize/2 : 1;
+  while (queues[A1OUT].size()>kout) {
+    DropOldest(A1OUT);
+  }
+}
+
+
+//
+// ARC
+//
+// T1 and T2 hold the cached blocks seen once and more than once
+// recently, B1 and B2 are their ghosts.  A hit in B1 means T1 should
+// have been bigger, a hit in B2 that T2 should have been.
+//
+
+ARCPolicy::ARCPolicy(const SIZE_T cachesize) :
+  MultiQueuePolicy(4),
+  c(cachesize > 0 ? cachesize : 1),
+  p(0),
+  adapted(false),
+  adaptedfor(0)
+{}
+
+void ARCPolicy::Adapt(const SIZE_T incoming)
+{
+  if (adapted && adaptedfor==incoming) {
+    return;
+  }
+
+  double b1=queues[B1].size();
+  double b2=queues[B2].size();
+
+  switch (QueueOf(incoming)) {
+  case B1:
+    p += (b1>=b2) ? 1 : b2/b1;
+    if (p>c) { p=c; }
+    break;
+  case B2:
+    p -= (b2>=b1) ? 1 : b1/b2;
+    if (p<0) { p=0; }
+    break;
+  default:
+    return;
+  }
+  adapted=true;
+  adaptedfor=incoming;
+}
+
+void ARCPolicy::Insert(const SIZE_T blocknum, const double now)
+{
+  int q=QueueOf(blocknum);
+
+  if (q==B1 || q==B2) {
+    Adapt(blocknum);
+    MoveToBack(blocknum,T2);
+  } else {
+    // Keep the directory at most c blocks of recency history
+    // and 2c in total
+    while (queues[T1].size()+queues[B1].size()>=c && !queues[B1].empty()) {
+      DropOldest(B1);
+    }
+    while (nodes.size()>=2*c && !queues[B2].empty()) {
+      DropOldest(B2);
+    }
+    PushBack(blocknum,T1);
+  }
+  adapted=false;
+}
+
+void ARCPolicy::Touch(const SIZE_T blocknum, const double now)
+{
+  int q=QueueOf(blocknum);
+
+  if (q==T1 || q==T2) {
+    MoveToBack(blocknum,T2);
+  }
+}
+
+bool ARCPolicy::Evict(SIZE_T &victim, const SIZE_T incoming)
+{
+  int q=QueueOf(incoming);
+
+  Adapt(incoming);
+
+  double t1=queues[T1].size();
+  bool fromT1 = t1>=1 && ((q==B2 && t1==p) || t1>p);
+
+  if (fromT1 && FindOldestUnpinned(T1,victim)) {
+  } else if (FindOldestUnpinned(T2,victim)) {
+    fromT1=false;
+  } else if (FindOldestUnpinned(T1,victim)) {
+    fromT1=true;
+  } else {
+    return false;
+  }
+
+  if (q==-1 && fromT1 && queues[B1].empty() && queues[T1].size()>=c) {
+    // T1 alone fills the cache, so there is no room for history
+    Erase(victim);
+  } else {
+    MoveToBack(victim, fromT1 ? B1 : B2);
+  }
+  return true;
+}
+
+void ARCPolicy::Resize(const SIZE_T cachesize)
+{
+  c=cachesize > 0 ? cachesize : 1;
+  if (p>c) {
+    p=c;
+  }
+  // Trim the history to fit the new directory size.  The cached
+  // blocks themselves go as the cache evicts them.
+  while (queues[T1].size()+queues[B1].size()>c && !queues[B1].empty()) {
+    DropOldest(B1);
+  }
+  while (nodes.size()>2*c && !queues[B2].empty()) {
+    DropOldest(B2);
+  }
+}
+
+void ARCPolicy::Clear()
+{
+  MultiQueuePolicy::Clear();
+  p=0;
+  adapted=false;
+}
+
+
+ERROR_T ParseReplacementPolicy(const string &name, ReplacementPolicyType &type)
+{
+  string n=name;
+
+  for (SIZE_T i=0;i<n.size();i++) {
+    n[i]=toupper(n[i]);
+  }
+
+  if (n=="LRU") {
+    type=POLICY_LRU;
+  } else if (n=="CLOCK") {
+    type=POLICY_CLOCK;
+  } else if (n=="2Q") {
+    type=POLICY_2Q;
+  } else if (n=="ARC") {
+    type=POLICY_ARC;
+  } else {
+    cerr << "Unknown replacement policy "<<name<<" (use LRU, CLOCK, 2Q, or ARC)\n";
+    return ERROR_BADCONFIG;
+  }
+  return ERROR_NOERROR;
+}
+
+const char *GetReplacementPolicyName(const ReplacementPolicyType type)
+{
+  switch (type) {
+  case POLICY_LRU:
+    return "LRU";
+  case POLICY_CLOCK:
+    return "CLOCK";
+  case POLICY_2Q:
+    return "2Q";
+  case POLICY_ARC:
+    return "ARC";
+  default:
+    return "UNKNOWN";
+  }
+}
+
+ReplacementPolicy *CreateReplacementPolicy(const ReplacementPolicyType type,
+					   const SIZE_T cachesize)
+{
+  switch (type) {
+  case POLICY_CLOCK:
+    return new ClockPolicy();
+  case POLICY_2Q:
+    return new TwoQPolicy(cachesize);
+  case POLICY_ARC:
+    return new ARCPolicy(cachesize);
+  case POLICY_LRU:
+  default:
+    return new LRUPolicy();
+  }
+}
@@ -0,0 +1,214 @@
+#ifndef _replacement
+#define _replacement
+
+#include <iostream>
+#include <string>
+#include <list>
+#include <vector>
+#include <unordered_map>
+
+#include "global.h"
+
+using namespace std;
+
+//
+// Replacement policies for the buffer cache
+//
+// A policy only tracks block numbers.  The buffer cache tells it
+// about every block that comes in, every hit, and every block that
+// leaves other than by eviction, and asks it for a victim when the
+// cache is full.  Pinned blocks must never be chosen.
+//
+// LRU    least recently used (ties broken by lowest block number)
+// CLOCK  second chance approximation of LRU
+// 2Q     Johnson and Shasha's full 2Q - new blocks go through a FIFO,
+//        and only those referenced again after leaving it are kept
+//        in the main LRU queue, so one pass over the tree can't
+//        flush the hot interior nodes
+// ARC    Megiddo and Modha's adaptive replacement cache - balances
+//        recency against frequency using ghost lists of recently
+//        evicted blocks
+//
+enum ReplacementPolicyType {POLICY_LRU, POLICY_CLOCK, POLICY_2Q, POLICY_ARC};
+
+// Passed to Evict when blocks are evicted to shrink the cache rather
+// than to make room for a particular block
+const SIZE_T NO_INCOMING_BLOCK=(SIZE_T)-1;
+
+
+class ReplacementPolicy {
+ public:
+  virtual ~ReplacementPolicy() {}
+
+  virtual ReplacementPolicyType GetType() const = 0;
+
+  // A block was just brought into the cache
+  virtual void Insert(const SIZE_T blocknum, const double now) = 0;
+  // A block in the cache was referenced
+  virtual void Touch(const SIZE_T blocknum, const double now) = 0;
+  // A block left the cache other than through Evict
+  virtual void Remove(const SIZE_T blocknum) = 0;
+  // Pinned blocks can't be evicted.  Pins do not nest here, the
+  // cache only calls these on the first pin and the last unpin.
+  virtual void Pin(const SIZE_T blocknum) = 0;
+  virtual void Unpin(const SIZE_T blocknum, const double now) = 0;
+  // Choose a victim to make room for incoming, and forget it.
+  // Returns false if every block is pinned.
+  virtual bool Evict(SIZE_T &victim, const SIZE_T incoming) = 0;
+  // The cache size changed.  Shrinking the cache is done by the
+  // cache calling Evict until it fits.
+  virtual void Resize(const SIZE_T cachesize) {}
+  // Forget everything
+  virtual void Clear() = 0;
+};
+
+
+//
+// Blocks touched at the same simulated time share a group.  Groups
+// are kept from least to most recently used.  Since the clock only
+// advances on disk I/O, many blocks share a timestamp; within the
+// oldest group the victim is the lowest numbered block.  A group is
+// sorted lazily, the first time it supplies a victim, and never grows
+// again unless it is also the newest group.
+//
+class LRUPolicy : public ReplacementPolicy {
+ private:
+  struct Group {
+    double        lastaccessed;
+    bool          sorted;
+    list<SIZE_T>  blocks;
+
+    Group(const double t) : lastaccessed(t), sorted(true) {}
+  };
+
+  typedef list<Group> GroupList;
+
+  struct Node {
+    bool                    pinned;   // pinned blocks are in no group
+    GroupList::iterator     group;
+    list<SIZE_T>::iterator  pos;
+  };
+
+  GroupList                   groups;
+  unordered_map<SIZE_T, Node> nodes;
+
+  void Link(const SIZE_T blocknum, Node &n, const double now);
+  void Unlink(Node &n);
+
+ public:
+  ReplacementPolicyType GetType() const { return POLICY_LRU; }
+  void Insert(const SIZE_T blocknum, const double now);
+  void Touch(const SIZE_T blocknum, const double now);
+  void Remove(const SIZE_T blocknum);
+  void Pin(const SIZE_T blocknum);
+  void Unpin(const SIZE_T blocknum, const double now);
+  bool Evict(SIZE_T &victim, const SIZE_T incoming);
+  void Clear();
+};
+
+
+class ClockPolicy : public ReplacementPolicy {
+ private:
+  struct Frame {
+    SIZE_T blocknum;
+    bool   used;
+    bool   referenced;
+    bool   pinned;
+  };
+
+  vector<Frame>                 frames;
+  vector<SIZE_T>                freeframes;
+  unordered_map<SIZE_T, SIZE_T> index;   // block number -> frame
+  SIZE_T                        hand;
+
+ public:
+  ClockPolicy() : hand(0) {}
+  ReplacementPolicyType GetType() const { return POLICY_CLOCK; }
+  void Insert(const SIZE_T blocknum, const double now);
+  void Touch(const SIZE_T blocknum, const double now);
+  void Remove(const SIZE_T blocknum);
+  void Pin(const SIZE_T blocknum);
+  void Unpin(const SIZE_T blocknum, const double now);
+  bool Evict(SIZE_T &victim, const SIZE_T incoming);
+  void Clear();
+};
+
+
+//
+// Shared plumbing for the policies built out of several LRU/FIFO
+// queues of block numbers, some of which may be ghost queues.
+// front() is the oldest end of each queue.
+//
+class MultiQueuePolicy : public ReplacementPolicy {
+ protected:
+  struct Node {
+    int                     queue;
+    bool                    pinned;
+    list<SIZE_T>::iterator  pos;
+  };
+
+  vector<list<SIZE_T> >       queues;
+  unordered_map<SIZE_T, Node> nodes;
+
+  MultiQueuePolicy(const int numqueues) : queues(numqueues) {}
+
+  // which queue a block is in, or -1
+  int  QueueOf(const SIZE_T blocknum) const;
+  void MoveToBack(const SIZE_T blocknum, const int queue);
+  void PushBack(const SIZE_T blocknum, const int queue);
+  void Erase(const SIZE_T blocknum);
+  void DropOldest(const int queue);
+  // oldest unpinned block in a queue
+  bool FindOldestUnpinned(const int queue, SIZE_T &blocknum) const;
+
+ public:
+  void Remove(const SIZE_T blocknum);
+  void Pin(const SIZE_T blocknum);
+  void Unpin(const SIZE_T blocknum, const double now);
+  void Clear();
+};
+
+
+class TwoQPolicy : public MultiQueuePolicy {
+ private:
+  enum {A1IN=0, A1OUT=1, AM=2};
+  SIZE_T kin, kout;
+
+ public:
+  TwoQPolicy(const SIZE_T cachesize);
+  ReplacementPolicyType GetType() const { return POLICY_2Q; }
+  void Insert(const SIZE_T blocknum, const double now);
+  void Touch(const SIZE_T blocknum, const double now);
+  bool Evict(SIZE_T &victim, const SIZE_T incoming);
+  void Resize(const SIZE_T cachesize);
+};
+
+
+class ARCPolicy : public MultiQueuePolicy {
+ private:
+  enum {T1=0, T2=1, B1=2, B2=3};
+  SIZE_T c;
+  double p;            // target size of T1
+  bool   adapted;      // p already adapted for this miss
+  SIZE_T adaptedfor;
+
+  void Adapt(const SIZE_T incoming);
+
+ public:
+  ARCPolicy(const SIZE_T cachesize);
+  ReplacementPolicyType GetType() const { return POLICY_ARC; }
+  void Insert(const SIZE_T blocknum, const double now);
+  void Touch(const SIZE_T blocknum, const double now);
+  bool Evict(SIZE_T &victim, const SIZE_T incoming);
+  void Resize(const SIZE_T cachesize);
+  void Clear();
+};
+
+
+// returns ERROR_BADCONFIG if there is no such policy
+ERROR_T ParseReplacementPolicy(const string &name, ReplacementPolicyType &type);
+const char *GetReplacementPolicyName(const ReplacementPolicyType type);
+ReplacementPolicy *CreateReplacementPolicy(const ReplacementPolicyType type,
+					   const SIZE_T cachesize);
+
+#endif
@@ -5,13 +5,18 @@
 #include <strstream>
 #include <fstream>
 #include "btree.h"
+#include "keysearch.h"
 
 
 using namespace std;
 
 void usage()
 {
-  cerr << "usage: sim filestem cachesize < specfile \n";
+  cerr << "usage: sim filestem cachesize [LRU|CLOCK|2Q|ARC] [FIFO|SSTF|SCAN|CLOOK] [MRC] [MMAP] [ASYNC] [PREFIX] < specfile \n";
+  cerr << "       MRC prints the predicted miss ratio curve at DEINIT\n";
+  cerr << "       MMAP reads and writes the disk through a memory mapping\n";
+  cerr << "       ASYNC lets the disk's reads and writes overlap\n";
+  cerr << "       PREFIX stores the prefix the keys of a node share once per node\n";
 }
 
 
@@ -20,7 +25,7 @@ int main(int argc, char *argv[])
 
   // CONFORMS to the interface of ref_impl.pl
 
-  if (argc != 3){
+  if (argc < 3 || argc > 9){
     usage();
     return 1;
   }
@@ -28,6 +33,29 @@ int main(int argc, char *argv[])
   char *filestem=argv[1];
   SIZE_T cachesize=atoi(argv[2]);
   SIZE_T superblocknum;
+  ReplacementPolicyType policy=POLICY_LRU;
+  DiskSchedulerType scheduler=DISKSCHED_CLOOK;
+  bool missratiocurve=false;
+  bool memorymap=false;
+  bool async=false;
+  bool prefixkeys=false;
+
+  for (int i=3; i<argc; i++) { 
+    if (string(argv[i])=="MRC") { 
+      missratiocurve=true;
+    } else if (string(argv[i])=="MMAP") { 
+      memorymap=true;
+    } else if (string(argv[i])=="ASYNC") { 
+      async=true;
+    } else if (string(argv[i])=="PREFIX") { 
+      prefixkeys=true;
+    } else if (ParseDiskScheduler(argv[i],scheduler)==ERROR_NOERROR) { 
+      // the disk's request scheduler
+    } else if (ParseReplacementPolicy(argv[i],policy)!=ERROR_NOERROR) { 
+      usage();
+      return 1;
+    }
+  }
 
   FILE *file; 
   char line[1024];
@@ -37,8 +65,22 @@ int main(int argc, char *argv[])
   // We'll connect to the btree only once and then
   // run lots of operations
   // so we need to do this outside the loop
-  DiskSystem disk(filestem);
-  BufferCache cache(&disk,cachesize);
+  unique_ptr<DiskSystem> diskp(OpenDiskSystem(filestem));
+  DiskSystem &disk=*diskp;
+
+  disk.SetScheduler(scheduler);
+
+  if (memorymap && disk.EnableMemoryMap()!=ERROR_NOERROR) {
+    cerr << "Can't memory map the disk\n";
+    return -1;
+  }
+
+  if (async && disk.EnableAsyncIO()!=ERROR_NOERROR) {
+    cerr << "Can't do asynchronous I/O\n";
+    return -1;
+  }
+
+  BufferCache cache(&disk,cachesize,policy);
   // will be set on init
   BTreeIndex *btree;
 
@@ -47,6 +89,11 @@ int main(int argc, char *argv[])
     cerr << "Can't attach cache due to error "<<rc<<"\n";
     return -1;
   }
+
+  if (missratiocurve) { 
+    // stderr, so that the output still matches ref_impl.pl
+    cache.EnableMissRatioCurve(1.0,&cerr);
+  }
   
   file=stdin;
 
@@ -59,7 +106,7 @@ int main(int argc, char *argv[])
     is >> action >> key >> value;
 
     if (action == "INIT") {
-      btree = new BTreeIndex(atoi(key.c_str()),atoi(value.c_str()),&cache);
+      btree = new BTreeIndex(atoi(key.c_str()),atoi(value.c_str()),&cache,true,prefixkeys);
       if ((rc=btree->Attach(0, true))!=ERROR_NOERROR) {
 	cerr << "Can't attach btree with initialization due to error "<<rc<<"\n";
 	cout << "FAIL\n";
@@ -104,6 +151,14 @@ int main(int argc, char *argv[])
       cout <<"OK BEGIN DISPLAY\n";
       btree->Display(cout,BTREE_SORTED_KEYVAL);
       cout <<"OK END DISPLAY\n";
+    } else if (action == "CACHESIZE"){
+      // not part of ref_impl.pl - resizes the cache between phases
+      if ((rc=cache.SetCacheSize(atoi(key.c_str())))!=ERROR_NOERROR) { 
+	cout <<"FAIL"<<endl;
+	cerr <<"Can't resize cache due to error "<<rc<<endl;
+      } else {
+	cout <<"OK\n";
+      }
     } else if (action == "DEINIT"){
       if ((rc=btree->Detach(superblocknum))!=ERROR_NOERROR) { 
 	cout << "FAIL"<<endl;
@@ -115,6 +170,18 @@ int main(int argc, char *argv[])
 	} else {
 	  delete btree;
 	  cout << "OK\n";
+	  // stderr, so that the output still matches ref_impl.pl
+	  cerr << "policy          = "<<GetReplacementPolicyName(cache.GetPolicy())<<endl;
+	  cerr << "numhits         = "<<cache.GetNumHits()<<endl;
+	  cerr << "nummisses       = "<<cache.GetNumMisses()<<endl;
+	  cerr << "numdiskreads    = "<<cache.GetNumDiskReads()<<endl;
+	  cerr << "numdiskwrites   = "<<cache.GetNumDiskWrites()<<endl;
+	  cerr << "total time      = "<<cache.GetCurrentTime()<<endl;
+	  cerr << "scheduler       = "<<GetDiskSchedulerName(disk.GetScheduler())<<endl;
+	  cerr << "seektime        = "<<disk.GetSeekTime()<<endl;
+	  cerr << "rotationtime    = "<<disk.GetRotationTime()<<endl;
+	  cerr << "transfertime    = "<<disk.GetTransferTime()<<endl;
+	  cerr << "keysearch       = "<<GetKeySearchType()<<endl;
 	}
       }
     }
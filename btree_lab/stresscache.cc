@@ -0,0 +1,290 @@
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buffercache.h"
+
+
+void usage()
+{
+  cerr << "usage: stresscache filestem cachesize numshards numthreads numops [seed] [MMAP] [ASYNC|THREADS]\n";
+  cerr << "       Threads sharing one buffer cache read, write, pin, prefetch\n";
+  cerr << "       and flush blocks at random.  Thread t owns the blocks whose\n";
+  cerr << "       number is t modulo numthreads+1 and checks them against a copy\n";
+  cerr << "       in memory.  The rest are only read, by every thread.\n";
+  cerr << "       MMAP reads and writes the disk through a memory mapping\n";
+  cerr << "       ASYNC overlaps the disk's requests with io_uring, THREADS\n";
+  cerr << "       with the thread pool\n";
+}
+
+static atomic<SIZE_T> numerrors(0);
+static atomic<SIZE_T> numfailures(0);
+
+// rand() is not safe to share between threads
+static unsigned Next(unsigned &state)
+{
+  state=state*1103515245+12345;
+  return state>>8;
+}
+
+static void Fill(Block &block, unsigned &state)
+{
+  for (SIZE_T j=0;j<block.length;j++) {
+    block.data[j]=Next(state);
+  }
+}
+
+// Only the contents; the cache keeps its own bookkeeping in a Block
+static void Copy(Block &to, const Block &from)
+{
+  memcpy(to.data,from.data,to.length);
+}
+
+static bool Same(const Block &a, const Block &b)
+{
+  return a.length==b.length && memcmp(a.data,b.data,a.length)==0;
+}
+
+static void Fail(const SIZE_T t, const char *what, const ERROR_T rc)
+{
+  cerr << "Thread " << t << ": error " << rc << " occured in " << what << endl;
+  numfailures++;
+}
+
+static void Stress(BufferCache &cache,
+		   const SIZE_T t,
+		   const SIZE_T numthreads,
+		   const SIZE_T numops,
+		   const unsigned seed,
+		   vector<Block> &shadow)
+{
+  SIZE_T numblocks=cache.GetNumBlocks();
+  SIZE_T blocksize=cache.GetBlockSize();
+  SIZE_T stride=numthreads+1;
+  SIZE_T numowned=(numblocks-t+stride-1)/stride;
+  SIZE_T numshared=(numblocks-numthreads+stride-1)/stride;
+  unsigned state=seed*(t+1);
+  ERROR_T rc;
+
+  for (SIZE_T i=0;i<numops && numfailures==0;i++) {
+    // One of ours, and one that nobody writes.  Only the owner may
+    // look at a block it could have pinned to change.
+    SIZE_T b=t+(Next(state)%numowned)*stride;
+    SIZE_T shared=numthreads+(Next(state)%numshared)*stride;
+
+    switch (Next(state)%8) {
+    case 0:
+    case 1: {
+      Block block(blocksize);
+      Fill(block,state);
+      rc=cache.WriteBlock(b,block);
+      if (rc!=ERROR_NOERROR) {
+	Fail(t,"WriteBlock",rc);
+	return;
+      }
+      Copy(shadow[b],block);
+    }
+      break;
+    case 2: {
+      Block block;
+      rc=cache.ReadBlock(b,block);
+      if (rc!=ERROR_NOERROR) {
+	Fail(t,"ReadBlock",rc);
+	return;
+      }
+      if (!Same(block,shadow[b])) {
+	cerr << "Thread " << t << ": read of block " << b << " does not match what was written\n";
+	numerrors++;
+      }
+    }
+      break;
+    case 3: {
+      Block block;
+      rc=cache.ReadBlock(shared,block);
+      if (rc!=ERROR_NOERROR) {
+	Fail(t,"ReadBlock",rc);
+	return;
+      }
+      if (!Same(block,shadow[shared])) {
+	cerr << "Thread " << t << ": read of shared block " << shared << " does not match the disk\n";
+	numerrors++;
+      }
+    }
+      break;
+    case 4: {
+      Block *block;
+      rc=cache.PinBlock(b,block);
+      if (rc!=ERROR_NOERROR) {
+	Fail(t,"PinBlock",rc);
+	return;
+      }
+      if (!Same(*block,shadow[b])) {
+	cerr << "Thread " << t << ": pin of block " << b << " does not match what was written\n";
+	numerrors++;
+      }
+      bool dirty=Next(state)%2;
+      if (dirty) {
+	block->data[Next(state)%blocksize]=Next(state);
+	Copy(shadow[b],*block);
+      }
+      rc=cache.UnpinBlock(b,dirty);
+      if (rc!=ERROR_NOERROR) {
+	Fail(t,"UnpinBlock",rc);
+	return;
+      }
+    }
+      break;
+    case 5: {
+      Block *block;
+      rc=cache.PinBlock(shared,block);
+      if (rc!=ERROR_NOERROR) {
+	Fail(t,"PinBlock",rc);
+	return;
+      }
+      if (!Same(*block,shadow[shared])) {
+	cerr << "Thread " << t << ": pin of shared block " << shared << " does not match the disk\n";
+	numerrors++;
+      }
+      rc=cache.UnpinBlock(shared);
+      if (rc!=ERROR_NOERROR) {
+	Fail(t,"UnpinBlock",rc);
+	return;
+      }
+    }
+      break;
+    case 6:
+      rc=cache.PrefetchBlock(Next(state)%2 ? b : shared);
+      if (rc!=ERROR_NOERROR && rc!=ERROR_NOFETCH) {
+	Fail(t,"PrefetchBlock",rc);
+	return;
+      }
+      break;
+    case 7:
+      rc=cache.FlushBlock(b);
+      if (rc!=ERROR_NOERROR) {
+	Fail(t,"FlushBlock",rc);
+	return;
+      }
+      break;
+    }
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc<6 || argc>9) {
+    usage();
+    exit(-1);
+  }
+  SIZE_T cachesize=atoi(argv[2]);
+  SIZE_T numshards=atoi(argv[3]);
+  SIZE_T numthreads=atoi(argv[4]);
+  SIZE_T numops=atoll(argv[5]);
+  unsigned seed=1;
+  bool memorymap=false;
+  bool async=false;
+  AsyncIOType asynctype=ASYNCIO_URING;
+
+  for (int i=6;i<argc;i++) {
+    if (string(argv[i])=="MMAP") {
+      memorymap=true;
+    } else if (string(argv[i])=="ASYNC") {
+      async=true;
+      asynctype=ASYNCIO_URING;
+    } else if (string(argv[i])=="THREADS") {
+      async=true;
+      asynctype=ASYNCIO_THREADS;
+    } else if (i==6 && atoi(argv[i])>0) {
+      seed=atoi(argv[i]);
+    } else {
+      usage();
+      exit(-1);
+    }
+  }
+
+  unique_ptr<DiskSystem> diskp(OpenDiskSystem(argv[1]));
+  DiskSystem &disk=*diskp;
+  SIZE_T numblocks=disk.GetNumBlocks();
+
+  if (memorymap && disk.EnableMemoryMap()!=ERROR_NOERROR) {
+    cerr << "Can't memory map the disk\n";
+    return -1;
+  }
+  if (async && disk.EnableAsyncIO(asynctype)!=ERROR_NOERROR) {
+    cerr << "Can't do asynchronous I/O\n";
+    return -1;
+  }
+
+  if (numthreads<1 || numthreads>=numblocks || numshards<1) {
+    usage();
+    exit(-1);
+  }
+
+  BufferCache cache(&disk,cachesize,POLICY_LRU,numshards);
+  double reqtime;
+  ERROR_T rc;
+
+  // Start from what is on the disk now
+  vector<Block> shadow(numblocks);
+  for (SIZE_T b=0;b<numblocks;b++) {
+    rc=disk.Read(b,shadow[b],reqtime);
+    if (rc!=ERROR_NOERROR) {
+      cerr << "Error " << rc << " occured when reading block " << b << endl;
+      return -1;
+    }
+  }
+
+  rc=cache.SetWriteBackWatermarks(.5,.25);
+  if (rc!=ERROR_NOERROR) {
+    cerr << "Error " << rc << " occured when setting the watermarks\n";
+    return -1;
+  }
+  rc=cache.Attach();
+  if (rc!=ERROR_NOERROR) {
+    cerr << "Error " << rc << " occured when attaching the cache\n";
+    return -1;
+  }
+
+  vector<thread> threads;
+  for (SIZE_T t=0;t<numthreads;t++) {
+    threads.push_back(thread(Stress,ref(cache),t,numthreads,numops,seed,ref(shadow)));
+  }
+  for (SIZE_T t=0;t<numthreads;t++) {
+    threads[t].join();
+  }
+
+  rc=cache.Detach();
+  if (rc!=ERROR_NOERROR) {
+    cerr << "Error " << rc << " occured when detaching the cache\n";
+    return -1;
+  }
+
+  // Everything should now be on the disk
+  for (SIZE_T b=0;b<numblocks;b++) {
+    Block block;
+    rc=disk.Read(b,block,reqtime);
+    if (rc!=ERROR_NOERROR) {
+      cerr << "Error " << rc << " occured when reading block " << b << endl;
+      return -1;
+    }
+    if (!Same(block,shadow[b])) {
+      cerr << "Block " << b << " on the disk after Detach does not match what was written\n";
+      numerrors++;
+    }
+  }
+
+  cerr << "numthreads      = " << numthreads << endl;
+  cerr << "numshards       = " << cache.GetNumShards() << endl;
+  cerr << "numops          = " << numops << " per thread\n";
+  cerr << "numreads        = " << cache.GetNumReads() << endl;
+  cerr << "numwrites       = " << cache.GetNumWrites() << endl;
+  cerr << "numdiskreads    = " << cache.GetNumDiskReads() << endl;
+  cerr << "numdiskwrites   = " << cache.GetNumDiskWrites() << endl;
+  cerr << "numwritebacks   = " << cache.GetNumWriteBacks() << endl;
+  cerr << "mismatches      = " << numerrors << endl;
+
+  return (numerrors==0 && numfailures==0) ? 0 : -1;
+}
@@ -0,0 +1,379 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buffercache.h"
+
+
+void usage()
+{
+  cerr << "usage: stressdisk filestem cachesize numops [seed] [MMAP] [ASYNC|THREADS]\n";
+  cerr << "       Random reads and writes of the disk, and then of a buffer\n";
+  cerr << "       cache over it, checked against a copy kept in memory\n";
+  cerr << "       MMAP reads and writes the disk through a memory mapping\n";
+  cerr << "       ASYNC overlaps the disk's requests with io_uring, THREADS\n";
+  cerr << "       with the thread pool\n";
+}
+
+// The copy of the disk we check against
+static vector<Block> shadow;
+static SIZE_T numerrors=0;
+
+static void Check(const char *what, const SIZE_T blocknum, const Block &block)
+{
+  if (!(block==shadow[blocknum])) {
+    cerr << what << " of block " << blocknum << " does not match what was written\n";
+    numerrors++;
+  }
+}
+
+static void Fill(Block &block)
+{
+  for (SIZE_T j=0;j<block.length;j++) {
+    block.data[j]=rand();
+  }
+}
+
+// A random run of at most 8 blocks
+static void PickRun(const SIZE_T numblocks, SIZE_T &first, SIZE_T &num)
+{
+  first=rand()%numblocks;
+  num=1+rand()%8;
+  if (first+num>numblocks) {
+    num=numblocks-first;
+  }
+}
+
+static ERROR_T StressDisk(DiskSystem &disk, const SIZE_T numops)
+{
+  SIZE_T numblocks=disk.GetNumBlocks();
+  SIZE_T blocksize=disk.GetBlockSize();
+  double reqtime;
+  ERROR_T rc;
+
+  // Reads in flight, with what each should find
+  map<SIZE_T, vector<Block> > reads;
+  map<SIZE_T, SIZE_T> readfirst;
+  // Writes in flight that we will Complete
+  vector<SIZE_T> writes;
+
+  for (SIZE_T i=0;i<numops;i++) {
+    SIZE_T first, num;
+    PickRun(numblocks,first,num);
+
+    switch (rand()%8) {
+    case 0:
+    case 1: {
+      vector<Block> blocks(num,Block(blocksize));
+      for (SIZE_T j=0;j<num;j++) {
+	Fill(blocks[j]);
+      }
+      rc=disk.Write(first,num,blocks,reqtime);
+      if (rc!=ERROR_NOERROR) {
+	return rc;
+      }
+      for (SIZE_T j=0;j<num;j++) {
+	shadow[first+j]=blocks[j];
+      }
+    }
+      break;
+    case 2: {
+      vector<Block> blocks;
+      rc=disk.Read(first,num,blocks,reqtime);
+      if (rc!=ERROR_NOERROR) {
+	return rc;
+      }
+      for (SIZE_T j=0;j<num;j++) {
+	Check("Read",first+j,blocks[j]);
+      }
+    }
+      break;
+    case 3:
+    case 4: {
+      // with an id half the time; the rest are only reaped by
+      // CompleteAll
+      vector<Block> blocks(num,Block(blocksize));
+      SIZE_T request;
+      for (SIZE_T j=0;j<num;j++) {
+	Fill(blocks[j]);
+      }
+      bool withid=rand()%2;
+      rc=disk.SubmitWrite(first,num,blocks,reqtime,withid ? &request : 0);
+      if (rc!=ERROR_NOERROR) {
+	return rc;
+      }
+      if (withid) {
+	writes.push_back(request);
+      }
+      // Blocks the caller can change right after the submit
+      for (SIZE_T j=0;j<num;j++) {
+	shadow[first+j]=blocks[j];
+	Fill(blocks[j]);
+      }
+    }
+      break;
+    case 5: {
+      SIZE_T request;
+      rc=disk.SubmitRead(first,num,reqtime,request);
+      if (rc!=ERROR_NOERROR) {
+	return rc;
+      }
+      readfirst[request]=first;
+      for (SIZE_T j=0;j<num;j++) {
+	reads[request].push_back(shadow[first+j]);
+      }
+    }
+      break;
+    case 6: {
+      // Complete one of each that is in flight, if any
+      if (!reads.empty()) {
+	map<SIZE_T, vector<Block> >::iterator r=reads.begin();
+	vector<Block> blocks;
+	disk.IsComplete((*r).first);
+	rc=disk.Complete((*r).first,&blocks);
+	if (rc!=ERROR_NOERROR) {
+	  return rc;
+	}
+	if (blocks.size()!=(*r).second.size()) {
+	  cerr << "Completed read of block " << readfirst[(*r).first] << " has the wrong number of blocks\n";
+	  numerrors++;
+	} else {
+	  for (SIZE_T j=0;j<blocks.size();j++) {
+	    if (!(blocks[j]==(*r).second[j])) {
+	      cerr << "Completed read of block " << readfirst[(*r).first]+j << " does not match what was written before it was submitted\n";
+	      numerrors++;
+	    }
+	  }
+	}
+	readfirst.erase((*r).first);
+	reads.erase(r);
+      }
+      if (!writes.empty()) {
+	rc=disk.Complete(writes.back());
+	if (rc!=ERROR_NOERROR) {
+	  return rc;
+	}
+	writes.pop_back();
+      }
+    }
+      break;
+    case 7:
+      if (rand()%4==0) {
+	rc=disk.Sync();
+	if (rc!=ERROR_NOERROR) {
+	  return rc;
+	}
+      }
+      break;
+    }
+  }
+
+  // Finish whatever is left, then read everything back
+  for (map<SIZE_T, vector<Block> >::iterator r=reads.begin();r!=reads.end();++r) {
+    rc=disk.Complete((*r).first);
+    if (rc!=ERROR_NOERROR) {
+      return rc;
+    }
+  }
+  for (SIZE_T j=0;j<writes.size();j++) {
+    rc=disk.Complete(writes[j]);
+    if (rc!=ERROR_NOERROR) {
+      return rc;
+    }
+  }
+  rc=disk.CompleteAll();
+  if (rc!=ERROR_NOERROR) {
+    return rc;
+  }
+  rc=disk.Sync();
+  if (rc!=ERROR_NOERROR) {
+    return rc;
+  }
+  for (SIZE_T b=0;b<numblocks;b++) {
+    Block block;
+    rc=disk.Read(b,block,reqtime);
+    if (rc!=ERROR_NOERROR) {
+      return rc;
+    }
+    Check("Final read of the disk",b,block);
+  }
+  return ERROR_NOERROR;
+}
+
+static ERROR_T StressCache(DiskSystem &disk, const SIZE_T cachesize, const SIZE_T numops)
+{
+  SIZE_T numblocks=disk.GetNumBlocks();
+  SIZE_T blocksize=disk.GetBlockSize();
+  BufferCache cache(&disk,cachesize);
+  ERROR_T rc;
+
+  // Start write back well before the cache is all dirty
+  rc=cache.SetWriteBackWatermarks(.5,.25);
+  if (rc!=ERROR_NOERROR) {
+    return rc;
+  }
+  rc=cache.Attach();
+  if (rc!=ERROR_NOERROR) {
+    return rc;
+  }
+
+  for (SIZE_T i=0;i<numops;i++) {
+    SIZE_T b=rand()%numblocks;
+    switch (rand()%7) {
+    case 0:
+    case 1: {
+      Block block(blocksize);
+      Fill(block);
+      rc=cache.WriteBlock(b,block);
+      if (rc!=ERROR_NOERROR) {
+	return rc;
+      }
+      shadow[b]=block;
+    }
+      break;
+    case 2:
+    case 3: {
+      Block block;
+      rc=cache.ReadBlock(b,block);
+      if (rc!=ERROR_NOERROR) {
+	return rc;
+      }
+      Check("Cached read",b,block);
+    }
+      break;
+    case 4: {
+      // change a few bytes in place, or just look
+      Block *block;
+      rc=cache.PinBlock(b,block);
+      if (rc!=ERROR_NOERROR) {
+	return rc;
+      }
+      Check("Pinned read",b,*block);
+      bool dirty=rand()%2;
+      if (dirty) {
+	block->data[rand()%blocksize]=rand();
+	shadow[b]=*block;
+      }
+      rc=cache.UnpinBlock(b,dirty);
+      if (rc!=ERROR_NOERROR) {
+	return rc;
+      }
+    }
+      break;
+    case 5:
+      rc=cache.PrefetchBlock(b);
+      if (rc!=ERROR_NOERROR && rc!=ERROR_NOFETCH) {
+	return rc;
+      }
+      break;
+    case 6:
+      rc=cache.FlushBlock(b);
+      if (rc!=ERROR_NOERROR) {
+	return rc;
+      }
+      break;
+    }
+  }
+
+  rc=cache.Detach();
+  if (rc!=ERROR_NOERROR) {
+    return rc;
+  }
+
+  // Everything should now be on the disk
+  double reqtime;
+  for (SIZE_T b=0;b<numblocks;b++) {
+    Block block;
+    rc=disk.Read(b,block,reqtime);
+    if (rc!=ERROR_NOERROR) {
+      return rc;
+    }
+    Check("Read after Detach",b,block);
+  }
+  return ERROR_NOERROR;
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc<4 || argc>7) {
+    usage();
+    exit(-1);
+  }
+  SIZE_T cachesize=atoi(argv[2]);
+  SIZE_T numops=atoll(argv[3]);
+  unsigned seed=1;
+  bool memorymap=false;
+  bool async=false;
+  AsyncIOType asynctype=ASYNCIO_URING;
+
+  for (int i=4;i<argc;i++) {
+    if (string(argv[i])=="MMAP") {
+      memorymap=true;
+    } else if (string(argv[i])=="ASYNC") {
+      async=true;
+      asynctype=ASYNCIO_URING;
+    } else if (string(argv[i])=="THREADS") {
+      async=true;
+      asynctype=ASYNCIO_THREADS;
+    } else if (i==4 && atoi(argv[i])>0) {
+      seed=atoi(argv[i]);
+    } else {
+      usage();
+      exit(-1);
+    }
+  }
+
+  srand(seed);
+
+  unique_ptr<DiskSystem> diskp(OpenDiskSystem(argv[1]));
+  DiskSystem &disk=*diskp;
+
+  if (memorymap && disk.EnableMemoryMap()!=ERROR_NOERROR) {
+    cerr << "Can't memory map the disk\n";
+    return -1;
+  }
+  if (async && disk.EnableAsyncIO(asynctype)!=ERROR_NOERROR) {
+    cerr << "Can't do asynchronous I/O\n";
+    return -1;
+  }
+
+  SIZE_T numblocks=disk.GetNumBlocks();
+  double reqtime;
+  ERROR_T rc;
+
+  // Start from what is on the disk now
+  shadow.resize(numblocks);
+  for (SIZE_T b=0;b<numblocks;b++) {
+    rc=disk.Read(b,shadow[b],reqtime);
+    if (rc!=ERROR_NOERROR) {
+      cerr << "Error " << rc << " occured when reading block " << b << endl;
+      return -1;
+    }
+  }
+
+  rc=StressDisk(disk,numops);
+  if (rc!=ERROR_NOERROR) {
+    cerr << "Error " << rc << " occured in the disk stress\n";
+    return -1;
+  }
+  rc=StressCache(disk,cachesize,numops);
+  if (rc!=ERROR_NOERROR) {
+    cerr << "Error " << rc << " occured in the cache stress\n";
+    return -1;
+  }
+
+  AsyncIOType type;
+  cerr << "engine          = ";
+  if (!disk.GetAsyncIOType(type)) {
+    cerr << "none";
+  } else {
+    cerr << (type==ASYNCIO_URING ? "io_uring" : "threads");
+  }
+  cerr << (disk.IsMemoryMapped() ? ", memory mapped" : "") << endl;
+  cerr << "numops          = " << numops << " on the disk, " << numops << " on the cache\n";
+  cerr << "mismatches      = " << numerrors << endl;
+
+  return numerrors==0 ? 0 : -1;
+}
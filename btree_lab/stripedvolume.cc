@@ -0,0 +1,702 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <string.h>
+#include <stdio.h>
+
+#include <algorithm>
+
+#include "stripedvolume.h"
+
+
+#define STRIPEDVOLUME_MAGIC "# striped volume config file"
+
+
+StripedVolume::StripedVolume(const string &filestem,
+			     const bool   create,
+			     const SIZE_T unit,
+			     const vector<string> &stems) :
+  DiskSystem(),
+  stripeunit(unit),
+  memberstems(stems),
+  batching(false),
+  nextrequest(1)
+{
+  SIZE_T blocks, blocksize;
+
+  if (!create && ReadConfig(filestem)!=ERROR_NOERROR) {
+    cerr << "Can't read the volume configuration.\n";
+    return;
+  }
+
+  if (OpenMembers(blocks,blocksize)!=ERROR_NOERROR) {
+    return;
+  }
+
+  if (create) {
+    struct stat s;
+
+    if (stat((filestem+".config").c_str(),&s)!=-1 ||
+	stat((filestem+".bitmap").c_str(),&s)!=-1) {
+      cerr << "Configuration or bitmap files exist for this name!\n";
+      return;
+    }
+    if (WriteConfig(filestem)!=ERROR_NOERROR) {
+      return;
+    }
+  }
+
+  InitWithoutData(filestem,blocks,blocksize,create);
+}
+
+StripedVolume::~StripedVolume()
+{
+  CompleteAll();
+  requests.clear();
+  for (SIZE_T i=0;i<members.size();i++) {
+    delete members[i];
+  }
+  members.clear();
+}
+
+bool StripedVolume::IsStripedVolume(const string &filestem)
+{
+  FILE *f;
+  char buf[80];
+  bool isvolume;
+
+  if ((f=fopen((filestem+".config").c_str(),"r"))==0) {
+    return false;
+  }
+  isvolume = fgets(buf,80,f) && !strncmp(buf,STRIPEDVOLUME_MAGIC,strlen(STRIPEDVOLUME_MAGIC));
+  fclose(f);
+  return isvolume;
+}
+
+
+ERROR_T StripedVolume::WriteConfig(const string &filestem)
+{
+  FILE *f;
+
+  if ((f=fopen((filestem+".config").c_str(),"w"))==0) {
+    return ERROR_NOFILE;
+  }
+  fprintf(f,"%s version 1.0\n",STRIPEDVOLUME_MAGIC);
+  fprintf(f,"# filestem\n");
+  fprintf(f,"%s\n",filestem.c_str());
+  fprintf(f,"# stripeunit\n");
+  fprintf(f,"%llu\n",stripeunit);
+  fprintf(f,"# nummembers\n");
+  fprintf(f,"%llu\n",(SIZE_T)memberstems.size());
+  for (SIZE_T i=0;i<memberstems.size();i++) {
+    fprintf(f,"# member\n");
+    fprintf(f,"%s\n",memberstems[i].c_str());
+  }
+  fclose(f);
+
+  return ERROR_NOERROR;
+}
+
+ERROR_T StripedVolume::ReadConfig(const string &filestem)
+{
+  FILE *f;
+  char buf[1024];
+  SIZE_T num=0;
+
+#define GETNEXTLINE do { if (!fgets(buf,1024,f)) { fclose(f); return ERROR_BADCONFIG; } } while (buf[0]=='#')
+#define CHOMP do { if (strlen(buf)>0 && buf[strlen(buf)-1]=='\n') { buf[strlen(buf)-1]=0; } } while (0)
+
+  if ((f=fopen((filestem+".config").c_str(),"r"))==0) {
+    return ERROR_NOFILE;
+  }
+  // filestem, which is just for show
+  GETNEXTLINE;
+  GETNEXTLINE;
+  sscanf(buf,"%llu",&stripeunit);
+  GETNEXTLINE;
+  sscanf(buf,"%llu",&num);
+  memberstems.clear();
+  for (SIZE_T i=0;i<num;i++) {
+    GETNEXTLINE;
+    CHOMP;
+    memberstems.push_back(string(buf));
+  }
+  fclose(f);
+
+  return ERROR_NOERROR;
+}
+
+ERROR_T StripedVolume::OpenMembers(SIZE_T &blocks, SIZE_T &blocksize)
+{
+  SIZE_T rows=0;
+
+  blocks=blocksize=0;
+
+  if (memberstems.size()<1 || stripeunit<1) {
+    cerr << "A volume needs at least one member and a stripe unit of at least one block.\n";
+    return ERROR_BADCONFIG;
+  }
+
+  for (SIZE_T i=0;i<memberstems.size();i++) {
+    DiskSystem *d=OpenDiskSystem(memberstems[i]);
+
+    members.push_back(d);
+    if (d->GetNumBlocks()<stripeunit) {
+      cerr << "Member "<<memberstems[i]<<" is missing or smaller than one stripe unit.\n";
+      return ERROR_BADCONFIG;
+    }
+    if (i==0) {
+      blocksize=d->GetBlockSize();
+      rows=d->GetNumBlocks()/stripeunit;
+    } else {
+      if (d->GetBlockSize()!=blocksize) {
+	cerr << "Member "<<memberstems[i]<<" has a different block size.\n";
+	return ERROR_BADCONFIG;
+      }
+      rows=min(rows,d->GetNumBlocks()/stripeunit);
+    }
+  }
+
+  blocks=rows*stripeunit*members.size();
+  return ERROR_NOERROR;
+}
+
+
+SIZE_T StripedVolume::GetStripeUnit() const
+{
+  return stripeunit;
+}
+
+SIZE_T StripedVolume::GetNumMembers() const
+{
+  return members.size();
+}
+
+
+void StripedVolume::Split(const SIZE_T first,
+			  const SIZE_T num,
+			  vector<SIZE_T> &memberfirst,
+			  vector<SIZE_T> &membernum) const
+{
+  SIZE_T n=members.size();
+
+  memberfirst.assign(n,0);
+  membernum.assign(n,0);
+
+  // a stripe unit at a time
+  for (SIZE_T b=first; b<first+num; ) {
+    SIZE_T stripe=b/stripeunit;
+    SIZE_T m=stripe%n;
+    SIZE_T end=min((stripe+1)*stripeunit,first+num);
+
+    if (membernum[m]==0) {
+      memberfirst[m]=(stripe/n)*stripeunit+b%stripeunit;
+    }
+    membernum[m]+=end-b;
+    b=end;
+  }
+}
+
+void StripedVolume::Gather(const SIZE_T first,
+			   const SIZE_T num,
+			   vector<vector<Block> > &memberblocks,
+			   vector<Block> &blocks) const
+{
+  vector<SIZE_T> next(members.size(),0);
+  SIZE_T start=blocks.size();
+
+  blocks.resize(start+num);
+  for (SIZE_T i=0;i<num;i++) {
+    SIZE_T m=((first+i)/stripeunit)%members.size();
+    Block &from=memberblocks[m][next[m]++];
+    Block &to=blocks[start+i];
+    // hand the data over instead of copying it
+    swap(from.data,to.data);
+    swap(from.length,to.length);
+  }
+}
+
+
+ERROR_T StripedVolume::Read(const SIZE_T   inoffblock,
+			    const SIZE_T   numblock,
+			    vector<Block> &blocks,
+			    double        &reqtime)
+{
+  reqtime=0;
+
+  if (inoffblock+numblock > GetNumBlocks()) {
+    cerr << "StripedVolume::Read: Attempt to read blocks "<<inoffblock<<" to "<<(inoffblock+numblock-1)<<", but maxmimum block is only "<<(GetNumBlocks()-1)<<endl;
+    return ERROR_NOSPACE;
+  }
+
+  if (!batching) {
+    // Start every member's part, then wait for them all
+    SIZE_T request;
+    ERROR_T rc=SubmitRead(inoffblock,numblock,reqtime,request);
+    if (rc!=ERROR_NOERROR) {
+      return rc;
+    }
+    return Complete(request,&blocks);
+  }
+
+  // A blocking read in the middle of a batch isn't queued with it,
+  // so it can't be submitted
+  vector<SIZE_T> mfirst, mnum;
+  vector<vector<Block> > mblocks(members.size());
+  ERROR_T rc=ERROR_NOERROR;
+
+  Split(inoffblock,numblock,mfirst,mnum);
+  for (SIZE_T m=0;m<members.size();m++) {
+    if (mnum[m]>0) {
+      double t;
+      ERROR_T mrc=members[m]->Read(mfirst[m],mnum[m],mblocks[m],t);
+      if (mrc!=ERROR_NOERROR && rc==ERROR_NOERROR) {
+	rc=mrc;
+      }
+      reqtime=max(reqtime,t);
+    }
+  }
+  if (rc==ERROR_NOERROR) {
+    Gather(inoffblock,numblock,mblocks,blocks);
+  }
+  return rc;
+}
+
+ERROR_T StripedVolume::Write(const SIZE_T   inoffblock,
+			     const SIZE_T   numblock,
+			     const vector<Block> &blocks,
+			     double        &reqtime)
+{
+  reqtime=0;
+
+  if (inoffblock+numblock > GetNumBlocks()) {
+    cerr << "StripedVolume::Write: Attempt to write blocks "<<inoffblock<<" to "<<(inoffblock+numblock-1)<<", but maxmimum block is only "<<(GetNumBlocks()-1)<<endl;
+    return ERROR_NOSPACE;
+  }
+
+  if (!batching) {
+    SIZE_T request;
+    ERROR_T rc=SubmitWrite(inoffblock,numblock,blocks,reqtime,&request);
+    if (rc!=ERROR_NOERROR) {
+      return rc;
+    }
+    return Complete(request);
+  }
+
+  vector<SIZE_T> mfirst, mnum;
+  vector<vector<Block> > mblocks(members.size());
+  ERROR_T rc=ERROR_NOERROR;
+
+  Split(inoffblock,numblock,mfirst,mnum);
+  for (SIZE_T i=0;i<numblock;i++) {
+    mblocks[((inoffblock+i)/stripeunit)%members.size()].push_back(blocks[i]);
+  }
+  for (SIZE_T m=0;m<members.size();m++) {
+    if (mnum[m]>0) {
+      double t;
+      ERROR_T mrc=members[m]->Write(mfirst[m],mnum[m],mblocks[m],t);
+      if (mrc!=ERROR_NOERROR && rc==ERROR_NOERROR) {
+	rc=mrc;
+      }
+      reqtime=max(reqtime,t);
+    }
+  }
+  return rc;
+}
+
+
+ERROR_T StripedVolume::ReadV(const SIZE_T   inoffblock,
+			     const SIZE_T   numblock,
+			     BYTE_T * const bufs[],
+			     double        &reqtime)
+{
+  reqtime=0;
+
+  if (inoffblock+numblock > GetNumBlocks()) {
+    cerr << "StripedVolume::Read: Attempt to read blocks "<<inoffblock<<" to "<<(inoffblock+numblock-1)<<", but maxmimum block is only "<<(GetNumBlocks()-1)<<endl;
+    return ERROR_NOSPACE;
+  }
+
+  vector<SIZE_T> mfirst, mnum;
+  vector<vector<BYTE_T *> > mbufs(members.size());
+  ERROR_T rc=ERROR_NOERROR;
+
+  Split(inoffblock,numblock,mfirst,mnum);
+  for (SIZE_T i=0;i<numblock;i++) {
+    mbufs[((inoffblock+i)/stripeunit)%members.size()].push_back(bufs[i]);
+  }
+  for (SIZE_T m=0;m<members.size();m++) {
+    if (mnum[m]>0) {
+      double t;
+      ERROR_T mrc=members[m]->ReadV(mfirst[m],mnum[m],&(mbufs[m][0]),t);
+      if (mrc!=ERROR_NOERROR && rc==ERROR_NOERROR) {
+	rc=mrc;
+      }
+      reqtime=max(reqtime,t);
+    }
+  }
+  return rc;
+}
+
+ERROR_T StripedVolume::WriteV(const SIZE_T   inoffblock,
+			      const SIZE_T   numblock,
+			      const BYTE_T * const bufs[],
+			      double        &reqtime)
+{
+  reqtime=0;
+
+  if (inoffblock+numblock > GetNumBlocks()) {
+    cerr << "StripedVolume::Write: Attempt to write blocks "<<inoffblock<<" to "<<(inoffblock+numblock-1)<<", but maxmimum block is only "<<(GetNumBlocks()-1)<<endl;
+    return ERROR_NOSPACE;
+  }
+
+  vector<SIZE_T> mfirst, mnum;
+  vector<vector<const BYTE_T *> > mbufs(members.size());
+  ERROR_T rc=ERROR_NOERROR;
+
+  Split(inoffblock,numblock,mfirst,mnum);
+  for (SIZE_T i=0;i<numblock;i++) {
+    mbufs[((inoffblock+i)/stripeunit)%members.size()].push_back(bufs[i]);
+  }
+  for (SIZE_T m=0;m<members.size();m++) {
+    if (mnum[m]>0) {
+      double t;
+      ERROR_T mrc=members[m]->WriteV(mfirst[m],mnum[m],&(mbufs[m][0]),t);
+      if (mrc!=ERROR_NOERROR && rc==ERROR_NOERROR) {
+	rc=mrc;
+      }
+      reqtime=max(reqtime,t);
+    }
+  }
+  return rc;
+}
+
+
+ERROR_T StripedVolume::Sync()
+{
+  ERROR_T rc=ERROR_NOERROR;
+
+  for (SIZE_T m=0;m<members.size();m++) {
+    ERROR_T mrc=members[m]->Sync();
+    if (mrc!=ERROR_NOERROR && rc==ERROR_NOERROR) {
+      rc=mrc;
+    }
+  }
+  return rc;
+}
+
+void StripedVolume::SetSyncWrites(const bool sync)
+{
+  for (SIZE_T m=0;m<members.size();m++) {
+    members[m]->SetSyncWrites(sync);
+  }
+}
+
+ERROR_T StripedVolume::EnableMemoryMap()
+{
+  for (SIZE_T m=0;m<members.size();m++) {
+    ERROR_T rc=members[m]->EnableMemoryMap();
+    if (rc!=ERROR_NOERROR) {
+      return rc;
+    }
+  }
+  return ERROR_NOERROR;
+}
+
+bool StripedVolume::IsMemoryMapped() const
+{
+  for (SIZE_T m=0;m<members.size();m++) {
+    if (!members[m]->IsMemoryMapped()) {
+      return false;
+    }
+  }
+  return members.size()>0;
+}
+
+ERROR_T StripedVolume::EnableAsyncIO(const AsyncIOType type)
+{
+  for (SIZE_T m=0;m<members.size();m++) {
+    ERROR_T rc=members[m]->EnableAsyncIO(type);
+    if (rc!=ERROR_NOERROR) {
+      return rc;
+    }
+  }
+  return ERROR_NOERROR;
+}
+
+bool StripedVolume::GetAsyncIOType(AsyncIOType &type) const
+{
+  return members.size()>0 && members[0]->GetAsyncIOType(type);
+}
+
+
+ERROR_T StripedVolume::SubmitRead(const SIZE_T inoffblock,
+				  const SIZE_T numblock,
+				  double &reqtime,
+				  SIZE_T &request)
+{
+  reqtime=0;
+
+  if (inoffblock+numblock > GetNumBlocks()) {
+    cerr << "StripedVolume::SubmitRead: Attempt to read blocks "<<inoffblock<<" to "<<(inoffblock+numblock-1)<<", but maxmimum block is only "<<(GetNumBlocks()-1)<<endl;
+    return ERROR_NOSPACE;
+  }
+
+  vector<SIZE_T> mfirst, mnum;
+  VolumeRequest r;
+
+  r.first=inoffblock;
+  r.num=numblock;
+  r.write=false;
+  r.parts.assign(members.size(),0);
+
+  Split(inoffblock,numblock,mfirst,mnum);
+  for (SIZE_T m=0;m<members.size();m++) {
+    if (mnum[m]>0) {
+      double t;
+      ERROR_T rc=members[m]->SubmitRead(mfirst[m],mnum[m],t,r.parts[m]);
+      if (rc!=ERROR_NOERROR) {
+	// drop whatever parts did start
+	r.parts[m]=0;
+	CompleteParts(r,0);
+	return rc;
+      }
+      reqtime=max(reqtime,t);
+    }
+  }
+
+  request=nextrequest++;
+  requests[request]=r;
+  return ERROR_NOERROR;
+}
+
+ERROR_T StripedVolume::SubmitWrite(const SIZE_T inoffblock,
+				   const SIZE_T numblock,
+				   const vector<Block> &blocks,
+				   double &reqtime,
+				   SIZE_T *request)
+{
+  reqtime=0;
+
+  if (inoffblock+numblock > GetNumBlocks()) {
+    cerr << "StripedVolume::SubmitWrite: Attempt to write blocks "<<inoffblock<<" to "<<(inoffblock+numblock-1)<<", but maxmimum block is only "<<(GetNumBlocks()-1)<<endl;
+    return ERROR_NOSPACE;
+  }
+
+  vector<SIZE_T> mfirst, mnum;
+  vector<vector<Block> > mblocks(members.size());
+  VolumeRequest r;
+  ERROR_T rc=ERROR_NOERROR;
+
+  r.first=inoffblock;
+  r.num=numblock;
+  r.write=true;
+  r.parts.assign(members.size(),0);
+
+  Split(inoffblock,numblock,mfirst,mnum);
+  for (SIZE_T i=0;i<numblock;i++) {
+    mblocks[((inoffblock+i)/stripeunit)%members.size()].push_back(blocks[i]);
+  }
+  for (SIZE_T m=0;m<members.size();m++) {
+    if (mnum[m]>0) {
+      double t;
+      // with no id, each part is left to the member to finish
+      ERROR_T mrc=members[m]->SubmitWrite(mfirst[m],mnum[m],mblocks[m],t,request ? &(r.parts[m]) : 0);
+      if (mrc!=ERROR_NOERROR) {
+	if (request) {
+	  r.parts[m]=0;
+	  CompleteParts(r,0);
+	  return mrc;
+	}
+	if (rc==ERROR_NOERROR) {
+	  rc=mrc;
+	}
+      }
+      reqtime=max(reqtime,t);
+    }
+  }
+
+  if (request) {
+    *request=nextrequest++;
+    requests[*request]=r;
+  }
+  return rc;
+}
+
+
+void StripedVolume::SetScheduler(const DiskSchedulerType type)
+{
+  DiskSystem::SetScheduler(type);
+  for (SIZE_T m=0;m<members.size();m++) {
+    members[m]->SetScheduler(type);
+  }
+}
+
+void StripedVolume::StartBatch()
+{
+  batching=true;
+  for (SIZE_T m=0;m<members.size();m++) {
+    members[m]->StartBatch();
+  }
+}
+
+void StripedVolume::EndBatch(vector<double> &reqtimes)
+{
+  vector<double> done;
+
+  batching=false;
+
+  // When each member request finishes, from the start of the batch
+  for (SIZE_T m=0;m<members.size();m++) {
+    vector<double> times;
+    double t=0;
+    members[m]->EndBatch(times);
+    for (SIZE_T i=0;i<times.size();i++) {
+      t+=times[i];
+      done.push_back(t);
+    }
+  }
+  sort(done.begin(),done.end());
+
+  reqtimes.clear();
+  for (SIZE_T i=0;i<done.size();i++) {
+    reqtimes.push_back(i==0 ? done[i] : done[i]-done[i-1]);
+  }
+}
+
+
+SIZE_T StripedVolume::GetNumRequests() const
+{
+  SIZE_T n=0;
+
+  for (SIZE_T m=0;m<members.size();m++) {
+    n+=members[m]->GetNumRequests();
+  }
+  return n;
+}
+
+double StripedVolume::GetSeekTime() const
+{
+  double t=0;
+
+  for (SIZE_T m=0;m<members.size();m++) {
+    t+=members[m]->GetSeekTime();
+  }
+  return t;
+}
+
+double StripedVolume::GetRotationTime() const
+{
+  double t=0;
+
+  for (SIZE_T m=0;m<members.size();m++) {
+    t+=members[m]->GetRotationTime();
+  }
+  return t;
+}
+
+double StripedVolume::GetTransferTime() const
+{
+  double t=0;
+
+  for (SIZE_T m=0;m<members.size();m++) {
+    t+=members[m]->GetTransferTime();
+  }
+  return t;
+}
+
+
+ERROR_T StripedVolume::CompleteParts(const VolumeRequest &r, vector<Block> *blocks)
+{
+  vector<vector<Block> > mblocks(members.size());
+  ERROR_T rc=ERROR_NOERROR;
+
+  for (SIZE_T m=0;m<members.size();m++) {
+    if (r.parts[m]) {
+      ERROR_T mrc=members[m]->Complete(r.parts[m],r.write ? 0 : &(mblocks[m]));
+      if (mrc!=ERROR_NOERROR && rc==ERROR_NOERROR) {
+	rc=mrc;
+      }
+    }
+  }
+  if (rc==ERROR_NOERROR && !r.write && blocks) {
+    Gather(r.first,r.num,mblocks,*blocks);
+  }
+  return rc;
+}
+
+bool StripedVolume::IsComplete(const SIZE_T request)
+{
+  map<SIZE_T, VolumeRequest>::const_iterator i=requests.find(request);
+
+  if (i==requests.end()) {
+    return true;
+  }
+  for (SIZE_T m=0;m<members.size();m++) {
+    if ((*i).second.parts[m] && !members[m]->IsComplete((*i).second.parts[m])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+ERROR_T StripedVolume::Complete(const SIZE_T request, vector<Block> *blocks)
+{
+  map<SIZE_T, VolumeRequest>::iterator i=requests.find(request);
+
+  if (i==requests.end()) {
+    return ERROR_NONEXISTENT;
+  }
+
+  VolumeRequest r=(*i).second;
+  requests.erase(i);
+  return CompleteParts(r,blocks);
+}
+
+ERROR_T StripedVolume::CompleteAll()
+{
+  ERROR_T rc=ERROR_NOERROR;
+
+  for (SIZE_T m=0;m<members.size();m++) {
+    ERROR_T mrc=members[m]->CompleteAll();
+    if (mrc!=ERROR_NOERROR && rc==ERROR_NOERROR) {
+      rc=mrc;
+    }
+  }
+  return rc;
+}
+
+
+ERROR_T StripedVolume::GetDataStamp(string &stamp)
+{
+  stamp="";
+  for (SIZE_T m=0;m<members.size();m++) {
+    string s;
+    ERROR_T rc=members[m]->GetDataStamp(s);
+    if (rc!=ERROR_NOERROR) {
+      return rc;
+    }
+    stamp += (m>0 ? "," : "") + s;
+  }
+  return ERROR_NOERROR;
+}
+
+
+ostream & StripedVolume::Print(ostream &os) const
+{
+  os << "StripedVolume(diskfilestem="<<GetFileStem()
+     << ", numblocks="<<GetNumBlocks()
+     << ", blocksize="<<GetBlockSize()
+     << ", stripeunit="<<stripeunit
+     << ", members=(";
+  for (SIZE_T m=0;m<members.size();m++) {
+    if (m>0) {
+      os << ", ";
+    }
+    members[m]->Print(os);
+  }
+  os << "), bitmap=";
+  PrintBitMap(os);
+  os << ")";
+  return os;
+}
@@ -0,0 +1,153 @@
+#ifndef _stripedvolume
+#define _stripedvolume
+
+#include <string>
+#include <iostream>
+#include <vector>
+#include <map>
+
+#include "global.h"
+#include "block.h"
+#include "disksystem.h"
+
+using namespace std;
+
+//
+// A RAID-0 volume striped across several disks
+//
+// The volume's blocks are dealt out to the member disks a stripe
+// unit at a time: blocks 0..unit-1 go to the first member, the next
+// unit to the second, and so on around.  A run of blocks on the
+// volume is a single run on each member it touches.  Each member
+// keeps its own head position and its own time, and they all work
+// at once, so a request to the volume takes as long as the slowest
+// member's part of it.  With asynchronous I/O enabled, the real
+// transfers to the members overlap too.
+//
+// The volume has its own filestem.config and filestem.bitmap, but no
+// data file.  The members are ordinary disks made with makedisk (or
+// volumes themselves), and their own bitmaps are not used.  The
+// volume is as big as its smallest member allows.
+//
+class StripedVolume : public DiskSystem {
+ private:
+  SIZE_T               stripeunit;
+  vector<string>       memberstems;
+  vector<DiskSystem *> members;
+  bool                 batching;
+
+  // A request to the volume, as a request to each member.  A member
+  // the request doesn't touch has 0.
+  struct VolumeRequest {
+    SIZE_T         first;
+    SIZE_T         num;
+    bool           write;
+    vector<SIZE_T> parts;
+  };
+
+  map<SIZE_T, VolumeRequest> requests;
+  SIZE_T                     nextrequest;
+
+  ERROR_T ReadConfig(const string &filestem);
+  ERROR_T WriteConfig(const string &filestem);
+  // Opens the members and works out how big the volume can be
+  ERROR_T OpenMembers(SIZE_T &blocks, SIZE_T &blocksize);
+
+  // Where the run first..first+num-1 falls on each member.  Members
+  // it misses get a count of 0.
+  void    Split(const SIZE_T first,
+		const SIZE_T num,
+		vector<SIZE_T> &memberfirst,
+		vector<SIZE_T> &membernum) const;
+  // Put the members' blocks of a run back in the volume's order,
+  // appending them to blocks
+  void    Gather(const SIZE_T first,
+		 const SIZE_T num,
+		 vector<vector<Block> > &memberblocks,
+		 vector<Block> &blocks) const;
+  // Collect the members' parts of a request
+  ERROR_T CompleteParts(const VolumeRequest &r, vector<Block> *blocks);
+
+ public:
+  // The config is stored in file "filestem.config".  When creating,
+  // the members must already exist and have the same block size.
+  StripedVolume(const string &filestem,
+		const bool create=false,
+		const SIZE_T stripeunit=0,
+		const vector<string> &members=vector<string>());
+  StripedVolume(const StripedVolume &rhs) { throw GenericException();}
+  StripedVolume & operator=(const StripedVolume &rhs) { throw GenericException(); return *this;}
+
+  virtual ~StripedVolume();
+
+  // Whether filestem.config describes a striped volume
+  static bool IsStripedVolume(const string &filestem);
+
+  SIZE_T GetStripeUnit() const;
+  SIZE_T GetNumMembers() const;
+
+  using DiskSystem::Read;
+  using DiskSystem::Write;
+
+  ERROR_T Read(const SIZE_T inoffblock,
+	       const SIZE_T numblock,
+	       vector<Block> &blocks,
+	       double &reqtime);
+  ERROR_T Write(const SIZE_T inoffblock,
+		const SIZE_T numblock,
+		const vector<Block> &blocks,
+		double &reqtime);
+  // Each member's part goes straight to or from the caller's
+  // buffers.  The members are modelled as working at once, but the
+  // real transfers are made one member after another.
+  ERROR_T ReadV(const SIZE_T inoffblock,
+		const SIZE_T numblock,
+		BYTE_T * const bufs[],
+		double &reqtime);
+  ERROR_T WriteV(const SIZE_T inoffblock,
+		 const SIZE_T numblock,
+		 const BYTE_T * const bufs[],
+		 double &reqtime);
+
+  // These go to every member
+  ERROR_T Sync();
+  void    SetSyncWrites(const bool sync);
+  ERROR_T EnableMemoryMap();
+  bool    IsMemoryMapped() const;
+  ERROR_T EnableAsyncIO(const AsyncIOType type=ASYNCIO_URING);
+  bool    GetAsyncIOType(AsyncIOType &type) const;
+
+  ERROR_T SubmitRead(const SIZE_T inoffblock,
+		     const SIZE_T numblock,
+		     double &reqtime,
+		     SIZE_T &request);
+  ERROR_T SubmitWrite(const SIZE_T inoffblock,
+		      const SIZE_T numblock,
+		      const vector<Block> &blocks,
+		      double &reqtime,
+		      SIZE_T *request=0);
+
+  // Each member schedules its own part of a batch.  EndBatch gives
+  // the time from one member request finishing to the next, so they
+  // add up to the time the busiest member took.
+  void    SetScheduler(const DiskSchedulerType type);
+  void    StartBatch();
+  void    EndBatch(vector<double> &reqtimes);
+
+  // Summed over the members, so with them working at once these add
+  // up to more than the time that passed
+  SIZE_T  GetNumRequests() const;
+  double  GetSeekTime() const;
+  double  GetRotationTime() const;
+  double  GetTransferTime() const;
+
+  bool    IsComplete(const SIZE_T request);
+  ERROR_T Complete(const SIZE_T request, vector<Block> *blocks=0);
+  ERROR_T CompleteAll();
+
+  ERROR_T GetDataStamp(string &stamp);
+
+  ostream & Print(ostream &os) const;
+};
+
+#endif
@@ -16,10 +16,11 @@ int main(int argc, char *argv[])
     exit(-1);
   }
   SIZE_T cachesize=atoi(argv[2]);
-  SIZE_T blocknum=atoi(argv[3]);
-  SIZE_T numblocks=atoi(argv[4]);
+  SIZE_T blocknum=atoll(argv[3]);
+  SIZE_T numblocks=atoll(argv[4]);
 
-  DiskSystem disk(argv[1]);
+  unique_ptr<DiskSystem> diskp(OpenDiskSystem(argv[1]));
+  DiskSystem &disk=*diskp;
   BufferCache cache(&disk,cachesize);
 
   SIZE_T blocksize = disk.GetBlockSize();